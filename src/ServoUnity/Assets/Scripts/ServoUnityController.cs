@@ -307,6 +307,9 @@ public class ServoUnityController : MonoBehaviour
     void Update()
     {
         servo_unity_plugin.ServoUnityFlushLog();
+        // One render event for all windows, rather than one per window.
+        int windowCount = servo_unity_plugin.ServoUnityGetWindowCount();
+        if (windowCount > 0) servo_unity_plugin.ServoUnityRequestAllWindowsUpdate(Time.deltaTime, windowCount);
     }
 
     //
@@ -472,10 +475,12 @@ public class ServoUnityController : MonoBehaviour
         }
 
         // Because Servo cleanup must happen on the GPU thread, we must wait until
-        // the GPU thread has time to process the cleanup. We assume that the GPU thread
-        // continues to be called while we block the UI thread in a spinlock servicing
-        // window events in the plugn. We'll exit the spinlock when one of those events
-        // is a callback to signal the browser shutdown, or when a timeout is reached.
+        // the GPU thread has time to process the cleanup. Cleanup doesn't block the GPU
+        // thread; instead it advances a step with each window update, so while we block
+        // the UI thread we keep requesting updates, and service window events in the
+        // plugin. We'll exit the loop when one of those events is a callback to signal
+        // the browser shutdown, or when a timeout is reached (slightly longer than the
+        // plugin's own shutdown timeout, so that the plugin gets to finish up).
         // If we have more than one window, we'll need to change this logic to
         // wait for all windows to be shut down. At the moment, it will continue
         // as soon as the first is done.
@@ -484,11 +489,30 @@ public class ServoUnityController : MonoBehaviour
         stopWatch.Start();
         if (servoUnityWindows.Length > 0)
         {
+            // Each update takes a render event parameter slot, and Time.frameCount doesn't advance here, so
+            // the plugin can't tell if slots are reused too early. So issue the next update only once the
+            // render thread has run the last (or, in case it can't be observed, after 100 ms), which keeps
+            // the events in flight far below the size of the pool.
+            int windowIndex = servoUnityWindows[0].WindowIndex;
+            ulong renderEventsIssued = 0;
+            long lastIssuedMs = 0;
+            bool issued = false;
             waitingForShutdown = true;
             do
             {
-                servo_unity_plugin.ServoUnityServiceWindowEvents(servoUnityWindows[0].WindowIndex);
-            } while (waitingForShutdown == true && stopWatch.ElapsedMilliseconds < 2000);
+                ulong renderEvents = 0;
+                if (servo_unity_plugin.ServoUnityGetWindowStats(windowIndex, out ServoUnityPlugin.ServoUnityWindowStats stats)) renderEvents = stats.renderEvents;
+                if (!issued || renderEvents >= renderEventsIssued || stopWatch.ElapsedMilliseconds - lastIssuedMs >= 100)
+                {
+                    servo_unity_plugin.ServoUnityRequestWindowUpdate(windowIndex, 0.0f);
+                    GL.Flush();
+                    renderEventsIssued = renderEvents + 1;
+                    lastIssuedMs = stopWatch.ElapsedMilliseconds;
+                    issued = true;
+                }
+                System.Threading.Thread.Sleep(1);
+                servo_unity_plugin.ServoUnityServiceWindowEvents(windowIndex);
+            } while (waitingForShutdown == true && stopWatch.ElapsedMilliseconds < 2500);
             stopWatch.Stop();
             if (waitingForShutdown)
             {
@@ -42,6 +42,49 @@ public class ServoUnityPlugin
     private ServoUnityPluginBrowserEventCallback browserEventCallback = null;
     private GCHandle browserEventCallbackGCH;
 
+    //
+    // Render event parameters. Each render event is issued with its own slot from a pool owned by the
+    // plugin, filled in rotation, so that events for several windows can be issued in one frame.
+    // Mirrors ServoUnityRenderEventData in servo_unity_c.h.
+    //
+
+    private const int RenderEventDataSize = 24;
+    private const int RenderEventDataOffsetWindowIndex = 0;
+    private const int RenderEventDataOffsetTimeDelta = 4;
+    private const int RenderEventDataOffsetFrame = 8;
+    private const int RenderEventDataOffsetWidth = 16;
+    private const int RenderEventDataOffsetHeight = 20;
+
+    private IntPtr renderEventAndDataFunc = IntPtr.Zero;
+    private IntPtr renderEventDataPool = IntPtr.Zero;
+    private int renderEventDataPoolCount = 0;
+    private int renderEventDataNext = 0;
+
+    [StructLayout(LayoutKind.Explicit)]
+    private struct FloatBits
+    {
+        [FieldOffset(0)] public float f;
+        [FieldOffset(0)] public int i;
+    }
+
+    private void IssueRenderEvent(int eventID, int windowIndex, float timeDelta, int width, int height)
+    {
+        if (renderEventDataPool == IntPtr.Zero)
+        {
+            renderEventAndDataFunc = ServoUnityPlugin_pinvoke.GetRenderEventAndDataFunc();
+            renderEventDataPool = ServoUnityPlugin_pinvoke.servoUnityGetRenderEventDataPool(out renderEventDataPoolCount);
+        }
+        IntPtr data = new IntPtr(renderEventDataPool.ToInt64() + (long)renderEventDataNext * RenderEventDataSize);
+        renderEventDataNext = (renderEventDataNext + 1) % renderEventDataPoolCount;
+        Marshal.WriteInt32(data, RenderEventDataOffsetWindowIndex, windowIndex);
+        Marshal.WriteInt32(data, RenderEventDataOffsetTimeDelta, new FloatBits { f = timeDelta }.i);
+        Marshal.WriteInt64(data, RenderEventDataOffsetFrame, Time.frameCount);
+        Marshal.WriteInt32(data, RenderEventDataOffsetWidth, width);
+        Marshal.WriteInt32(data, RenderEventDataOffsetHeight, height);
+        GL.IssuePluginEventAndData(renderEventAndDataFunc, eventID, data);
+        GL.InvalidateState();
+    }
+
     public void ServoUnityRegisterLogCallback(ServoUnityPluginLogCallback lcb)
     {
         logCallback = lcb; // Set or unset.
@@ -263,11 +306,94 @@ public class ServoUnityPlugin
     {
         // Rather than calling ServoUnityPlugin_pinvoke.servoUnityRequestWindowUpdate(windowIndex, timeDelta)
         // directly, make sure the call runs on the rendering thread.
-        ServoUnityPlugin_pinvoke.servoUnitySetRenderEventFunc1Params(windowIndex, timeDelta);
-        GL.IssuePluginEvent(ServoUnityPlugin_pinvoke.GetRenderEventFunc(), 1);
+        IssueRenderEvent(1, windowIndex, timeDelta, 0, 0);
+    }
+
+    //
+    // Render event 4 (update all windows). Parameters and results are in unmanaged memory, double-buffered
+    // as the render thread may still be running the previous frame's event. They are never freed, as the
+    // render thread may still be using them. Mirrors ServoUnityUpdateAllWindowsData and
+    // ServoUnityWindowUpdateResult in servo_unity_c.h.
+    //
+
+    private const int UpdateAllDataSize = 40;
+    private const int UpdateAllDataOffsetTimeDelta = 0;
+    private const int UpdateAllDataOffsetResultsCapacity = 4;
+    private const int UpdateAllDataOffsetFrame = 8;
+    private const int UpdateAllDataOffsetResultsFrame = 16;
+    private const int UpdateAllDataOffsetWindowCount = 24;
+    private const int UpdateAllDataOffsetResults = 32;
+    private const int WindowUpdateResultSize = 12;
+
+    private IntPtr[] updateAllData = new IntPtr[2];
+    private IntPtr[] updateAllResults = new IntPtr[2];
+    private int[] updateAllResultsCapacity = new int[2];
+    private int updateAllNext = 0;
+
+    [StructLayout(LayoutKind.Sequential)]
+    public struct ServoUnityWindowUpdateResult
+    {
+        public int windowIndex;
+        public int updated; // 1 if the window was updated, 0 if it was idle and skipped.
+        public float updateMs;
+    };
+
+    // Updates every window with a single render event. Call at most once per frame, instead of
+    // ServoUnityRequestWindowUpdate() for each window. windowCount sizes the results buffer.
+    public void ServoUnityRequestAllWindowsUpdate(float timeDelta, int windowCount)
+    {
+        if (renderEventAndDataFunc == IntPtr.Zero) renderEventAndDataFunc = ServoUnityPlugin_pinvoke.GetRenderEventAndDataFunc();
+        int b = updateAllNext;
+        updateAllNext = (updateAllNext + 1) % 2;
+        if (updateAllData[b] == IntPtr.Zero) updateAllData[b] = Marshal.AllocHGlobal(UpdateAllDataSize);
+        if (updateAllResultsCapacity[b] < windowCount)
+        {
+            // This block's previous event ran at least a frame ago, so its results buffer is free.
+            if (updateAllResults[b] != IntPtr.Zero) Marshal.FreeHGlobal(updateAllResults[b]);
+            updateAllResults[b] = Marshal.AllocHGlobal(windowCount * WindowUpdateResultSize);
+            updateAllResultsCapacity[b] = windowCount;
+        }
+        IntPtr data = updateAllData[b];
+        Marshal.WriteInt32(data, UpdateAllDataOffsetTimeDelta, new FloatBits { f = timeDelta }.i);
+        Marshal.WriteInt32(data, UpdateAllDataOffsetResultsCapacity, updateAllResultsCapacity[b]);
+        Marshal.WriteInt64(data, UpdateAllDataOffsetFrame, Time.frameCount);
+        Marshal.WriteInt64(data, UpdateAllDataOffsetResultsFrame, -1);
+        Marshal.WriteInt32(data, UpdateAllDataOffsetWindowCount, 0);
+        Marshal.WriteIntPtr(data, UpdateAllDataOffsetResults, updateAllResults[b]);
+        GL.IssuePluginEventAndData(renderEventAndDataFunc, 4, data);
         GL.InvalidateState();
     }
 
+    // Copies the per-window results of the most recent ServoUnityRequestAllWindowsUpdate() whose render event
+    // has run. Returns the number of results copied, or 0 if none are available yet.
+    public int ServoUnityGetAllWindowsUpdateResults(ServoUnityWindowUpdateResult[] results)
+    {
+        if (results == null) return 0;
+        for (int i = 1; i <= 2; i++)
+        {
+            IntPtr data = updateAllData[(updateAllNext + 2 - i) % 2]; // Most recently issued first.
+            if (data == IntPtr.Zero) continue;
+            if (Marshal.ReadInt64(data, UpdateAllDataOffsetResultsFrame) != Marshal.ReadInt64(data, UpdateAllDataOffsetFrame)) continue;
+            System.Threading.Thread.MemoryBarrier();
+            int count = Math.Min(Math.Min(Marshal.ReadInt32(data, UpdateAllDataOffsetWindowCount), Marshal.ReadInt32(data, UpdateAllDataOffsetResultsCapacity)), results.Length);
+            IntPtr r = Marshal.ReadIntPtr(data, UpdateAllDataOffsetResults);
+            for (int j = 0; j < count; j++)
+            {
+                int offset = j * WindowUpdateResultSize;
+                results[j].windowIndex = Marshal.ReadInt32(r, offset);
+                results[j].updated = Marshal.ReadInt32(r, offset + 4);
+                results[j].updateMs = new FloatBits { i = Marshal.ReadInt32(r, offset + 8) }.f;
+            }
+            return count;
+        }
+        return 0;
+    }
+
+    public void ServoUnityForceWindowTextureRefresh(int windowIndex)
+    {
+        ServoUnityPlugin_pinvoke.servoUnityForceWindowTextureRefresh(windowIndex);
+    }
+
 
     public string ServoUnityGetWindowTitle(int windowIndex)
     {
@@ -283,13 +409,98 @@ public class ServoUnityPlugin
         return sb.ToString();
     }
 
+    public enum ServoUnityWindowCounter
+    {
+        PointerMovesCoalesced = 0,
+        ScrollsCoalesced = 1,
+        InputEventsCoalescedLastFrame = 2,
+        LatencySamplesDropped = 3,
+        TasksDeferred = 4,
+        TasksDeferredLastFrame = 5,
+        TextureFillsPerformed = 6,
+        TextureFillsSkipped = 7,
+        TimeToFirstFrameUs = 8,
+        Max
+    };
+
+    public ulong ServoUnityGetWindowCounter(int windowIndex, ServoUnityWindowCounter counterID)
+    {
+        return ServoUnityPlugin_pinvoke.servoUnityGetWindowCounter(windowIndex, (int)counterID);
+    }
+
+    public enum ServoUnityLatencyStage
+    {
+        Queue = 0,
+        Update = 1,
+        Fill = 2,
+        Total = 3,
+        Max
+    };
+
+    // Must match the layout of ServoUnityLatencyStats in servo_unity_c.h.
+    [StructLayout(LayoutKind.Sequential)]
+    public struct ServoUnityLatencyStats
+    {
+        public ulong count;
+        public float p50Ms;
+        public float p95Ms;
+        public float p99Ms;
+        public float maxMs;
+    };
+
+    public bool ServoUnityGetWindowLatencyStats(int windowIndex, ServoUnityLatencyStage stage, out ServoUnityLatencyStats stats)
+    {
+        return ServoUnityPlugin_pinvoke.servoUnityGetWindowLatencyStats(windowIndex, (int)stage, out stats);
+    }
+
+    public void ServoUnityResetWindowLatencyStats(int windowIndex)
+    {
+        ServoUnityPlugin_pinvoke.servoUnityResetWindowLatencyStats(windowIndex);
+    }
+
+    // Must match the layout of ServoUnityWindowStats in servo_unity_c.h.
+    [StructLayout(LayoutKind.Sequential)]
+    public struct ServoUnityWindowStats
+    {
+        public ulong renderEvents;
+        public ulong framesSkipped;
+        public ulong performUpdatesCount;
+        public ulong performUpdatesTotalUs;
+        public ulong performUpdatesMaxUs;
+        public ulong fillCount;
+        public ulong fillTotalUs;
+        public ulong fillMaxUs;
+        public ulong taskQueueDepth;
+        public ulong taskQueueHighWater;
+        public ulong browserEventQueueDepth;
+        public ulong wakeups;
+        public double wakeupsPerSecond;
+    };
+
+    public bool ServoUnityGetWindowStats(int windowIndex, out ServoUnityWindowStats stats)
+    {
+        return ServoUnityPlugin_pinvoke.servoUnityGetWindowStats(windowIndex, out stats);
+    }
+
+    public bool ServoUnityWriteTrace(string path)
+    {
+        return ServoUnityPlugin_pinvoke.servoUnityWriteTrace(path);
+    }
+
     public void ServoUnityCleanupRenderer(int windowIndex)
     {
         // Rather than calling ServoUnityPlugin_pinvoke.servoUnityCleanupRenderer(windowIndex)
         // directly, make sure the call runs on the rendering thread.
-        ServoUnityPlugin_pinvoke.servoUnitySetRenderEventFunc2Param(windowIndex);
-        GL.IssuePluginEvent(ServoUnityPlugin_pinvoke.GetRenderEventFunc(), 2);
-        GL.InvalidateState();
+        IssueRenderEvent(2, windowIndex, 0.0f, 0, 0);
+    }
+
+    // Starts the browser engine ahead of the first window, e.g. during a loading screen.
+    // Pass the size the first window will request, to avoid a resize when it adopts the engine.
+    public void ServoUnityPrewarm(int width, int height)
+    {
+        // Rather than calling ServoUnityPlugin_pinvoke.servoUnityPrewarm(width, height)
+        // directly, make sure the call runs on the rendering thread.
+        IssueRenderEvent(3, 0, 0.0f, width, height);
     }
 
     public enum ServoUnityPointerEventID
@@ -317,6 +528,42 @@ public class ServoUnityPlugin
         ServoUnityPlugin_pinvoke.servoUnityWindowPointerEvent(windowIndex, (int) eventID, eventParam0, eventParam1, windowX, windowY);
     }
 
+    public enum ServoUnityInputEventType
+    {
+        Pointer = 0,
+        Key = 1
+    };
+
+    // Must match the layout of ServoUnityInputEvent in servo_unity_c.h.
+    [StructLayout(LayoutKind.Sequential)]
+    public struct ServoUnityInputEvent
+    {
+        public long timestamp;
+        public int type;
+        public int eventID;
+        public int param0;
+        public int param1;
+        public int windowX;
+        public int windowY;
+
+        public static ServoUnityInputEvent Pointer(long timestamp, ServoUnityPointerEventID eventID, int eventParam0, int eventParam1, int windowX, int windowY)
+        {
+            return new ServoUnityInputEvent { timestamp = timestamp, type = (int)ServoUnityInputEventType.Pointer, eventID = (int)eventID, param0 = eventParam0, param1 = eventParam1, windowX = windowX, windowY = windowY };
+        }
+
+        public static ServoUnityInputEvent Key(long timestamp, int upDown, int keyCode, int character)
+        {
+            return new ServoUnityInputEvent { timestamp = timestamp, type = (int)ServoUnityInputEventType.Key, eventID = upDown, param0 = keyCode, param1 = character };
+        }
+    };
+
+    // Submits the first `count` events from `events` in one call. Returns the number accepted.
+    public int ServoUnitySubmitInputEvents(int windowIndex, ServoUnityInputEvent[] events, int count)
+    {
+        if (events == null || count <= 0) return 0;
+        return ServoUnityPlugin_pinvoke.servoUnitySubmitInputEvents(windowIndex, events, Math.Min(count, events.Length));
+    }
+
     public enum ServoUnityWindowBrowserControlEventID
     {
         Refresh = 0,
@@ -366,6 +613,16 @@ public class ServoUnityPlugin
         b_CloseNativeWindowOnClose = 0,
         s_SearchURI = 1,
         s_Homepage = 2,
+        i_MaxServoTasksPerFrame = 3,
+        f_ServoTaskTimeBudgetMs = 4,
+        b_Trace = 5,
+        b_LogDeferredFormatting = 6,
+        i_LogRateLimit = 7,
+        s_ServoLogModules = 8,
+        s_ServoLogLevel = 9,
+        s_RemoteHost = 10,
+        i_ServoLogRateLimit = 11,
+        i_MaxLibraryCopies = 12,
         Max
     };
 
@@ -379,7 +636,7 @@ public class ServoUnityPlugin
         ServoUnityPlugin_pinvoke.servoUnitySetParamInt((int)param, val);
     }
 
-    public void ServoUnitySetParamFloat(ServoUnityParam param, bool val)
+    public void ServoUnitySetParamFloat(ServoUnityParam param, float val)
     {
         ServoUnityPlugin_pinvoke.servoUnitySetParamFloat((int)param, val);
     }
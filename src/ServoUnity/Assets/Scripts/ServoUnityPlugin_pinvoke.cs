@@ -23,6 +23,9 @@ public static class ServoUnityPlugin_pinvoke
     [DllImport(LIBRARY_NAME, CallingConvention = CallingConvention.StdCall)]
     public static extern IntPtr GetRenderEventFunc();
 
+    [DllImport(LIBRARY_NAME, CallingConvention = CallingConvention.StdCall)]
+    public static extern IntPtr GetRenderEventAndDataFunc();
+
     [DllImport(LIBRARY_NAME, CallingConvention = CallingConvention.Cdecl)]
     public static extern void servoUnityRegisterLogCallback(ServoUnityPluginLogCallback callback);
 
@@ -57,6 +60,9 @@ public static class ServoUnityPlugin_pinvoke
     [DllImport(LIBRARY_NAME, CallingConvention = CallingConvention.Cdecl)]
     public static extern void servoUnityWindowPointerEvent(int windowIndex, int eventID, int eventParam0, int eventParam1, int windowX, int windowY);
 
+    [DllImport(LIBRARY_NAME, CallingConvention = CallingConvention.Cdecl)]
+    public static extern int servoUnitySubmitInputEvents(int windowIndex, [In] ServoUnityPlugin.ServoUnityInputEvent[] events, int count);
+
     [DllImport(LIBRARY_NAME, CallingConvention = CallingConvention.Cdecl)]
     public static extern void servoUnityWindowBrowserControlEvent(int windowIndex, int eventID, int eventParam0, int eventParam1, string eventParamS);
 
@@ -92,6 +98,24 @@ public static class ServoUnityPlugin_pinvoke
     [DllImport(LIBRARY_NAME, CallingConvention = CallingConvention.Cdecl)]
     public static extern void servoUnityGetWindowMetadata(int windowIndex, [MarshalAs(UnmanagedType.LPStr)] StringBuilder titleBuf, int titleBufLen, [MarshalAs(UnmanagedType.LPStr)] StringBuilder urlBuf, int urlBufLen);
 
+    [DllImport(LIBRARY_NAME, CallingConvention = CallingConvention.Cdecl)]
+    public static extern ulong servoUnityGetWindowCounter(int windowIndex, int counterID);
+
+    [DllImport(LIBRARY_NAME, CallingConvention = CallingConvention.Cdecl)]
+    [return: MarshalAsAttribute(UnmanagedType.I1)]
+    public static extern bool servoUnityGetWindowLatencyStats(int windowIndex, int stage, out ServoUnityPlugin.ServoUnityLatencyStats stats);
+
+    [DllImport(LIBRARY_NAME, CallingConvention = CallingConvention.Cdecl)]
+    public static extern void servoUnityResetWindowLatencyStats(int windowIndex);
+
+    [DllImport(LIBRARY_NAME, CallingConvention = CallingConvention.Cdecl)]
+    [return: MarshalAsAttribute(UnmanagedType.I1)]
+    public static extern bool servoUnityGetWindowStats(int windowIndex, out ServoUnityPlugin.ServoUnityWindowStats stats);
+
+    [DllImport(LIBRARY_NAME, CallingConvention = CallingConvention.Cdecl)]
+    [return: MarshalAsAttribute(UnmanagedType.I1)]
+    public static extern bool servoUnityWriteTrace(string path);
+
     ///
     /// Must be called from rendering thread with active rendering context.
     /// As an alternative to invoking directly, an equivalent invocation can be invoked via call this sequence:
@@ -101,6 +125,9 @@ public static class ServoUnityPlugin_pinvoke
     [DllImport(LIBRARY_NAME, CallingConvention = CallingConvention.Cdecl)]
     public static extern void servoUnityRequestWindowUpdate(int windowIndex, float timeDelta);
 
+    [DllImport(LIBRARY_NAME, CallingConvention = CallingConvention.Cdecl)]
+    public static extern void servoUnityForceWindowTextureRefresh(int windowIndex);
+
     ///
     /// Must be called from rendering thread with active rendering context.
     /// As an alternative to invoking directly, an equivalent invocation can be invoked via call this sequence:
@@ -116,6 +143,21 @@ public static class ServoUnityPlugin_pinvoke
     [DllImport(LIBRARY_NAME, CallingConvention = CallingConvention.Cdecl)]
     public static extern void servoUnitySetRenderEventFunc2Param(int windowIndex);
 
+    ///
+    /// Must be called from rendering thread with active rendering context.
+    /// As an alternative to invoking directly, an equivalent invocation can be invoked via call this sequence:
+    ///     servoUnitySetRenderEventFunc3Params(width, height);
+    ///     (*GetRenderEventFunc())(3);
+    ///
+    [DllImport(LIBRARY_NAME, CallingConvention = CallingConvention.Cdecl)]
+    public static extern void servoUnityPrewarm(int width, int height);
+
+    [DllImport(LIBRARY_NAME, CallingConvention = CallingConvention.Cdecl)]
+    public static extern void servoUnitySetRenderEventFunc3Params(int width, int height);
+
+    [DllImport(LIBRARY_NAME, CallingConvention = CallingConvention.Cdecl)]
+    public static extern IntPtr servoUnityGetRenderEventDataPool(out int count);
+
     [DllImport(LIBRARY_NAME, CallingConvention = CallingConvention.Cdecl)]
     public static extern void servoUnitySetParamBool(int param, bool flag);
 
@@ -123,7 +165,7 @@ public static class ServoUnityPlugin_pinvoke
     public static extern void servoUnitySetParamInt(int param, int flag);
 
     [DllImport(LIBRARY_NAME, CallingConvention = CallingConvention.Cdecl)]
-    public static extern void servoUnitySetParamFloat(int param, [MarshalAsAttribute(UnmanagedType.I1)] bool flag);
+    public static extern void servoUnitySetParamFloat(int param, float val);
 
     [DllImport(LIBRARY_NAME, CallingConvention = CallingConvention.Cdecl)]
     public static extern void servoUnitySetParamString(int param, string s);
@@ -183,8 +183,7 @@ public class ServoUnityWindow : ServoUnityPointableSurface
 
         servo_unity_plugin?.ServoUnityServiceWindowEvents(_windowIndex);
 
-        //Debug.Log("ServoUnityWindow.Update() with _windowIndex == " + _windowIndex);
-        servo_unity_plugin?.ServoUnityRequestWindowUpdate(_windowIndex, Time.deltaTime);
+        // The window's update on the rendering thread is requested by ServoUnityController.Update(), along with all other windows.
     }
 
     private Texture2D CreateWindowTexture(int videoWidth, int videoHeight, TextureFormat format,
@@ -0,0 +1,404 @@
+//
+// ServoUnityEngine.cpp
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0.If a copy of the MPL was not distributed with this
+// file, You can obtain one at https ://mozilla.org/MPL/2.0/.
+//
+// Copyright (c) 2019-2020 Mozilla, Inc.
+//
+// Author(s): Philip Lamb
+//
+
+#include "ServoUnityEngine.h"
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <dlfcn.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+#include "servo_unity_internal.h"
+#include "servo_unity_log.h"
+#include "servo_unity_trace.h"
+
+static ServoUnityEngine s_engines[SERVO_UNITY_ENGINES_MAX];
+static std::mutex s_enginesLock; // Guards engine state, and loading state.
+
+// Servo's log output from all engines, rate limited separately from the plugin's own call sites.
+static servoUnityLogSite s_servoLogSite = {"Servo", 0, 0, 0, 0, &s_param_ServoLogRateLimit};
+
+//
+// Callback trampolines. Each engine has its own instantiation, so the function a callback
+// arrives on identifies the engine, and so the client it is forwarded to.
+// Callbacks arriving with no client are dropped, or answered as the window would answer them.
+// Each holds a Client for its duration, so that the client isn't deleted under it.
+//
+
+template <size_t I>
+struct ServoUnityEngineTrampolines
+{
+    struct Client : ServoUnityEngine::CallbackScope {
+        Client() : CallbackScope(s_engines[I]) {}
+    };
+
+    static void on_load_started(void) { Client c; if (c) c->on_load_started(); }
+    static void on_load_ended(void) { Client c; if (c) c->on_load_ended(); }
+    static void on_title_changed(const char *title) { Client c; if (c) c->on_title_changed(title); }
+    static bool on_allow_navigation(const char *url) { Client c; return (c ? c->on_allow_navigation(url) : true); }
+    static void on_url_changed(const char *url) { Client c; if (c) c->on_url_changed(url); }
+    static void on_history_changed(bool can_go_back, bool can_go_forward) { Client c; if (c) c->on_history_changed(can_go_back, can_go_forward); }
+    static void on_animating_changed(bool animating) { Client c; if (c) c->on_animating_changed(animating); }
+    static void on_shutdown_complete(void) { Client c; if (c) c->on_shutdown_complete(); }
+    static void on_ime_show(const char *text, int32_t x, int32_t y, int32_t width, int32_t height) { Client c; if (c) c->on_ime_show(text, x, y, width, height); }
+    static void on_ime_hide(void) { Client c; if (c) c->on_ime_hide(); }
+    static const char *get_clipboard_contents(void) { Client c; return (c ? c->get_clipboard_contents() : nullptr); }
+    static void set_clipboard_contents(const char *contents) { Client c; if (c) c->set_clipboard_contents(contents); }
+    static void on_media_session_metadata(const char *title, const char *album, const char *artist) { Client c; if (c) c->on_media_session_metadata(title, album, artist); }
+    static void on_media_session_playback_state_change(CMediaSessionPlaybackState state) { Client c; if (c) c->on_media_session_playback_state_change(state); }
+    static void on_media_session_set_position_state(double duration, double position, double playback_rate) { Client c; if (c) c->on_media_session_set_position_state(duration, position, playback_rate); }
+    static void prompt_alert(const char *message, bool trusted) { Client c; if (c) c->prompt_alert(message, trusted); }
+    static CPromptResult prompt_ok_cancel(const char *message, bool trusted) { Client c; return (c ? c->prompt_ok_cancel(message, trusted) : CPromptResult::Dismissed); }
+    static CPromptResult prompt_yes_no(const char *message, bool trusted) { Client c; return (c ? c->prompt_yes_no(message, trusted) : CPromptResult::Dismissed); }
+    static const char *prompt_input(const char *message, const char *def, bool trusted) { Client c; return (c ? c->prompt_input(message, def, trusted) : def); }
+    static void on_devtools_started(CDevtoolsServerState result, unsigned int port, const char *token) { Client c; if (c) c->on_devtools_started(result, port, token); }
+    static void show_context_menu(const char *title, const char *const *items_list, uint32_t items_size)
+    {
+        Client c;
+        if (c) c->show_context_menu(title, items_list, items_size);
+        else s_engines[I].api().on_context_menu_closed(CContextMenuResult::Dismissed_, 0);
+    }
+    static void wakeup(void) { Client c; if (c) c->wakeup(); }
+
+    static void on_log_output(const char *buffer, uint32_t buffer_length)
+    {
+        SERVOUNITYTRACE("on_log_output");
+        // Copied into the log as is, without formatting. Logged at REL_INFO so that output Servo's
+        // own log level and module list let through isn't filtered again by servoUnityLogLevel.
+        // All of Servo's output arrives here, so it has its own limit, higher than that of a single call site.
+        servoUnityLogBuffer(&s_servoLogSite, NULL, SERVO_UNITY_LOG_LEVEL_REL_INFO, buffer, buffer_length);
+    }
+
+    static CHostCallbacks hostCallbacks(void)
+    {
+        CHostCallbacks chc {
+            .on_load_started = on_load_started,
+            .on_load_ended = on_load_ended,
+            .on_title_changed = on_title_changed,
+            .on_allow_navigation = on_allow_navigation,
+            .on_url_changed = on_url_changed,
+            .on_history_changed = on_history_changed,
+            .on_animating_changed = on_animating_changed,
+            .on_shutdown_complete = on_shutdown_complete,
+            .on_ime_show = on_ime_show,
+            .on_ime_hide = on_ime_hide,
+            .get_clipboard_contents = get_clipboard_contents,
+            .set_clipboard_contents = set_clipboard_contents,
+            .on_media_session_metadata = on_media_session_metadata,
+            .on_media_session_playback_state_change = on_media_session_playback_state_change,
+            .on_media_session_set_position_state = on_media_session_set_position_state,
+            .prompt_alert = prompt_alert,
+            .prompt_ok_cancel = prompt_ok_cancel,
+            .prompt_yes_no = prompt_yes_no,
+            .prompt_input = prompt_input,
+            .on_devtools_started = on_devtools_started,
+            .show_context_menu = show_context_menu,
+            .on_log_output = on_log_output
+        };
+        return chc;
+    }
+};
+
+typedef struct {
+    CHostCallbacks (*hostCallbacks)(void);
+    void (*wakeup)(void);
+} TRAMPOLINES;
+
+template <size_t... Is>
+static const TRAMPOLINES *trampolinesTable(std::index_sequence<Is...>)
+{
+    static const TRAMPOLINES table[] = {{ServoUnityEngineTrampolines<Is>::hostCallbacks, ServoUnityEngineTrampolines<Is>::wakeup}...};
+    return table;
+}
+
+static const TRAMPOLINES *trampolines(size_t index)
+{
+    return trampolinesTable(std::make_index_sequence<SERVO_UNITY_ENGINES_MAX>()) + index;
+}
+
+//
+// Loading private copies of the simpleservo library.
+//
+
+#ifdef _WIN32
+
+// Copies are named simpleservo-<pid>-<index>.dll in the temp directory. A loaded DLL can't be deleted, and
+// copies are never unloaded, so each process's copies are deleted by the first process to start after it exits.
+static void deleteStaleLibraryCopies(const char *tempDir)
+{
+    char pattern[MAX_PATH], stalePath[MAX_PATH];
+    snprintf(pattern, MAX_PATH, "%ssimpleservo-*-*.dll", tempDir);
+    WIN32_FIND_DATAA fd;
+    HANDLE find = FindFirstFileA(pattern, &fd);
+    if (find == INVALID_HANDLE_VALUE) return;
+    do {
+        unsigned long pid;
+        int index;
+        if (sscanf(fd.cFileName, "simpleservo-%lu-%d.dll", &pid, &index) != 2 || pid == GetCurrentProcessId()) continue;
+        HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, (DWORD)pid);
+        bool running = false;
+        if (process) {
+            DWORD exitCode;
+            running = (GetExitCodeProcess(process, &exitCode) && exitCode == STILL_ACTIVE);
+            CloseHandle(process);
+        } else {
+            running = (GetLastError() == ERROR_ACCESS_DENIED); // Exists, but isn't ours to query.
+        }
+        if (running) continue;
+        snprintf(stalePath, MAX_PATH, "%s%s", tempDir, fd.cFileName);
+        if (DeleteFileA(stalePath)) SERVOUNITYLOGi("Deleted stale library copy %s.\n", stalePath);
+    } while (FindNextFileA(find, &fd));
+    FindClose(find);
+}
+
+static bool loadLibraryCopy(size_t index, void **library_p)
+{
+    static std::once_flag swept;
+    HMODULE self = NULL, lib = NULL;
+    char path[MAX_PATH], tempDir[MAX_PATH], copyPath[MAX_PATH];
+    GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT, (LPCSTR)&trampolines, &self);
+    if (!GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT, (LPCSTR)&::perform_updates, &lib) || lib == self) {
+        SERVOUNITYLOGe("Unable to locate the simpleservo library.\n");
+        return false;
+    }
+    if (!GetModuleFileNameA(lib, path, MAX_PATH) || !GetTempPathA(MAX_PATH, tempDir)) return false;
+    std::call_once(swept, deleteStaleLibraryCopies, tempDir);
+    snprintf(copyPath, MAX_PATH, "%ssimpleservo-%lu-%d.dll", tempDir, GetCurrentProcessId(), (int)index);
+    if (!CopyFileA(path, copyPath, FALSE)) {
+        SERVOUNITYLOGe("Unable to copy %s to %s.\n", path, copyPath);
+        return false;
+    }
+    HMODULE copy = LoadLibraryA(copyPath);
+    if (!copy) {
+        SERVOUNITYLOGe("Unable to load %s.\n", copyPath);
+        DeleteFileA(copyPath);
+        return false;
+    }
+    *library_p = (void *)copy;
+    return true;
+}
+
+static void *librarySymbol(void *library, const char *name)
+{
+    return (void *)GetProcAddress((HMODULE)library, name);
+}
+
+#else
+
+static bool loadLibraryCopy(size_t index, void **library_p)
+{
+    Dl_info info;
+    if (!dladdr((void *)&::perform_updates, &info) || !info.dli_fname) {
+        SERVOUNITYLOGe("Unable to locate the simpleservo library.\n");
+        return false;
+    }
+    const char *tmpdir = getenv("TMPDIR");
+    char copyPath[1024];
+    snprintf(copyPath, sizeof(copyPath), "%s/simpleservo-%d-XXXXXX", (tmpdir && *tmpdir ? tmpdir : "/tmp"), (int)index);
+    int out = mkstemp(copyPath);
+    if (out == -1) {
+        SERVOUNITYLOGperror("Unable to create library copy");
+        return false;
+    }
+    int in = open(info.dli_fname, O_RDONLY);
+    bool ok = (in != -1);
+    char buf[65536];
+    ssize_t n = 0;
+    while (ok && (n = read(in, buf, sizeof(buf))) > 0) {
+        for (ssize_t done = 0; ok && done < n;) {
+            ssize_t w = write(out, buf + done, n - done);
+            if (w <= 0) ok = false;
+            else done += w;
+        }
+    }
+    if (n < 0) ok = false;
+    if (in != -1) close(in);
+    close(out);
+    if (!ok) {
+        SERVOUNITYLOGe("Unable to copy %s to %s.\n", info.dli_fname, copyPath);
+        unlink(copyPath);
+        return false;
+    }
+    // Local, so that the copy doesn't interpose on anything, and (where supported) deep-bound, so that calls
+    // within the copy to its own exported functions aren't resolved to the original's.
+    int flags = RTLD_NOW | RTLD_LOCAL;
+#ifdef RTLD_DEEPBIND
+    flags |= RTLD_DEEPBIND;
+#endif
+    void *lib = dlopen(copyPath, flags);
+    unlink(copyPath); // Stays mapped, and is freed at exit.
+    if (!lib) {
+        SERVOUNITYLOGe("Unable to load copy of %s: %s\n", info.dli_fname, dlerror());
+        return false;
+    }
+    *library_p = lib;
+    return true;
+}
+
+static void *librarySymbol(void *library, const char *name)
+{
+    return dlsym(library, name);
+}
+
+#endif
+
+ServoUnityEngine::ServoUnityEngine() :
+    m_index(this - s_engines),
+    m_state(State::Free),
+    m_loaded(false),
+    m_loading(false),
+    m_loadFailed(false),
+    m_loader(),
+    m_localAPI(),
+    m_api(),
+    m_callbacks(),
+    m_wakeup(nullptr),
+    m_client(nullptr),
+    m_callbacksInFlight(0)
+{
+    const TRAMPOLINES *t = trampolines(m_index);
+    m_callbacks = t->hostCallbacks();
+    m_wakeup = t->wakeup;
+}
+
+ServoUnityEngine::~ServoUnityEngine()
+{
+    if (m_loader.joinable()) m_loader.join();
+}
+
+// Engine 0 uses the library the plugin links against. Must be called with s_enginesLock held.
+void ServoUnityEngine::loadLinked(void)
+{
+#define SERVO_UNITY_ENGINE_API_LINKED(name) m_localAPI.name = &::name;
+    SERVO_UNITY_ENGINE_API_FUNCTIONS(SERVO_UNITY_ENGINE_API_LINKED)
+#undef SERVO_UNITY_ENGINE_API_LINKED
+    m_loaded = true;
+}
+
+// Runs on m_loader, as copying the library takes too long for the render thread.
+void ServoUnityEngine::loadCopy(void)
+{
+    SERVOUNITYTRACE("ServoUnityEngine::loadCopy");
+    void *library = nullptr;
+    API api;
+    bool ok = loadLibraryCopy(m_index, &library);
+    if (ok) {
+#define SERVO_UNITY_ENGINE_API_LOOKUP(name) \
+        if (!(*(void **)&api.name = librarySymbol(library, #name))) { SERVOUNITYLOGe("Library copy is missing symbol '%s'.\n", #name); ok = false; }
+        SERVO_UNITY_ENGINE_API_FUNCTIONS(SERVO_UNITY_ENGINE_API_LOOKUP)
+#undef SERVO_UNITY_ENGINE_API_LOOKUP
+    }
+    std::lock_guard<std::mutex> lock(s_enginesLock);
+    if (ok) {
+        m_localAPI = api;
+        m_loaded = true;
+        SERVOUNITYLOGi("Loaded a copy of the simpleservo library for engine %d.\n", (int)m_index);
+    } else {
+        m_loadFailed = true;
+    }
+    m_loading = false;
+}
+
+ServoUnityEngine *ServoUnityEngine::acquire(ServoUnityEngineClient *client, bool remote)
+{
+    finalize(); // Engines abandoned since the last acquire can now be reused.
+    std::lock_guard<std::mutex> lock(s_enginesLock);
+    // Prefer engines whose library is already loaded, unless the library isn't needed.
+    ServoUnityEngine *e = nullptr;
+    for (size_t i = 0; i < SERVO_UNITY_ENGINES_MAX; i++) {
+        ServoUnityEngine& candidate = s_engines[i];
+        if (candidate.m_state != State::Free || (!remote && candidate.m_loadFailed)) continue;
+        if (!e) e = &candidate;
+        if (remote || candidate.m_loaded) {
+            e = &candidate;
+            break;
+        }
+    }
+    if (!e) {
+        SERVOUNITYLOGe("All %d Servo engines are in use.\n", SERVO_UNITY_ENGINES_MAX);
+        return nullptr;
+    }
+    if (remote) {
+        if (!remoteAPI(e->m_index, &e->m_api)) {
+            SERVOUNITYLOGe("Running Servo out of process is not supported on this platform.\n");
+            return nullptr;
+        }
+    } else {
+        if (!e->m_loaded) {
+            if (e->m_index == 0) {
+                e->loadLinked();
+            } else {
+                if (!e->m_loading) {
+                    // Each copy costs the library's size in memory (and on Windows, disk), and is never unloaded.
+                    int copies = 0;
+                    for (size_t i = 1; i < SERVO_UNITY_ENGINES_MAX; i++) {
+                        if (s_engines[i].m_loaded || s_engines[i].m_loading) copies++;
+                    }
+                    int copiesMax = s_param_MaxLibraryCopies.load(std::memory_order_relaxed);
+                    if (copies >= copiesMax) {
+                        SERVOUNITYLOGe("Servo engine %d needs a copy of the simpleservo library, but the limit of %d copies has been reached. Raise ServoUnityParam_i_MaxLibraryCopies, or on Linux, set ServoUnityParam_s_RemoteHost.\n", (int)e->m_index, copiesMax);
+                        return nullptr;
+                    }
+                    SERVOUNITYLOGi("Loading a copy of the simpleservo library for engine %d.\n", (int)e->m_index);
+                    if (e->m_loader.joinable()) e->m_loader.join();
+                    e->m_loading = true;
+                    e->m_loader = std::thread(&ServoUnityEngine::loadCopy, e);
+                }
+                SERVOUNITYLOGd("Servo engine %d not ready yet.\n", (int)e->m_index);
+                return nullptr;
+            }
+        }
+        if (e->m_loader.joinable()) e->m_loader.join(); // Already finished.
+        e->m_api = e->m_localAPI;
+    }
+    e->setClient(client);
+    e->m_state = State::InUse;
+    return e;
+}
+
+void ServoUnityEngine::release(bool running)
+{
+    m_client.store(nullptr); // Sequentially consistent with CallbackScope.
+    // Callbacks already holding the client are brief, and don't wait on the releasing thread.
+    while (m_callbacksInFlight.load(std::memory_order_acquire) > 0) std::this_thread::yield();
+    std::lock_guard<std::mutex> lock(s_enginesLock);
+    m_state = (running ? State::Abandoned : State::Free);
+}
+
+void ServoUnityEngine::finalize(void)
+{
+    std::lock_guard<std::mutex> lock(s_enginesLock);
+    for (size_t i = 0; i < SERVO_UNITY_ENGINES_MAX; i++) {
+        ServoUnityEngine& e = s_engines[i];
+        if (e.m_state != State::Abandoned) continue;
+        SERVOUNITYLOGi("Deiniting abandoned Servo engine %d.\n", (int)i);
+        SERVOUNITYTRACE("deinit");
+        e.m_api.deinit();
+        e.m_state = State::Free;
+    }
+}
+
+void ServoUnityEngine::joinLoaders(void)
+{
+    // Loaders are only started on the render thread, and take s_enginesLock to publish their results.
+    for (size_t i = 0; i < SERVO_UNITY_ENGINES_MAX; i++) {
+        if (s_engines[i].m_loader.joinable()) s_engines[i].m_loader.join();
+    }
+}
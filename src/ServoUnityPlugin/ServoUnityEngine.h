@@ -0,0 +1,193 @@
+//
+// ServoUnityEngine.h
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0.If a copy of the MPL was not distributed with this
+// file, You can obtain one at https ://mozilla.org/MPL/2.0/.
+//
+// Copyright (c) 2019-2020 Mozilla, Inc.
+//
+// Author(s): Philip Lamb
+//
+// An instance of the Servo engine, with its host callbacks routed to the
+// client (window) which owns it.
+//
+// The simpleservo interface is process-wide: its functions take no instance
+// argument and its callbacks carry no userdata. So each engine is a separate
+// copy of the simpleservo library. Engine 0 is the library the plugin links
+// against, and each further engine loads a private copy of the same library
+// file, which the loader treats as a distinct library with its own state.
+// Copies are never unloaded, and at most ServoUnityParam_i_MaxLibraryCopies
+// are loaded.
+// Each engine's callbacks are a distinct set of trampoline functions, which
+// forward to that engine's current client.
+//
+// Alternatively (on Linux), an engine may run Servo in a child process, in
+// which case its API functions forward to the process (see ServoUnityRemote.h).
+//
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include "simpleservo.h"
+
+#define SERVO_UNITY_ENGINES_MAX 8
+
+/// Receives the host callbacks of the engine it owns. Callbacks may arrive on any Servo thread.
+/// Callbacks which arrive while an engine has no client are dropped (or answered with a default).
+class ServoUnityEngineClient
+{
+public:
+    virtual ~ServoUnityEngineClient() {}
+    virtual void on_load_started(void) = 0;
+    virtual void on_load_ended(void) = 0;
+    virtual void on_title_changed(const char *title) = 0;
+    virtual bool on_allow_navigation(const char *url) = 0;
+    virtual void on_url_changed(const char *url) = 0;
+    virtual void on_history_changed(bool can_go_back, bool can_go_forward) = 0;
+    virtual void on_animating_changed(bool animating) = 0;
+    virtual void on_shutdown_complete(void) = 0;
+    virtual void on_ime_show(const char *text, int32_t x, int32_t y, int32_t width, int32_t height) = 0;
+    virtual void on_ime_hide(void) = 0;
+    virtual const char *get_clipboard_contents(void) = 0;
+    virtual void set_clipboard_contents(const char *contents) = 0;
+    virtual void on_media_session_metadata(const char *title, const char *album, const char *artist) = 0;
+    virtual void on_media_session_playback_state_change(CMediaSessionPlaybackState state) = 0;
+    virtual void on_media_session_set_position_state(double duration, double position, double playback_rate) = 0;
+    virtual void prompt_alert(const char *message, bool trusted) = 0;
+    virtual CPromptResult prompt_ok_cancel(const char *message, bool trusted) = 0;
+    virtual CPromptResult prompt_yes_no(const char *message, bool trusted) = 0;
+    virtual const char *prompt_input(const char *message, const char *def, bool trusted) = 0;
+    virtual void on_devtools_started(CDevtoolsServerState result, unsigned int port, const char *token) = 0;
+    virtual void show_context_menu(const char *title, const char *const *items_list, uint32_t items_size) = 0;
+    virtual void wakeup(void) = 0;
+};
+
+// The simpleservo functions used by the plugin, other than those (e.g. servo_version) which
+// don't depend on engine state.
+#if defined(__linux__)
+#  define SERVO_UNITY_ENGINE_API_FUNCTIONS_EGL(X) X(init_with_egl)
+#else
+#  define SERVO_UNITY_ENGINE_API_FUNCTIONS_EGL(X)
+#endif
+#define SERVO_UNITY_ENGINE_API_FUNCTIONS(X) \
+    X(init_with_gl) \
+    SERVO_UNITY_ENGINE_API_FUNCTIONS_EGL(X) \
+    X(deinit) \
+    X(request_shutdown) \
+    X(perform_updates) \
+    X(fill_gl_texture) \
+    X(resize) \
+    X(is_uri_valid) \
+    X(load_uri) \
+    X(refresh) \
+    X(reload) \
+    X(stop) \
+    X(go_back) \
+    X(go_forward) \
+    X(mouse_move) \
+    X(mouse_down) \
+    X(mouse_up) \
+    X(click) \
+    X(scroll) \
+    X(key_down) \
+    X(key_up) \
+    X(on_context_menu_closed)
+
+class ServoUnityEngine
+{
+public:
+    /// Entry points into this engine's copy of the simpleservo library.
+    struct API {
+#define SERVO_UNITY_ENGINE_API_DECLARE(name) decltype(&::name) name;
+        SERVO_UNITY_ENGINE_API_FUNCTIONS(SERVO_UNITY_ENGINE_API_DECLARE)
+#undef SERVO_UNITY_ENGINE_API_DECLARE
+    };
+
+private:
+    enum class State : uint8_t {
+        Free = 0,  // Servo not running.
+        InUse,     // Acquired. Servo may be running.
+        Abandoned  // Released with Servo still running. Deinited by finalize().
+    };
+    size_t m_index;
+    State m_state; // Guarded by the engine pool lock.
+    bool m_loaded; // The library copy has been loaded, and m_localAPI is valid.
+    bool m_loading; // m_loader is copying and loading the library.
+    bool m_loadFailed; // Not retried.
+    std::thread m_loader;
+    API m_localAPI;
+    API m_api; // m_localAPI, or the remote API.
+    CHostCallbacks m_callbacks;
+    void (*m_wakeup)(void);
+    std::atomic<ServoUnityEngineClient *> m_client;
+    std::atomic<int> m_callbacksInFlight; // Callbacks which may be using the client they loaded.
+
+    void loadLinked(void);
+    void loadCopy(void);
+    /// Fill in the API of the remote engine with this index. Defined in ServoUnityEngineRemote.cpp.
+    /// @return false if remote engines are not supported on this platform.
+    static bool remoteAPI(size_t index, API *api_out);
+
+public:
+    ServoUnityEngine();
+    ~ServoUnityEngine();
+    ServoUnityEngine(const ServoUnityEngine&) = delete;
+    void operator=(const ServoUnityEngine&) = delete;
+
+    /// Take an engine which isn't running Servo. If another copy of the library is needed, it is
+    /// copied and loaded on a helper thread, and the engine isn't ready until that completes.
+    /// Must be called from render thread.
+    /// @param client Receives the engine's callbacks. May be null, e.g. to prewarm the engine, and set later.
+    /// @param remote If true, the engine runs Servo in a servo_unity_remote_host process.
+    /// @return The engine, or nullptr if no engine is ready yet (try again later), all SERVO_UNITY_ENGINES_MAX
+    ///     engines are in use, a copy could not be loaded, or another copy would exceed ServoUnityParam_i_MaxLibraryCopies.
+    static ServoUnityEngine *acquire(ServoUnityEngineClient *client, bool remote);
+
+    /// Deinit any engines released while still running. Must be called from render thread.
+    static void finalize(void);
+
+    /// Wait for any library copies still loading. The copies stay loaded, for reuse if the device is reinitialised:
+    /// Servo's threads and thread-local destructors may still be running their code.
+    /// Call after finalize(), at device shutdown.
+    static void joinLoaders(void);
+
+    /// Largest window width and height a remote engine can render. Defined in ServoUnityEngineRemote.cpp.
+    /// @return The size in pixels, or 0 if remote engines are not supported on this platform.
+    static int remoteSizeMax(void);
+
+    /// Return the engine to the pool. Callbacks which arrive after this are dropped, and callbacks
+    /// already in progress are waited for, so the client may be deleted once this returns.
+    /// Must not be called from within one of this engine's callbacks.
+    /// @param running true if Servo has not been deinited, in which case the engine is not reused, and is deinited by finalize().
+    void release(bool running);
+
+    void setClient(ServoUnityEngineClient *client) { m_client.store(client, std::memory_order_release); }
+    ServoUnityEngineClient *client(void) const { return m_client.load(std::memory_order_acquire); }
+
+    /// Holds the engine's client for the duration of a callback, so that release() can wait for it.
+    class CallbackScope {
+    private:
+        ServoUnityEngine& m_engine;
+        ServoUnityEngineClient *m_client;
+    public:
+        explicit CallbackScope(ServoUnityEngine& engine) : m_engine(engine) {
+            // Sequentially consistent with release(): either release() sees this callback, or it sees release()'s null client.
+            m_engine.m_callbacksInFlight.fetch_add(1);
+            m_client = m_engine.m_client.load();
+        }
+        ~CallbackScope() { m_engine.m_callbacksInFlight.fetch_sub(1, std::memory_order_release); }
+        CallbackScope(const CallbackScope&) = delete;
+        void operator=(const CallbackScope&) = delete;
+        explicit operator bool() const { return m_client != nullptr; }
+        ServoUnityEngineClient *operator->() const { return m_client; }
+    };
+
+    size_t index(void) const { return m_index; }
+    const API& api(void) const { return m_api; }
+
+    /// Callbacks to pass to this engine's init_with_gl/init_with_egl.
+    const CHostCallbacks& hostCallbacks(void) const { return m_callbacks; }
+    void (*wakeupCallback(void) const)(void) { return m_wakeup; }
+};
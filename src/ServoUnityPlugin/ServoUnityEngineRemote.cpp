@@ -0,0 +1,584 @@
+//
+// ServoUnityEngineRemote.cpp
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0.If a copy of the MPL was not distributed with this
+// file, You can obtain one at https ://mozilla.org/MPL/2.0/.
+//
+// Copyright (c) 2019-2020 Mozilla, Inc.
+//
+// Author(s): Philip Lamb
+//
+// Engines which run Servo in a servo_unity_remote_host child process.
+//
+// Each remote engine implements the simpleservo API the window calls:
+// - init_with_gl/init_with_egl start the host, and deinit stops it.
+// - Navigation, input and control calls are queued to the host.
+// - perform_updates delivers the callbacks the host has queued since the last
+//   call, so, as with Servo in-process, they arrive on the render thread.
+// - fill_gl_texture uploads the host's latest complete frame, if it is newer
+//   than the one last uploaded.
+// A thread per engine waits on the socket, and calls the engine's wakeup
+// callback when the host signals. If the host exits unexpectedly, the window
+// keeps its last frame, further calls are ignored, and any shutdown
+// completes immediately. After deinit, a reaper thread waits for the host to
+// exit, and kills it if it doesn't.
+//
+
+#include "ServoUnityEngine.h"
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <inttypes.h>
+#include <GL/glcorearb.h>
+#include "ServoUnityRemote.h"
+#include "servo_unity_internal.h"
+#include "servo_unity_log.h"
+#include "servo_unity_trace.h"
+#include "utils.h"
+
+#define SERVO_UNITY_REMOTE_EXIT_TIMEOUT_MS 1000L
+
+extern char **environ;
+
+// The plugin doesn't link to GL, so the few functions needed to upload frames are looked up at runtime.
+static PFNGLGETINTEGERVPROC s_glGetIntegerv = nullptr;
+static PFNGLBINDTEXTUREPROC s_glBindTexture = nullptr;
+static PFNGLPIXELSTOREIPROC s_glPixelStorei = nullptr;
+static PFNGLTEXSUBIMAGE2DPROC s_glTexSubImage2D = nullptr;
+
+static bool lookupGL(void)
+{
+    if (s_glTexSubImage2D) return true;
+    void *lib = RTLD_DEFAULT; // Note: a null handle.
+    if (!dlsym(lib, "glTexSubImage2D")) {
+        lib = dlopen("libGL.so.1", RTLD_NOW | RTLD_LOCAL);
+        if (!lib) return false;
+    }
+    *(void **)&s_glGetIntegerv = dlsym(lib, "glGetIntegerv");
+    *(void **)&s_glBindTexture = dlsym(lib, "glBindTexture");
+    *(void **)&s_glPixelStorei = dlsym(lib, "glPixelStorei");
+    *(void **)&s_glTexSubImage2D = dlsym(lib, "glTexSubImage2D");
+    if (!s_glGetIntegerv || !s_glBindTexture || !s_glPixelStorei || !s_glTexSubImage2D) {
+        s_glTexSubImage2D = nullptr;
+        return false;
+    }
+    return true;
+}
+
+// Waits for deinited hosts to exit, off the render thread, and kills those which don't exit in time.
+class ServoUnityRemoteReaper
+{
+private:
+    struct Host {
+        pid_t pid;
+        uint64_t deadlineNs;
+    };
+    std::mutex m_lock;
+    std::condition_variable m_cond;
+    std::vector<Host> m_hosts; // Guarded by m_lock.
+    bool m_quit; // Guarded by m_lock.
+    std::thread m_thread;
+
+    void run(void)
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        while (!m_quit || !m_hosts.empty()) {
+            if (m_hosts.empty()) {
+                m_cond.wait(lock);
+                continue;
+            }
+            uint64_t nowNs = getTimeNowNs();
+            size_t kept = 0;
+            for (size_t i = 0; i < m_hosts.size(); i++) {
+                const Host& h = m_hosts[i];
+                int status;
+                if (waitpid(h.pid, &status, WNOHANG) != 0) continue; // Exited (or not ours to wait for).
+                if (nowNs >= h.deadlineNs) {
+                    SERVOUNITYLOGw("Servo host process %d did not exit. Killing it.\n", (int)h.pid);
+                    kill(h.pid, SIGKILL);
+                    waitpid(h.pid, &status, 0);
+                    continue;
+                }
+                m_hosts[kept++] = h;
+            }
+            m_hosts.resize(kept);
+            if (!m_hosts.empty()) m_cond.wait_for(lock, std::chrono::milliseconds(10));
+        }
+    }
+
+public:
+    ServoUnityRemoteReaper() : m_quit(false) {}
+
+    // Waits for, or kills, hosts still exiting, so that the thread is gone before the plugin is unloaded.
+    ~ServoUnityRemoteReaper()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_quit = true;
+            m_cond.notify_all();
+        }
+        if (m_thread.joinable()) m_thread.join();
+    }
+
+    void add(pid_t pid)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_hosts.push_back({pid, getTimeNowNs() + SERVO_UNITY_REMOTE_EXIT_TIMEOUT_MS * 1000000ull});
+        if (!m_thread.joinable()) m_thread = std::thread(&ServoUnityRemoteReaper::run, this);
+        m_cond.notify_all();
+    }
+};
+
+static ServoUnityRemoteReaper s_reaper;
+
+class ServoUnityEngineRemote
+{
+private:
+    ServoUnityRemoteShared *m_shared;
+    int m_socket;
+    pid_t m_pid;
+    std::thread *m_watcher;
+    std::atomic<bool> m_hostExited;
+    bool m_hostExitReported; // Render thread only.
+    bool m_hostInvalid; // The host wrote invalid data to shared memory, so nothing more is read from it. Render thread only.
+    bool m_shutdownRequested;
+    bool m_shutdownCompleted;
+    void (*m_wakeup)(void);
+    CHostCallbacks m_callbacks;
+    uint32_t m_frame; // Index of the frame buffer the plugin owns.
+    uint64_t m_frameSeqUploaded;
+
+    void watch(void);
+    void send(ServoUnityRemoteMessageType type, const char *str = nullptr, int32_t i0 = 0, int32_t i1 = 0, int32_t i2 = 0, int32_t i3 = 0, float f0 = 0.0f, float f1 = 0.0f);
+    bool dispatch(const ServoUnityRemoteMessage& msg);
+    void hostInvalid(const char *what);
+
+public:
+    ServoUnityEngineRemote() :
+        m_shared(nullptr),
+        m_socket(-1),
+        m_pid(-1),
+        m_watcher(nullptr),
+        m_hostExited(false),
+        m_hostExitReported(false),
+        m_hostInvalid(false),
+        m_shutdownRequested(false),
+        m_shutdownCompleted(false),
+        m_wakeup(nullptr),
+        m_callbacks(),
+        m_frame(2),
+        m_frameSeqUploaded(0)
+    {
+    }
+
+    void init(CInitOptions opts, void (*wakeup)(void), CHostCallbacks callbacks);
+    void deinit(void);
+    void requestShutdown(void);
+    void performUpdates(void);
+    void fillGLTexture(uint32_t tex_id, int32_t tex_width, int32_t tex_height);
+
+    void resize(int32_t width, int32_t height);
+    bool loadURI(const char *url) { send(ServoUnityRemoteMessageType::LoadURI, url); return true; }
+    void refresh(void) { send(ServoUnityRemoteMessageType::Refresh); }
+    void reload(void) { send(ServoUnityRemoteMessageType::Reload); }
+    void stop(void) { send(ServoUnityRemoteMessageType::Stop); }
+    void goBack(void) { send(ServoUnityRemoteMessageType::GoBack); }
+    void goForward(void) { send(ServoUnityRemoteMessageType::GoForward); }
+    void mouseMove(float x, float y) { send(ServoUnityRemoteMessageType::MouseMove, nullptr, 0, 0, 0, 0, x, y); }
+    void mouseDown(float x, float y, CMouseButton button) { send(ServoUnityRemoteMessageType::MouseDown, nullptr, button, 0, 0, 0, x, y); }
+    void mouseUp(float x, float y, CMouseButton button) { send(ServoUnityRemoteMessageType::MouseUp, nullptr, button, 0, 0, 0, x, y); }
+    void click(float x, float y) { send(ServoUnityRemoteMessageType::Click, nullptr, 0, 0, 0, 0, x, y); }
+    void scroll(int32_t dx, int32_t dy, int32_t x, int32_t y) { send(ServoUnityRemoteMessageType::Scroll, nullptr, dx, dy, x, y); }
+    void keyDown(uint32_t key_code, CKeyType key_type) { send(ServoUnityRemoteMessageType::KeyDown, nullptr, (int32_t)key_code, key_type); }
+    void keyUp(uint32_t key_code, CKeyType key_type) { send(ServoUnityRemoteMessageType::KeyUp, nullptr, (int32_t)key_code, key_type); }
+    void contextMenuClosed(CContextMenuResult result, uint32_t item) { send(ServoUnityRemoteMessageType::ContextMenuClosed, nullptr, result, (int32_t)item); }
+};
+
+static ServoUnityEngineRemote s_remotes[SERVO_UNITY_ENGINES_MAX];
+
+void ServoUnityEngineRemote::init(CInitOptions opts, void (*wakeup)(void), CHostCallbacks callbacks)
+{
+    SERVOUNITYTRACE("ServoUnityEngineRemote::init");
+    m_wakeup = wakeup;
+    m_callbacks = callbacks;
+    m_hostExited = true; // Until the host is running.
+    m_hostExitReported = false;
+    m_hostInvalid = false;
+    m_shutdownRequested = false;
+    m_shutdownCompleted = false;
+    m_frame = 2;
+    m_frameSeqUploaded = 0;
+
+    // Windows are checked when created, so this is a last resort.
+    if (opts.width <= 0 || opts.height <= 0 || opts.width > SERVO_UNITY_REMOTE_FRAME_SIZE_MAX || opts.height > SERVO_UNITY_REMOTE_FRAME_SIZE_MAX) {
+        SERVOUNITYLOGe("Window size %dx%d is outside the Servo host's range of 1 to %d pixels.\n", opts.width, opts.height, SERVO_UNITY_REMOTE_FRAME_SIZE_MAX);
+        return;
+    }
+
+    // Shared memory, sized for the largest frames. It's sparse, so only the pages used by frames are ever allocated.
+    int shm = (int)syscall(SYS_memfd_create, "servo_unity_remote", 1u /* MFD_CLOEXEC */);
+    if (shm == -1) {
+        SERVOUNITYLOGperror("Unable to create shared memory for Servo host");
+        return;
+    }
+    size_t size = servoUnityRemoteSharedSize();
+    void *mem = MAP_FAILED;
+    if (ftruncate(shm, (off_t)size) == 0) mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+    if (mem == MAP_FAILED) {
+        SERVOUNITYLOGperror("Unable to map shared memory for Servo host");
+        close(shm);
+        return;
+    }
+    m_shared = new (mem) ServoUnityRemoteShared();
+    m_shared->size = size;
+    m_shared->width = opts.width;
+    m_shared->height = opts.height;
+    m_shared->density = opts.density;
+    if (opts.args) strncpy(m_shared->args, opts.args, SERVO_UNITY_REMOTE_INIT_STRING_SIZE - 1);
+    std::string logModules;
+    for (uint32_t i = 0; i < opts.vslogger_mod_size; i++) {
+        if (i) logModules += ",";
+        logModules += opts.vslogger_mod_list[i];
+    }
+    strncpy(m_shared->logModules, logModules.c_str(), SERVO_UNITY_REMOTE_INIT_STRING_SIZE - 1);
+
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) == -1) {
+        SERVOUNITYLOGperror("Unable to create socket for Servo host");
+        close(shm);
+        return;
+    }
+
+    // The host finds its ends at fixed descriptors. dup2 clears close-on-exec, except where the
+    // descriptor is already at its target, so first move both out of the way.
+    int shmHigh = fcntl(shm, F_DUPFD_CLOEXEC, 10);
+    int socketHigh = fcntl(sockets[1], F_DUPFD_CLOEXEC, 10);
+    close(shm);
+    close(sockets[1]);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, shmHigh, SERVO_UNITY_REMOTE_SHM_FD);
+    posix_spawn_file_actions_adddup2(&actions, socketHigh, SERVO_UNITY_REMOTE_SOCKET_FD);
+    const std::string remoteHost = servoUnityCopyParamString(s_param_RemoteHost);
+    const char *path = remoteHost.c_str();
+    char *const argv[] = {(char *)path, nullptr};
+    int err = (shmHigh == -1 || socketHigh == -1 ? EMFILE : posix_spawn(&m_pid, path, &actions, nullptr, argv, environ));
+    posix_spawn_file_actions_destroy(&actions);
+    if (shmHigh != -1) close(shmHigh);
+    if (socketHigh != -1) close(socketHigh);
+    if (err) {
+        SERVOUNITYLOGe("Unable to start Servo host '%s': %s.\n", path, strerror(err));
+        close(sockets[0]);
+        m_pid = -1;
+        return;
+    }
+    SERVOUNITYLOGi("Started Servo host process %d.\n", (int)m_pid);
+    m_socket = sockets[0];
+    m_hostExited = false;
+    m_watcher = new std::thread(&ServoUnityEngineRemote::watch, this);
+}
+
+// Runs on the watcher thread. Wakes the window whenever the host signals, and once more if it goes away.
+void ServoUnityEngineRemote::watch(void)
+{
+    char buf[64];
+    while (true) {
+        ssize_t n = read(m_socket, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        m_shared->toPluginSignalled.store(false, std::memory_order_release);
+        if (m_wakeup) (*m_wakeup)();
+    }
+    m_hostExited = true;
+    if (m_wakeup) (*m_wakeup)();
+}
+
+void ServoUnityEngineRemote::send(ServoUnityRemoteMessageType type, const char *str, int32_t i0, int32_t i1, int32_t i2, int32_t i3, float f0, float f1)
+{
+    if (!m_shared || m_hostExited) return;
+    ServoUnityRemoteMessage msg = {type, {i0, i1, i2, i3}, {f0, f1}, -1};
+    if (!servoUnityRemoteSend(m_shared->toHost, m_shared->toHostStrings, m_shared->toHostSignalled, m_socket, msg, str)) {
+        SERVOUNITYLOGw("Servo host message queue full. Message dropped.\n");
+    }
+}
+
+void ServoUnityEngineRemote::resize(int32_t width, int32_t height)
+{
+    if (width > SERVO_UNITY_REMOTE_FRAME_SIZE_MAX || height > SERVO_UNITY_REMOTE_FRAME_SIZE_MAX) {
+        SERVOUNITYLOGe("Window size %dx%d exceeds the Servo host's maximum of %d pixels. Frames won't be shown until the window is made smaller.\n", width, height, SERVO_UNITY_REMOTE_FRAME_SIZE_MAX);
+    }
+    send(ServoUnityRemoteMessageType::Resize, nullptr, width, height);
+}
+
+// Must be called from render thread. Treats the host as if it had exited, so that the window shuts down.
+void ServoUnityEngineRemote::hostInvalid(const char *what)
+{
+    if (!m_hostInvalid) SERVOUNITYLOGe("Servo host process %d wrote an invalid %s. Abandoning it.\n", (int)m_pid, what);
+    m_hostInvalid = true;
+    m_hostExited = true;
+}
+
+void ServoUnityEngineRemote::requestShutdown(void)
+{
+    m_shutdownRequested = true;
+    send(ServoUnityRemoteMessageType::RequestShutdown);
+}
+
+// Must be called from render thread.
+void ServoUnityEngineRemote::performUpdates(void)
+{
+    if (!m_shared) return;
+    if (!m_hostInvalid) {
+        m_shared->toPlugin.drain([this](const ServoUnityRemoteMessage& msg) {
+            if (m_hostInvalid) return; // Drop the rest.
+            if (!dispatch(msg)) {
+                hostInvalid("message");
+                return;
+            }
+            if (msg.str >= 0) m_shared->toPluginStrings.release(msg.str);
+        });
+    }
+    if (m_hostExited && !m_hostExitReported) {
+        m_hostExitReported = true;
+        if (m_pid != -1 && !m_hostInvalid) SERVOUNITYLOGe("Servo host process %d exited unexpectedly.\n", (int)m_pid);
+    }
+    // A host which has gone can't complete a shutdown, including one requested after it went.
+    if (m_hostExited && m_shutdownRequested && !m_shutdownCompleted) {
+        m_shutdownCompleted = true;
+        if (m_callbacks.on_shutdown_complete) m_callbacks.on_shutdown_complete();
+    }
+}
+
+// Must be called from render thread. The message, and its string, were written by the host, so are checked first.
+// @return false if the message is invalid, in which case it is not dispatched.
+bool ServoUnityEngineRemote::dispatch(const ServoUnityRemoteMessage& msg)
+{
+    std::string strCopy; // The host may still write the arena, so copy out no more than the checked length.
+    const char *str = nullptr;
+    if (msg.str != -1) {
+        size_t length;
+        const char *s = m_shared->toPluginStrings.getChecked(msg.str, &length);
+        if (!s) return false;
+        strCopy.assign(s, length);
+        str = strCopy.c_str();
+    }
+    switch (msg.type) {
+        case ServoUnityRemoteMessageType::LoadStarted:
+            if (m_callbacks.on_load_started) m_callbacks.on_load_started();
+            break;
+        case ServoUnityRemoteMessageType::LoadEnded:
+            if (m_callbacks.on_load_ended) m_callbacks.on_load_ended();
+            break;
+        case ServoUnityRemoteMessageType::TitleChanged:
+            if (m_callbacks.on_title_changed && str) m_callbacks.on_title_changed(str);
+            break;
+        case ServoUnityRemoteMessageType::URLChanged:
+            if (m_callbacks.on_url_changed && str) m_callbacks.on_url_changed(str);
+            break;
+        case ServoUnityRemoteMessageType::HistoryChanged:
+            if (m_callbacks.on_history_changed) m_callbacks.on_history_changed(msg.i[0] != 0, msg.i[1] != 0);
+            break;
+        case ServoUnityRemoteMessageType::AnimatingChanged:
+            if (m_callbacks.on_animating_changed) m_callbacks.on_animating_changed(msg.i[0] != 0);
+            break;
+        case ServoUnityRemoteMessageType::ShutdownComplete:
+            m_shutdownCompleted = true;
+            if (m_callbacks.on_shutdown_complete) m_callbacks.on_shutdown_complete();
+            break;
+        case ServoUnityRemoteMessageType::IMEShow:
+            if (m_callbacks.on_ime_show) m_callbacks.on_ime_show(str ? str : "", msg.i[0], msg.i[1], msg.i[2], msg.i[3]);
+            break;
+        case ServoUnityRemoteMessageType::IMEHide:
+            if (m_callbacks.on_ime_hide) m_callbacks.on_ime_hide();
+            break;
+        case ServoUnityRemoteMessageType::DevtoolsStarted:
+            if (m_callbacks.on_devtools_started) m_callbacks.on_devtools_started((CDevtoolsServerState)msg.i[0], (unsigned int)msg.i[1], nullptr);
+            break;
+        case ServoUnityRemoteMessageType::LogOutput:
+            if (m_callbacks.on_log_output && str) m_callbacks.on_log_output(str, (uint32_t)strCopy.length());
+            break;
+        default:
+            SERVOUNITYLOGe("Unexpected message %u from Servo host.\n", (unsigned int)msg.type);
+            return false;
+    }
+    return true;
+}
+
+// Must be called from render thread, with Unity's GL context active.
+void ServoUnityEngineRemote::fillGLTexture(uint32_t tex_id, int32_t tex_width, int32_t tex_height)
+{
+    if (!m_shared || !tex_id || m_hostInvalid) return;
+    if (m_shared->frameLatest.load(std::memory_order_acquire) & SERVO_UNITY_REMOTE_FRAME_FRESH) {
+        uint32_t latest = m_shared->frameLatest.exchange(m_frame, std::memory_order_acq_rel) & ~SERVO_UNITY_REMOTE_FRAME_FRESH;
+        if (latest >= SERVO_UNITY_REMOTE_FRAMES) {
+            hostInvalid("frame index");
+            return;
+        }
+        m_frame = latest;
+    }
+    // The host owns the shared frame header, so take a copy to check and use.
+    const ServoUnityRemoteFrame frame = m_shared->frames[m_frame];
+    if (frame.seq <= m_frameSeqUploaded) return; // Nothing new.
+    if (frame.width <= 0 || frame.height <= 0 || frame.width > SERVO_UNITY_REMOTE_FRAME_SIZE_MAX || frame.height > SERVO_UNITY_REMOTE_FRAME_SIZE_MAX) {
+        hostInvalid("frame size");
+        return;
+    }
+    if (frame.width != tex_width || frame.height != tex_height) return; // Rendered before a resize, or the window is too large.
+    if (!lookupGL()) {
+        static bool logged = false;
+        if (!logged) SERVOUNITYLOGe("Unable to find OpenGL functions to upload Servo host frames.\n");
+        logged = true;
+        return;
+    }
+    SERVOUNITYTRACE("upload");
+    GLint prevTex = 0, prevAlign = 4;
+    s_glGetIntegerv(GL_TEXTURE_BINDING_2D, &prevTex);
+    s_glGetIntegerv(GL_UNPACK_ALIGNMENT, &prevAlign);
+    s_glBindTexture(GL_TEXTURE_2D, tex_id);
+    s_glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    s_glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, tex_width, tex_height, GL_RGBA, GL_UNSIGNED_BYTE, servoUnityRemoteFrameBuffer(m_shared, m_frame));
+    s_glPixelStorei(GL_UNPACK_ALIGNMENT, prevAlign);
+    s_glBindTexture(GL_TEXTURE_2D, (GLuint)prevTex);
+    if (frame.seq > m_frameSeqUploaded + 1 && m_frameSeqUploaded) SERVOUNITYLOGd("Skipped %" PRIu64 " Servo host frame(s).\n", frame.seq - m_frameSeqUploaded - 1);
+    m_frameSeqUploaded = frame.seq;
+}
+
+// Must be called from render thread. Doesn't wait for the host to exit.
+void ServoUnityEngineRemote::deinit(void)
+{
+    SERVOUNITYTRACE("ServoUnityEngineRemote::deinit");
+    send(ServoUnityRemoteMessageType::Deinit);
+    // The host exits on Deinit, or on finding the socket closed. It has its own mapping of the shared memory.
+    if (m_pid != -1) {
+        s_reaper.add(m_pid);
+        m_pid = -1;
+    }
+    if (m_socket != -1) shutdown(m_socket, SHUT_RDWR); // Releases the watcher, whatever the state of the host.
+    if (m_watcher) {
+        m_watcher->join();
+        delete m_watcher;
+        m_watcher = nullptr;
+    }
+    if (m_socket != -1) {
+        close(m_socket);
+        m_socket = -1;
+    }
+    if (m_shared) {
+        size_t size = m_shared->size;
+        m_shared->~ServoUnityRemoteShared();
+        munmap(m_shared, size);
+        m_shared = nullptr;
+    }
+    m_wakeup = nullptr;
+}
+
+//
+// The API of each remote engine. As with the callbacks in ServoUnityEngine.cpp, each engine has its own
+// instantiation, so that the functions can find the engine's state.
+//
+
+template <size_t I>
+struct ServoUnityEngineRemoteAPI
+{
+    static void init(CInitOptions opts, void (*wakeup)(void), CHostCallbacks callbacks) { s_remotes[I].init(opts, wakeup, callbacks); }
+    static void deinit(void) { s_remotes[I].deinit(); }
+    static void request_shutdown(void) { s_remotes[I].requestShutdown(); }
+    static void perform_updates(void) { s_remotes[I].performUpdates(); }
+    static void fill_gl_texture(uint32_t tex_id, int32_t tex_width, int32_t tex_height) { s_remotes[I].fillGLTexture(tex_id, tex_width, tex_height); }
+    static void resize(int32_t width, int32_t height) { s_remotes[I].resize(width, height); }
+    static bool load_uri(const char *url) { return s_remotes[I].loadURI(url); }
+    static void refresh(void) { s_remotes[I].refresh(); }
+    static void reload(void) { s_remotes[I].reload(); }
+    static void stop(void) { s_remotes[I].stop(); }
+    static void go_back(void) { s_remotes[I].goBack(); }
+    static void go_forward(void) { s_remotes[I].goForward(); }
+    static void mouse_move(float x, float y) { s_remotes[I].mouseMove(x, y); }
+    static void mouse_down(float x, float y, CMouseButton button) { s_remotes[I].mouseDown(x, y, button); }
+    static void mouse_up(float x, float y, CMouseButton button) { s_remotes[I].mouseUp(x, y, button); }
+    static void click(float x, float y) { s_remotes[I].click(x, y); }
+    static void scroll(int32_t dx, int32_t dy, int32_t x, int32_t y) { s_remotes[I].scroll(dx, dy, x, y); }
+    static void key_down(uint32_t key_code, CKeyType key_type) { s_remotes[I].keyDown(key_code, key_type); }
+    static void key_up(uint32_t key_code, CKeyType key_type) { s_remotes[I].keyUp(key_code, key_type); }
+    static void on_context_menu_closed(CContextMenuResult result, uint32_t item) { s_remotes[I].contextMenuClosed(result, item); }
+
+    static ServoUnityEngine::API api(void)
+    {
+        ServoUnityEngine::API a;
+        a.init_with_gl = init;
+        a.init_with_egl = init; // The host makes its own context, so the kind of Unity's doesn't matter.
+        a.deinit = deinit;
+        a.request_shutdown = request_shutdown;
+        a.perform_updates = perform_updates;
+        a.fill_gl_texture = fill_gl_texture;
+        a.resize = resize;
+        a.is_uri_valid = &::is_uri_valid; // Doesn't depend on engine state.
+        a.load_uri = load_uri;
+        a.refresh = refresh;
+        a.reload = reload;
+        a.stop = stop;
+        a.go_back = go_back;
+        a.go_forward = go_forward;
+        a.mouse_move = mouse_move;
+        a.mouse_down = mouse_down;
+        a.mouse_up = mouse_up;
+        a.click = click;
+        a.scroll = scroll;
+        a.key_down = key_down;
+        a.key_up = key_up;
+        a.on_context_menu_closed = on_context_menu_closed;
+        return a;
+    }
+};
+
+template <size_t... Is>
+static ServoUnityEngine::API remoteAPIForIndex(size_t index, std::index_sequence<Is...>)
+{
+    static ServoUnityEngine::API (*const table[])(void) = {ServoUnityEngineRemoteAPI<Is>::api...};
+    return table[index]();
+}
+
+bool ServoUnityEngine::remoteAPI(size_t index, API *api_out)
+{
+    *api_out = remoteAPIForIndex(index, std::make_index_sequence<SERVO_UNITY_ENGINES_MAX>());
+    return true;
+}
+
+int ServoUnityEngine::remoteSizeMax(void)
+{
+    return SERVO_UNITY_REMOTE_FRAME_SIZE_MAX;
+}
+
+#else // !__linux__
+
+bool ServoUnityEngine::remoteAPI(size_t index, API *api_out)
+{
+    return false;
+}
+
+int ServoUnityEngine::remoteSizeMax(void)
+{
+    return 0;
+}
+
+#endif // __linux__
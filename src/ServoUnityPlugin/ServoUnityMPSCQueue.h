@@ -0,0 +1,153 @@
+//
+// ServoUnityMPSCQueue.h
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0.If a copy of the MPL was not distributed with this
+// file, You can obtain one at https ://mozilla.org/MPL/2.0/.
+//
+// Copyright (c) 2019-2020 Mozilla, Inc.
+//
+// Author(s): Philip Lamb
+//
+// A bounded, lock-free, multi-producer/single-consumer queue of fixed-size
+// records. Any thread may push; exactly one thread (normally the render thread)
+// may pop. Based on Dmitry Vyukov's bounded MPMC queue, with the consumer side
+// simplified because only a single thread ever dequeues.
+//
+// Records are copied in and out by value, so T should be a small, trivially
+// copyable type. Storage is allocated once, inline, so pushing and popping never
+// touch the heap.
+//
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+template <typename T, size_t N>
+class ServoUnityMPSCQueue
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "ServoUnityMPSCQueue capacity must be a power of two.");
+    static_assert(std::is_trivially_copyable<T>::value, "ServoUnityMPSCQueue records must be trivially copyable.");
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    alignas(64) Cell m_cells[N];
+    alignas(64) std::atomic<size_t> m_enqueuePos;
+    alignas(64) std::atomic<size_t> m_dequeuePos; // Only written by the consumer.
+    std::atomic<uint64_t> m_overflowCount;
+
+public:
+    ServoUnityMPSCQueue() : m_enqueuePos(0), m_dequeuePos(0), m_overflowCount(0) {
+        for (size_t i = 0; i < N; i++) m_cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    ServoUnityMPSCQueue(const ServoUnityMPSCQueue&) = delete;
+    void operator=(const ServoUnityMPSCQueue&) = delete;
+
+    static constexpr size_t capacity() { return N; }
+
+    /// Enqueue a record. Safe to call from any thread.
+    /// @return true if the record was queued, false if the queue was full (in which case the overflow count is incremented).
+    bool push(const T& record) {
+        Cell *cell;
+        size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &m_cells[pos & (N - 1)];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0) {
+                if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (dif < 0) {
+                m_overflowCount.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                pos = m_enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = record;
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Enqueue up to `count` records, in order. Safe to call from any thread.
+    /// Where there is room, the whole batch is reserved with a single CAS, so the
+    /// records are contiguous in the queue. Otherwise falls back to pushing records
+    /// one at a time until the queue fills.
+    /// @return The number of records queued.
+    size_t push(const T *records, size_t count) {
+        if (count == 0) return 0;
+        if (count <= N) {
+            size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+            while (true) {
+                // The consumer frees cells in order, so if the last cell of the range is free for this lap, all are.
+                size_t last = pos + count - 1;
+                size_t seq = m_cells[last & (N - 1)].seq.load(std::memory_order_acquire);
+                intptr_t dif = (intptr_t)seq - (intptr_t)last;
+                if (dif < 0) break; // Not enough room.
+                if (dif > 0) {
+                    pos = m_enqueuePos.load(std::memory_order_relaxed);
+                    continue;
+                }
+                if (m_enqueuePos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) {
+                    for (size_t i = 0; i < count; i++) {
+                        Cell *cell = &m_cells[(pos + i) & (N - 1)];
+                        cell->data = records[i];
+                        cell->seq.store(pos + i + 1, std::memory_order_release);
+                    }
+                    return count;
+                }
+            }
+        }
+        size_t pushed = 0;
+        while (pushed < count && push(records[pushed])) pushed++;
+        if (pushed < count) m_overflowCount.fetch_add(count - pushed - 1, std::memory_order_relaxed); // push() counted one.
+        return pushed;
+    }
+
+    /// Dequeue the oldest record. Must only be called from the consumer thread.
+    /// @return true if a record was dequeued into `record`, false if the queue was empty.
+    bool pop(T& record) {
+        size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+        Cell *cell = &m_cells[pos & (N - 1)];
+        size_t seq = cell->seq.load(std::memory_order_acquire);
+        if ((intptr_t)seq - (intptr_t)(pos + 1) < 0) return false;
+        record = cell->data;
+        cell->seq.store(pos + N, std::memory_order_release);
+        m_dequeuePos.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /// Dequeue every record currently in the queue, passing each to `fn` in order.
+    /// Records pushed while the drain is in progress may or may not be included,
+    /// but at most one queue's worth of records is drained per call.
+    /// Must only be called from the consumer thread.
+    /// @return The number of records drained.
+    template <typename F>
+    size_t drain(F fn) {
+        size_t count = 0;
+        T record;
+        while (count < N && pop(record)) {
+            fn(record);
+            count++;
+        }
+        return count;
+    }
+
+    /// Approximate number of records in the queue. Exact only when called from the consumer with no producers active.
+    size_t sizeApprox() const {
+        size_t enq = m_enqueuePos.load(std::memory_order_relaxed);
+        size_t deq = m_dequeuePos.load(std::memory_order_relaxed);
+        return (enq > deq ? enq - deq : 0);
+    }
+
+    /// Total number of records rejected because the queue was full.
+    uint64_t overflowCount() const {
+        return m_overflowCount.load(std::memory_order_relaxed);
+    }
+};
@@ -0,0 +1,192 @@
+//
+// ServoUnityRemote.h
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0.If a copy of the MPL was not distributed with this
+// file, You can obtain one at https ://mozilla.org/MPL/2.0/.
+//
+// Copyright (c) 2019-2020 Mozilla, Inc.
+//
+// Author(s): Philip Lamb
+//
+// The shared-memory protocol between the plugin and servo_unity_remote_host,
+// a child process which runs a window's Servo engine outside Unity's process
+// (Linux only). The plugin creates a memfd holding a ServoUnityRemoteShared,
+// followed by SERVO_UNITY_REMOTE_FRAMES pixel buffers, and starts the host
+// with the memfd as SERVO_UNITY_REMOTE_SHM_FD and one end of a socket pair as
+// SERVO_UNITY_REMOTE_SOCKET_FD.
+//
+// - Control and input go from plugin to host, and callbacks from host to
+//   plugin, as fixed-size messages in a lock-free queue in each direction.
+//   Strings travel in a string arena alongside each queue, and are released
+//   by the receiver.
+// - Frames go from host to plugin through a triple buffer: the host renders
+//   into the buffer it owns, then exchanges it with the "latest" buffer, and
+//   the plugin exchanges its buffer with the latest only if a newer frame has
+//   been published. So the plugin only ever uploads the most recent complete
+//   frame, and neither side waits for the other. Each buffer carries the
+//   sequence number of the frame it holds.
+// - After queueing messages or publishing a frame, the sender writes a byte to
+//   the socket, unless the receiver has yet to see the last one. The socket
+//   also tells each side when the other has gone away.
+//
+// Buffers are sized for the largest frame supported, but the memfd is sparse,
+// so only the pages a frame actually touches are ever allocated.
+//
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <unistd.h>
+#include "ServoUnityMPSCQueue.h"
+#include "ServoUnityStringArena.h"
+
+#define SERVO_UNITY_REMOTE_MAGIC 0x48525553u // "SURH".
+#define SERVO_UNITY_REMOTE_VERSION 1
+#define SERVO_UNITY_REMOTE_QUEUE_SIZE 1024 // Must be a power of two.
+#define SERVO_UNITY_REMOTE_STRING_ARENA_SIZE 65536
+#define SERVO_UNITY_REMOTE_INIT_STRING_SIZE 1024
+#define SERVO_UNITY_REMOTE_FRAMES 3
+#define SERVO_UNITY_REMOTE_FRAME_SIZE_MAX 4096 // Maximum frame width and height, in pixels.
+#define SERVO_UNITY_REMOTE_SHM_FD 3
+#define SERVO_UNITY_REMOTE_SOCKET_FD 4
+
+enum class ServoUnityRemoteMessageType : uint32_t {
+    None = 0,
+    // Plugin to host.
+    RequestShutdown,
+    Deinit,
+    Resize,             // i[0] width, i[1] height.
+    MouseMove,          // f[0] x, f[1] y.
+    MouseDown,          // f[0] x, f[1] y, i[0] button.
+    MouseUp,            // f[0] x, f[1] y, i[0] button.
+    Click,              // f[0] x, f[1] y.
+    Scroll,             // i[0] dx, i[1] dy, i[2] x, i[3] y.
+    KeyDown,            // i[0] key code, i[1] key type.
+    KeyUp,              // i[0] key code, i[1] key type.
+    Refresh,
+    Reload,
+    Stop,
+    GoBack,
+    GoForward,
+    LoadURI,            // str.
+    ContextMenuClosed,  // i[0] result, i[1] item.
+    // Host to plugin.
+    LoadStarted = 100,
+    LoadEnded,
+    TitleChanged,       // str.
+    URLChanged,         // str.
+    HistoryChanged,     // i[0] can go back, i[1] can go forward.
+    AnimatingChanged,   // i[0] animating.
+    ShutdownComplete,
+    IMEShow,            // str, i[0] x, i[1] y, i[2] width, i[3] height.
+    IMEHide,
+    DevtoolsStarted,    // i[0] result, i[1] port.
+    LogOutput           // str.
+};
+
+typedef struct {
+    ServoUnityRemoteMessageType type;
+    int32_t i[4];
+    float f[2];
+    int32_t str; // Offset in the sender's string arena, or -1.
+} ServoUnityRemoteMessage;
+
+typedef struct {
+    uint64_t seq; // 0 if the buffer has never held a frame.
+    int32_t width;
+    int32_t height; // Pixels are RGBA, bottom row first, with no row padding.
+} ServoUnityRemoteFrame;
+
+struct ServoUnityRemoteShared {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size; // Of the whole mapping, including frame buffers.
+
+    // Set by the plugin before starting the host.
+    int32_t width;
+    int32_t height;
+    float density;
+    char args[SERVO_UNITY_REMOTE_INIT_STRING_SIZE]; // Servo's command line, e.g. "--vslogger-level info".
+    char logModules[SERVO_UNITY_REMOTE_INIT_STRING_SIZE]; // Comma-separated.
+
+    ServoUnityMPSCQueue<ServoUnityRemoteMessage, SERVO_UNITY_REMOTE_QUEUE_SIZE> toHost;
+    ServoUnityStringArena<SERVO_UNITY_REMOTE_STRING_ARENA_SIZE> toHostStrings;
+    std::atomic<bool> toHostSignalled; // A byte has been written to the host since it last read the socket.
+    ServoUnityMPSCQueue<ServoUnityRemoteMessage, SERVO_UNITY_REMOTE_QUEUE_SIZE> toPlugin;
+    ServoUnityStringArena<SERVO_UNITY_REMOTE_STRING_ARENA_SIZE> toPluginStrings;
+    std::atomic<bool> toPluginSignalled;
+
+    // Triple-buffered frames. frameLatest holds the index of the buffer most recently published,
+    // with SERVO_UNITY_REMOTE_FRAME_FRESH set until the plugin takes it. The host initially owns
+    // buffer 0, and the plugin buffer 2.
+    std::atomic<uint32_t> frameLatest;
+    ServoUnityRemoteFrame frames[SERVO_UNITY_REMOTE_FRAMES];
+
+    ServoUnityRemoteShared() :
+        magic(SERVO_UNITY_REMOTE_MAGIC),
+        version(SERVO_UNITY_REMOTE_VERSION),
+        size(0),
+        width(0),
+        height(0),
+        density(1.0f),
+        args(),
+        logModules(),
+        toHostSignalled(false),
+        toPluginSignalled(false),
+        frameLatest(1),
+        frames()
+    {
+    }
+
+    ServoUnityRemoteShared(const ServoUnityRemoteShared&) = delete;
+    void operator=(const ServoUnityRemoteShared&) = delete;
+};
+
+#define SERVO_UNITY_REMOTE_FRAME_FRESH 0x4u
+
+static_assert(ATOMIC_BOOL_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2, "Atomics shared between processes must be lock-free.");
+
+/// Offset of the first frame buffer from the start of the mapping.
+inline size_t servoUnityRemoteFrameBufferOffset(void)
+{
+    return (sizeof(ServoUnityRemoteShared) + 4095) & ~(size_t)4095;
+}
+
+inline size_t servoUnityRemoteFrameBufferSize(void)
+{
+    return (size_t)SERVO_UNITY_REMOTE_FRAME_SIZE_MAX * SERVO_UNITY_REMOTE_FRAME_SIZE_MAX * 4;
+}
+
+inline size_t servoUnityRemoteSharedSize(void)
+{
+    return servoUnityRemoteFrameBufferOffset() + SERVO_UNITY_REMOTE_FRAMES * servoUnityRemoteFrameBufferSize();
+}
+
+inline uint8_t *servoUnityRemoteFrameBuffer(ServoUnityRemoteShared *shared, uint32_t index)
+{
+    return (uint8_t *)shared + servoUnityRemoteFrameBufferOffset() + index * servoUnityRemoteFrameBufferSize();
+}
+
+/// Queue a message, with an optional string, and signal the receiver if it hasn't been signalled
+/// since it last read the socket. Safe to call from any thread.
+/// @return false if the queue or string arena was full, in which case the message was dropped.
+template <typename Q, typename A>
+inline bool servoUnityRemoteSend(Q& queue, A& strings, std::atomic<bool>& signalled, int socket, ServoUnityRemoteMessage msg, const char *str)
+{
+    msg.str = -1;
+    if (str) {
+        msg.str = strings.store(str);
+        if (msg.str < 0) return false;
+    }
+    if (!queue.push(msg)) {
+        if (msg.str >= 0) strings.release(msg.str);
+        return false;
+    }
+    if (!signalled.exchange(true, std::memory_order_acq_rel)) {
+        char b = 0;
+        if (write(socket, &b, 1) < 0) {} // If the receiver has gone, the socket's other users will find out.
+    }
+    return true;
+}
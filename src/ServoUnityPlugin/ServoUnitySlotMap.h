@@ -0,0 +1,266 @@
+//
+// ServoUnitySlotMap.h
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0.If a copy of the MPL was not distributed with this
+// file, You can obtain one at https ://mozilla.org/MPL/2.0/.
+//
+// Copyright (c) 2019-2020 Mozilla, Inc.
+//
+// Author(s): Philip Lamb
+//
+// A fixed-capacity slot map of owned objects, addressed by generation-tagged
+// integer handles. A handle packs a slot number into its low bits and the slot's
+// generation into the remaining bits; the generation is advanced each time an
+// object is erased, so a handle to an erased object is rejected even after its
+// slot has been reused. Handles are always positive, so 0 and negatives are
+// never valid.
+//
+// Insertion and erasure take a mutex. Lookup takes no locks and may be done from
+// any thread, but only inside a ReadGuard. Erased objects are not deleted until
+// every guard which might have seen them has been released (epoch-based
+// reclamation), so a pointer returned from get() remains valid for the lifetime
+// of the guard it was obtained under.
+//
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+template <typename T, size_t N>
+class ServoUnitySlotMap
+{
+    static_assert(N >= 2 && N <= 4096 && (N & (N - 1)) == 0, "ServoUnitySlotMap capacity must be a power of two no greater than 4096.");
+
+private:
+    static constexpr int log2(size_t n) { return n <= 1 ? 0 : 1 + log2(n >> 1); }
+    static constexpr int kSlotBits = log2(N);
+    static constexpr uint32_t kGenerationMax = (1u << (31 - kSlotBits)) - 1;
+    static constexpr size_t kMaxReaders = 16; // Threads beyond this many read under a shared counter which holds off all reclamation.
+
+    struct Slot {
+        std::atomic<uint32_t> generation; // Never 0.
+        std::atomic<T *> ptr;
+    };
+
+    struct alignas(64) Reader {
+        std::atomic<uint64_t> epoch; // 0 when not inside a guard.
+        std::atomic<bool> claimed;
+        int depth; // Only touched by the owning thread.
+    };
+
+    struct Retired {
+        T *ptr;
+        uint64_t epoch;
+    };
+
+    // The calling thread's reader record. Released when the thread exits.
+    struct ThreadReader {
+        const ServoUnitySlotMap *map = nullptr;
+        Reader *reader = nullptr;
+        int overflowDepth = 0;
+        ~ThreadReader() { if (reader) reader->claimed.store(false, std::memory_order_release); }
+    };
+    static thread_local ThreadReader t_reader;
+
+    Slot m_slots[N];
+    Reader m_readers[kMaxReaders];
+    alignas(64) std::atomic<uint64_t> m_epoch;
+    std::atomic<int> m_overflowReaders;
+    std::atomic<int> m_size;
+    std::atomic<size_t> m_slotsUsed; // High-water mark. Slots at or above this have never held an object.
+    std::atomic<size_t> m_retiredCount; // Mirrors m_retired.size(), so reclaim() can skip the lock when there's nothing to do.
+
+    // Writer state, guarded by m_lock.
+    std::mutex m_lock;
+    std::vector<size_t> m_free;
+    std::vector<Retired> m_retired;
+
+    static int makeHandle(size_t slot, uint32_t generation) { return (int)((generation << kSlotBits) | (uint32_t)slot); }
+
+    Reader *threadReader() {
+        ThreadReader& tr = t_reader;
+        if (tr.map == this) return tr.reader;
+        if (tr.reader) tr.reader->claimed.store(false, std::memory_order_release);
+        tr.map = this;
+        tr.reader = nullptr;
+        for (size_t i = 0; i < kMaxReaders; i++) {
+            bool expected = false;
+            if (!m_readers[i].claimed.load(std::memory_order_relaxed) && m_readers[i].claimed.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                m_readers[i].depth = 0;
+                tr.reader = &m_readers[i];
+                break;
+            }
+        }
+        return tr.reader;
+    }
+
+    void enterRead() {
+        Reader *r = threadReader();
+        if (!r) {
+            if (t_reader.overflowDepth++ == 0) m_overflowReaders.fetch_add(1, std::memory_order_seq_cst);
+            return;
+        }
+        if (r->depth++ == 0) r->epoch.store(m_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+    }
+
+    void exitRead() {
+        Reader *r = t_reader.reader;
+        if (!r) {
+            if (--t_reader.overflowDepth == 0) m_overflowReaders.fetch_sub(1, std::memory_order_release);
+            return;
+        }
+        if (--r->depth == 0) r->epoch.store(0, std::memory_order_release);
+    }
+
+    // Must be called with m_lock held. Deletes every retired object which no reader can still hold.
+    void reclaimLocked() {
+        if (m_retired.empty()) return;
+        if (m_overflowReaders.load(std::memory_order_seq_cst) > 0) return;
+        uint64_t oldest = UINT64_MAX;
+        for (size_t i = 0; i < kMaxReaders; i++) {
+            uint64_t e = m_readers[i].epoch.load(std::memory_order_seq_cst);
+            if (e && e < oldest) oldest = e;
+        }
+        // A reader which entered at or before an object's retirement epoch may hold it.
+        size_t kept = 0;
+        for (size_t i = 0; i < m_retired.size(); i++) {
+            if (m_retired[i].epoch < oldest) delete m_retired[i].ptr;
+            else m_retired[kept++] = m_retired[i];
+        }
+        m_retired.resize(kept);
+        m_retiredCount.store(kept, std::memory_order_relaxed);
+    }
+
+    // Must be called with m_lock held.
+    void eraseSlotLocked(size_t slot) {
+        T *p = m_slots[slot].ptr.exchange(nullptr, std::memory_order_seq_cst);
+        uint32_t g = m_slots[slot].generation.load(std::memory_order_relaxed);
+        m_slots[slot].generation.store(g >= kGenerationMax ? 1 : g + 1, std::memory_order_seq_cst);
+        m_free.push_back(slot);
+        m_size.fetch_sub(1, std::memory_order_relaxed);
+        m_retired.push_back({p, m_epoch.fetch_add(1, std::memory_order_seq_cst)});
+        m_retiredCount.store(m_retired.size(), std::memory_order_relaxed);
+    }
+
+public:
+    ServoUnitySlotMap() : m_epoch(1), m_overflowReaders(0), m_size(0), m_slotsUsed(0), m_retiredCount(0) {
+        for (size_t i = 0; i < N; i++) {
+            m_slots[i].generation.store(1, std::memory_order_relaxed);
+            m_slots[i].ptr.store(nullptr, std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < kMaxReaders; i++) {
+            m_readers[i].epoch.store(0, std::memory_order_relaxed);
+            m_readers[i].claimed.store(false, std::memory_order_relaxed);
+            m_readers[i].depth = 0;
+        }
+    }
+
+    ~ServoUnitySlotMap() {
+        for (size_t i = 0; i < m_slotsUsed.load(std::memory_order_relaxed); i++) delete m_slots[i].ptr.load(std::memory_order_relaxed);
+        for (const Retired& r : m_retired) delete r.ptr;
+    }
+
+    ServoUnitySlotMap(const ServoUnitySlotMap&) = delete;
+    void operator=(const ServoUnitySlotMap&) = delete;
+
+    static constexpr size_t capacity() { return N; }
+
+    /// Holds off deletion of erased objects for its lifetime. Guards may be nested.
+    class ReadGuard
+    {
+    private:
+        ServoUnitySlotMap& m_map;
+    public:
+        explicit ReadGuard(ServoUnitySlotMap& map) : m_map(map) { m_map.enterRead(); }
+        ~ReadGuard() { m_map.exitRead(); }
+        ReadGuard(const ReadGuard&) = delete;
+        void operator=(const ReadGuard&) = delete;
+    };
+
+    /// Insert an object. The handle is allocated first and passed to make(), which returns the object
+    /// (which may record its own handle). If make() returns null, nothing is inserted.
+    /// @return The new object's handle, or 0 if the map is full or make() failed.
+    template <typename F>
+    int insert(F make) {
+        std::lock_guard<std::mutex> lk(m_lock);
+        reclaimLocked();
+        size_t slot;
+        if (!m_free.empty()) slot = m_free.back();
+        else if (m_slotsUsed.load(std::memory_order_relaxed) < N) slot = m_slotsUsed.load(std::memory_order_relaxed);
+        else return 0;
+        int handle = makeHandle(slot, m_slots[slot].generation.load(std::memory_order_relaxed));
+        std::unique_ptr<T> obj = make(handle);
+        if (!obj) return 0;
+        m_slots[slot].ptr.store(obj.release(), std::memory_order_seq_cst);
+        if (!m_free.empty()) m_free.pop_back();
+        else m_slotsUsed.store(slot + 1, std::memory_order_release);
+        m_size.fetch_add(1, std::memory_order_relaxed);
+        return handle;
+    }
+
+    /// Remove an object. It is deleted once no ReadGuard which might have obtained it remains.
+    /// @return false if the handle is stale or invalid.
+    bool erase(int handle) {
+        if (handle <= 0) return false;
+        size_t slot = (uint32_t)handle & (N - 1);
+        std::lock_guard<std::mutex> lk(m_lock);
+        if (m_slots[slot].generation.load(std::memory_order_relaxed) != ((uint32_t)handle >> kSlotBits) || !m_slots[slot].ptr.load(std::memory_order_relaxed)) return false;
+        eraseSlotLocked(slot);
+        reclaimLocked();
+        return true;
+    }
+
+    /// Remove all objects, as if by erase().
+    void clear() {
+        std::lock_guard<std::mutex> lk(m_lock);
+        for (size_t i = 0; i < m_slotsUsed.load(std::memory_order_relaxed); i++) {
+            if (m_slots[i].ptr.load(std::memory_order_relaxed)) eraseSlotLocked(i);
+        }
+        reclaimLocked();
+    }
+
+    /// Delete any erased objects which are no longer reachable by a reader. Cheap when there are none.
+    /// Must not be called inside a ReadGuard on this map, or the calling thread's own guard holds off deletion.
+    void reclaim() {
+        if (m_retiredCount.load(std::memory_order_relaxed) == 0) return;
+        std::lock_guard<std::mutex> lk(m_lock);
+        reclaimLocked();
+    }
+
+    /// Look up an object. Must be called inside a ReadGuard on this map, and the result
+    /// must not be used after that guard is released.
+    /// @return The object, or nullptr if the handle is stale or invalid.
+    T *get(int handle) const {
+        if (handle <= 0) return nullptr;
+        const Slot& s = m_slots[(uint32_t)handle & (N - 1)];
+        uint32_t generation = (uint32_t)handle >> kSlotBits;
+        // Read the generation on both sides of the pointer, so that a pointer read across an erase and reinsert is rejected.
+        if (s.generation.load(std::memory_order_seq_cst) != generation) return nullptr;
+        T *p = s.ptr.load(std::memory_order_seq_cst);
+        if (s.generation.load(std::memory_order_seq_cst) != generation) return nullptr;
+        return p;
+    }
+
+    /// Call f(handle, object) for every object. Must be called inside a ReadGuard on this map.
+    /// Objects inserted or erased during the iteration may or may not be visited.
+    template <typename F>
+    void forEach(F f) const {
+        size_t used = m_slotsUsed.load(std::memory_order_acquire);
+        for (size_t i = 0; i < used; i++) {
+            uint32_t generation = m_slots[i].generation.load(std::memory_order_seq_cst);
+            T *p = m_slots[i].ptr.load(std::memory_order_seq_cst);
+            if (p && m_slots[i].generation.load(std::memory_order_seq_cst) == generation) f(makeHandle(i, generation), p);
+        }
+    }
+
+    /// The number of objects currently in the map.
+    int size() const { return m_size.load(std::memory_order_relaxed); }
+};
+
+template <typename T, size_t N>
+thread_local typename ServoUnitySlotMap<T, N>::ThreadReader ServoUnitySlotMap<T, N>::t_reader;
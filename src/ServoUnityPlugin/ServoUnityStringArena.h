@@ -0,0 +1,85 @@
+//
+// ServoUnityStringArena.h
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0.If a copy of the MPL was not distributed with this
+// file, You can obtain one at https ://mozilla.org/MPL/2.0/.
+//
+// Copyright (c) 2019-2020 Mozilla, Inc.
+//
+// Author(s): Philip Lamb
+//
+// A fixed-size, lock-free bump arena for short-lived strings that need to
+// travel alongside fixed-size task records (e.g. a URL passed to navigate).
+// Any thread may store or release strings. Storage is reclaimed in one go
+// whenever the last live string is released, so the arena suits strings that
+// are consumed within a frame or two of being stored.
+//
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+template <size_t N>
+class ServoUnityStringArena
+{
+    static_assert(N > 0 && N < INT32_MAX, "ServoUnityStringArena size out of range.");
+
+private:
+    char m_buf[N];
+    // High 32 bits: offset of next free byte. Low 32 bits: count of live strings.
+    std::atomic<uint64_t> m_state;
+
+public:
+    ServoUnityStringArena() : m_state(0) {}
+
+    ServoUnityStringArena(const ServoUnityStringArena&) = delete;
+    void operator=(const ServoUnityStringArena&) = delete;
+
+    /// Copy a nul-terminated string into the arena.
+    /// @return The offset of the copy, to be passed to get() and release(), or -1 if there is insufficient space.
+    int32_t store(const char *s) {
+        size_t need = strlen(s) + 1;
+        if (need > N) return -1;
+        uint64_t state = m_state.load(std::memory_order_relaxed);
+        uint64_t offset;
+        while (true) {
+            offset = state >> 32;
+            uint64_t live = state & 0xffffffffu;
+            if (offset + need > N) return -1;
+            if (m_state.compare_exchange_weak(state, ((offset + need) << 32) | (live + 1), std::memory_order_acquire, std::memory_order_relaxed)) break;
+        }
+        memcpy(m_buf + offset, s, need);
+        return (int32_t)offset;
+    }
+
+    /// Get a pointer to a stored string. Valid until the string is released.
+    const char *get(int32_t offset) const {
+        return m_buf + offset;
+    }
+
+    /// Get a stored string whose offset comes from an untrusted source, e.g. another process sharing the arena.
+    /// @param length_out Receives the string's length. As the other process may still be writing the arena,
+    ///     read no more than this many bytes, rather than relying on the nul.
+    /// @return The string, or nullptr if the offset is out of range or the string isn't nul-terminated within the arena.
+    const char *getChecked(int32_t offset, size_t *length_out) const {
+        if (offset < 0 || (size_t)offset >= N) return nullptr;
+        const void *end = memchr(m_buf + offset, 0, N - offset);
+        if (!end) return nullptr;
+        *length_out = (size_t)((const char *)end - (m_buf + offset));
+        return m_buf + offset;
+    }
+
+    /// Release a stored string. Strings may be released in any order.
+    void release(int32_t offset) {
+        (void)offset;
+        uint64_t state = m_state.load(std::memory_order_relaxed);
+        while (true) {
+            uint64_t live = state & 0xffffffffu;
+            uint64_t next = (live <= 1 ? 0 : ((state & 0xffffffff00000000u) | (live - 1)));
+            if (m_state.compare_exchange_weak(state, next, std::memory_order_release, std::memory_order_relaxed)) break;
+        }
+    }
+};
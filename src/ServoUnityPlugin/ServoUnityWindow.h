@@ -14,15 +14,41 @@
 
 #include "servo_unity_c.h"
 #include <string>
+#include <atomic>
 
 class ServoUnityWindow
 {
+private:
+    std::atomic<bool> m_active;
+    static std::atomic<int> s_activeWindowCount;
 protected:
-	ServoUnityWindow(int uid, int uidExt) : m_uid(uid), m_uidExt(uidExt) { }
+	ServoUnityWindow(int uid, int uidExt) : m_active(true), m_uid(uid), m_uidExt(uidExt) { s_activeWindowCount++; }
 	int m_uid;
 	int m_uidExt;
+
+    // Idle state. An idle window has no pending work, so update requests for it return immediately.
+    // Anything that gives the window work must record that work first and then call markActive().
+    // The render thread calls tryMarkIdle() when it finds no work, and must then check again for
+    // work that arrived in the meantime, calling markActive() if it finds any.
+    // The count is raised before a window is published as active, and lowered after it is published as idle,
+    // so it is never less than the number of active windows, though it may briefly be more.
+    void markActive() {
+        if (m_active.load()) return;
+        s_activeWindowCount++;
+        if (m_active.exchange(true)) s_activeWindowCount--; // Already counted by another caller.
+    }
+    bool tryMarkIdle() {
+        bool expected = true;
+        if (!m_active.compare_exchange_strong(expected, false)) return false;
+        s_activeWindowCount--;
+        return true;
+    }
 public:
-	virtual ~ServoUnityWindow() {};
+	virtual ~ServoUnityWindow() { if (m_active) s_activeWindowCount--; };
+
+    bool isIdle() { return !m_active.load(std::memory_order_acquire); }
+    /// Number of windows not idle. Never less than the true number, but may briefly be more while a window is changing state.
+    static int activeWindowCount() { return s_activeWindowCount.load(); }
 
 	enum RendererAPI {
 		None = 0,
@@ -55,7 +81,12 @@ public:
     virtual void serviceWindowEvents(void) = 0;
     virtual std::string windowTitle(void) = 0;
     virtual std::string windowURL(void) = 0;
+    virtual uint64_t counter(int counterID) { return 0; }
+    virtual bool latencyStats(int stage, ServoUnityLatencyStats *stats_out) { return false; }
+    virtual void resetLatencyStats(void) {}
+    virtual bool windowStats(ServoUnityWindowStats *stats_out) { return false; }
 	virtual void requestUpdate(float timeDelta) = 0;
+    virtual void forceTextureRefresh(void) {}
     virtual void cleanupRenderer() = 0;
 	
 	virtual void CloseServoWindow() = 0;
@@ -68,6 +99,31 @@ public:
     virtual void pointerScrollDiscrete(int x_scroll, int y_scroll, int x, int y) = 0; // x and y are a discrete scroll count, e.g. count of mousewheel "clicks".
 	virtual void keyEvent(int upDown, int keyCode, int character) = 0;
 
+    /// Dispatch a ServoUnityPointerEventID_* event to the matching pointer method.
+    void pointerEvent(int eventID, int eventParam0, int eventParam1, int windowX, int windowY) {
+        switch (eventID) {
+            case ServoUnityPointerEventID_Enter: pointerEnter(); break;
+            case ServoUnityPointerEventID_Exit: pointerExit(); break;
+            case ServoUnityPointerEventID_Over: pointerOver(windowX, windowY); break;
+            case ServoUnityPointerEventID_Press: pointerPress(eventParam0, windowX, windowY); break;
+            case ServoUnityPointerEventID_Release: pointerRelease(eventParam0, windowX, windowY); break;
+            case ServoUnityPointerEventID_Click: pointerClick(eventParam0, windowX, windowY); break;
+            case ServoUnityPointerEventID_ScrollDiscrete: pointerScrollDiscrete(eventParam0, eventParam1, windowX, windowY); break;
+            default: break;
+        }
+    }
+
+    /// Submit a batch of input events, in order. Windows which can queue events in bulk should override this.
+    /// @return The number of events accepted.
+    virtual int submitInputEvents(const ServoUnityInputEvent *events, int count) {
+        for (int i = 0; i < count; i++) {
+            const ServoUnityInputEvent& e = events[i];
+            if (e.type == ServoUnityInputEventType_Pointer) pointerEvent(e.eventID, e.param0, e.param1, e.windowX, e.windowY);
+            else if (e.type == ServoUnityInputEventType_Key) keyEvent(e.eventID, e.param0, e.param1);
+        }
+        return count;
+    }
+
     virtual void refresh() = 0;
     virtual void reload() = 0;
     virtual void stop() = 0;
@@ -160,7 +160,7 @@ void ServoUnityWindowDX11::pointerExit() {
 }
 
 void ServoUnityWindowDX11::pointerOver(int x, int y) {
-	SERVOUNITYLOGi("ServoUnityWindowDX11::pointerOver(%d, %d)\n", x, y);
+	SERVOUNITYLOGd("ServoUnityWindowDX11::pointerOver(%d, %d)\n", x, y);
 }
 
 void ServoUnityWindowDX11::pointerPress(int button, int x, int y) {
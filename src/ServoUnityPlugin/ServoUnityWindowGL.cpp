@@ -18,30 +18,85 @@
 #  include <OpenGL/CGLCurrent.h>
 #elif defined(_WIN32)
 #  include <gl3w/gl3w.h>
-#else 
-#  define GL_GLEXT_PROTOTYPES
+#else
 #  include <GL/glcorearb.h>
+#  include <EGL/egl.h>
+#  include <dlfcn.h>
 #endif
 #include <stdlib.h>
+#include <vector>
 #include "servo_unity_internal.h"
 #include "servo_unity_log.h"
+#include "servo_unity_trace.h"
 #include "utils.h"
 
 
+#if defined(__linux__)
+// Unity's Linux player normally uses GLX, but headless and containerised
+// setups (e.g. llvmpipe on render farms and CI) use EGL, often with a pbuffer
+// or no surface at all. Servo must be started with the matching call, so
+// we look for a current EGL context when starting it. libEGL is loaded at
+// runtime so that the plugin doesn't depend on it where it's not installed.
+static void *s_libEGL = nullptr;
+static EGLContext (*s_eglGetCurrentContext)(void) = nullptr;
+static EGLSurface (*s_eglGetCurrentSurface)(EGLint readdraw) = nullptr;
+
+static bool eglContextIsCurrent(bool *surfaceless)
+{
+    if (!s_eglGetCurrentContext || s_eglGetCurrentContext() == EGL_NO_CONTEXT) return false;
+    *surfaceless = (s_eglGetCurrentSurface(EGL_DRAW) == EGL_NO_SURFACE);
+    return true;
+}
+#endif
+
 void ServoUnityWindowGL::initDevice() {
 #ifdef _WIN32
 	gl3wInit();
+#elif defined(__linux__)
+    if (!s_libEGL) {
+        s_libEGL = dlopen("libEGL.so.1", RTLD_NOW | RTLD_LOCAL);
+        if (s_libEGL) {
+            *(void **)&s_eglGetCurrentContext = dlsym(s_libEGL, "eglGetCurrentContext");
+            *(void **)&s_eglGetCurrentSurface = dlsym(s_libEGL, "eglGetCurrentSurface");
+            if (!s_eglGetCurrentContext || !s_eglGetCurrentSurface) {
+                s_eglGetCurrentContext = nullptr;
+                s_eglGetCurrentSurface = nullptr;
+            }
+        }
+        if (!s_eglGetCurrentContext) SERVOUNITYLOGi("libEGL not available. Only GLX contexts are supported.\n");
+    }
 #endif
 }
 
 void ServoUnityWindowGL::finalizeDevice() {
+    if (s_servoPrewarmed) {
+        // Prewarmed, but never adopted by a window.
+        s_servoPrewarmed->release(true);
+        s_servoPrewarmed = nullptr;
+    }
+    // Deinit Servo in any window that was closed without its renderer being cleaned up.
+    ServoUnityEngine::finalize();
+    ServoUnityEngine::joinLoaders();
+#if defined(__linux__)
+    if (s_libEGL) {
+        s_eglGetCurrentContext = nullptr;
+        s_eglGetCurrentSurface = nullptr;
+        dlclose(s_libEGL);
+        s_libEGL = nullptr;
+    }
+#endif
+}
+
+// For maxima with a single writer.
+static void storeMax(std::atomic<uint64_t>& max, uint64_t value)
+{
+    if (value > max.load(std::memory_order_relaxed)) max.store(value, std::memory_order_relaxed);
 }
 
-// Unfortunately the simpleservo interface doesn't allow arbitrary userdata
-// to be passed along with callbacks, so we have to keep a global static
-// instance pointer so that we can correctly call back to the correct window
-// instance.
-ServoUnityWindowGL *ServoUnityWindowGL::s_servo = nullptr;
+// Servo may be started before any window exists (see prewarm()), in which
+// case the first window to update adopts its engine.
+ServoUnityEngine *ServoUnityWindowGL::s_servoPrewarmed = nullptr;
+ServoUnityWindow::Size ServoUnityWindowGL::s_servoPrewarmedSize = {0, 0};
 
 ServoUnityWindowGL::ServoUnityWindowGL(int uid, int uidExt, Size size) :
 	ServoUnityWindow(uid, uidExt),
@@ -56,16 +111,48 @@ ServoUnityWindowGL::ServoUnityWindowGL(int uid, int uidExt, Size size) :
     m_windowCreatedCallback(nullptr),
     m_windowResizedCallback(nullptr),
     m_browserEventCallback(nullptr),
+    m_engine(nullptr),
     m_servoGLInited(false),
+    m_servoTasksOverflowCountReported(0),
+    m_servoTaskBatchCount(0),
+    m_servoTasksDeferred(0),
+    m_servoTasksDeferredLastFrame(0),
+    m_pointerMovesCoalesced(0),
+    m_scrollsCoalesced(0),
+    m_inputEventsCoalescedLastFrame(0),
+    m_latencySampleCount(0),
+    m_latencySamplesDropped(0),
+    m_textureDirty(true),
+    m_textureFillsPerformed(0),
+    m_textureFillsSkipped(0),
+    m_renderEvents(0),
+    m_performUpdatesCount(0),
+    m_performUpdatesTotalUs(0),
+    m_performUpdatesMaxUs(0),
+    m_fillTotalUs(0),
+    m_fillMaxUs(0),
+    m_servoTaskQueueHighWater(0),
+    m_wakeups(0),
+    m_wakeupsPerSecond(0.0),
+    m_wakeupsRateStartNs(0),
+    m_wakeupsRateStartCount(0),
+    m_browserEventCallbackTasksDepth(0),
     m_updateContinuously(false),
     m_updateOnce(false),
     m_title(std::string()),
     m_URL(std::string()),
-    m_waitingForShutdown(false)
+    m_waitingForShutdown(false),
+    m_shutdownState(ShutdownState::None),
+    m_timeCreatedNs(getTimeNowNs()),
+    m_timeToFirstFrameUs(0)
 {
+    m_wakeupsRateStartNs = m_timeCreatedNs;
 }
 
 ServoUnityWindowGL::~ServoUnityWindowGL() {
+    // May not be on the render thread, so if Servo is still running, it is left for ServoUnityEngine::finalize() to deinit.
+    if (m_engine) m_engine->release(m_servoGLInited);
+    clearServoTasks();
 	if (m_buf) {
 		free(m_buf);
 		m_buf = NULL;
@@ -77,6 +164,12 @@ bool ServoUnityWindowGL::init(PFN_WINDOWCREATEDCALLBACK windowCreatedCallback, P
     m_windowCreatedCallback = windowCreatedCallback;
     m_windowResizedCallback = windowResizedCallback;
     m_browserEventCallback = browserEventCallback;
+    // A Servo host process passes frames through fixed-size shared buffers.
+    int remoteSizeMax = ServoUnityEngine::remoteSizeMax();
+    if (remoteSizeMax > 0 && (m_size.w > remoteSizeMax || m_size.h > remoteSizeMax) && !servoUnityCopyParamString(s_param_RemoteHost).empty()) {
+        SERVOUNITYLOGe("Window size %dx%d exceeds the Servo host's maximum of %d pixels.\n", m_size.w, m_size.h, remoteSizeMax);
+        return false;
+    }
 	switch (m_format) {
 		case ServoUnityTextureFormat_RGBA32:
 			m_pixelIntFormatGL = GL_RGBA;
@@ -152,176 +245,547 @@ void ServoUnityWindowGL::setSize(ServoUnityWindow::Size size) {
 	if (m_buf) free(m_buf);
 	m_buf = (uint8_t *)calloc(1, m_size.w * m_size.h * m_pixelSize);
 
+    forceTextureRefresh();
+
     if (m_windowResizedCallback) (*m_windowResizedCallback)(m_uidExt, m_size.w, m_size.h);
 }
 
 void ServoUnityWindowGL::setNativePtr(void* texPtr) {
 	m_texID = (uint32_t)((uintptr_t)texPtr); // Truncation to 32-bits is the desired behaviour.
+    forceTextureRefresh();
 }
 
 void* ServoUnityWindowGL::nativePtr() {
 	return (void *)((uintptr_t)m_texID); // Extension to pointer-length (usually 64 bits) is the desired behaviour.
 }
 
+// Starts Servo in engine. Must be called from render thread, with Unity's GL context active.
+void ServoUnityWindowGL::initServo(ServoUnityEngine *engine, Size size)
+{
+    SERVOUNITYLOGi("initing servo engine %d.\n", (int)engine->index());
+    // Note about logs:
+    // By default: all modules are enabled, at the level matching servoUnityLogLevel.
+    // ServoUnityParam_s_ServoLogLevel overrides the level ("--vslogger-level" in .args),
+    // and ServoUnityParam_s_ServoLogModules restricts logging to the listed modules
+    // (.vslogger_mod_list), e.g. "script::dom::bindings::error,canvas::webgl_thread".
+    // Servo filters by module before formatting, so debug logging from one module
+    // doesn't slow down the others.
+    std::vector<std::string> logModules;
+    std::vector<const char *> logModulePtrs;
+    const std::string logModulesParam = servoUnityCopyParamString(s_param_ServoLogModules);
+    size_t start = 0;
+    while (start <= logModulesParam.size()) {
+        size_t end = logModulesParam.find(',', start);
+        if (end == std::string::npos) end = logModulesParam.size();
+        size_t first = logModulesParam.find_first_not_of(" \t", start);
+        size_t last = logModulesParam.find_last_not_of(" \t", end - 1);
+        if (first < end && last != std::string::npos && last >= first) logModules.push_back(logModulesParam.substr(first, last - first + 1));
+        start = end + 1;
+    }
+    for (const std::string& m : logModules) logModulePtrs.push_back(m.c_str());
+    if (!logModules.empty()) SERVOUNITYLOGi("Servo logging restricted to %d module(s).\n", (int)logModules.size());
+
+    char *args = nullptr;
+    const char *arg_ll = nullptr;
+    const char *arg_ll_debug = "debug";
+    const char *arg_ll_info = "info";
+    const char *arg_ll_warn = "warn";
+    const char *arg_ll_error = "error";
+    switch (servoUnityLogLevel) {
+        case SERVO_UNITY_LOG_LEVEL_DEBUG: arg_ll = arg_ll_debug; break;
+        case SERVO_UNITY_LOG_LEVEL_INFO: arg_ll = arg_ll_info; break;
+        case SERVO_UNITY_LOG_LEVEL_WARN: arg_ll = arg_ll_warn; break;
+        case SERVO_UNITY_LOG_LEVEL_ERROR: arg_ll = arg_ll_error; break;
+        default: break;
+    }
+    const std::string logLevelParam = servoUnityCopyParamString(s_param_ServoLogLevel);
+    if (!logLevelParam.empty()) arg_ll = logLevelParam.c_str();
+    if (arg_ll) asprintf(&args, "--vslogger-level %s", arg_ll);
+
+    CInitOptions cio {
+        .args = args,
+        .width = size.w,
+        .height = size.h,
+        .density = 1.0f,
+        .vslogger_mod_list = (logModulePtrs.empty() ? nullptr : logModulePtrs.data()),
+        .vslogger_mod_size = (uint32_t)logModulePtrs.size(),
+        .native_widget = nullptr
+    };
+    // init_with_gl/init_with_egl will capture the active GL context for later use by fill_gl_texture.
+    // This will be the Unity GL context.
+#if defined(__linux__)
+    bool surfaceless;
+    if (eglContextIsCurrent(&surfaceless)) {
+        SERVOUNITYLOGi("Unity GL context is an EGL context%s.\n", surfaceless ? " with no surface" : "");
+        engine->api().init_with_egl(cio, engine->wakeupCallback(), engine->hostCallbacks());
+    } else
+#endif
+    engine->api().init_with_gl(cio, engine->wakeupCallback(), engine->hostCallbacks());
+    free(args);
+}
+
+void ServoUnityWindowGL::prewarm(Size size)
+{
+    if (s_servoPrewarmed) {
+        SERVOUNITYLOGw("Prewarm requested, but a prewarmed servo is already waiting for a window.\n");
+        return;
+    }
+    ServoUnityEngine *engine = ServoUnityEngine::acquire(nullptr, !servoUnityCopyParamString(s_param_RemoteHost).empty());
+    if (!engine) {
+        SERVOUNITYLOGw("Prewarm requested, but no servo engine is ready.\n");
+        return;
+    }
+    initServo(engine, size);
+    s_servoPrewarmed = engine;
+    s_servoPrewarmedSize = size;
+}
+
 void ServoUnityWindowGL::requestUpdate(float timeDelta) {
+    SERVOUNITYTRACE("requestUpdate");
     SERVOUNITYLOGd("ServoUnityWindowGL::requestUpdate(%f)\n", timeDelta);
+    m_renderEvents.fetch_add(1, std::memory_order_relaxed);
+
+    if (m_shutdownState != ShutdownState::None) {
+        if (m_shutdownState == ShutdownState::InProgress) updateShutdown();
+        if (m_shutdownState == ShutdownState::Complete) tryMarkIdle(); // Nothing more to do, ever.
+        return;
+    }
 
     if (!m_servoGLInited) {
-        if (s_servo) {
-            SERVOUNITYLOGe("servo already inited.\n");
-            return;
-        }
-        SERVOUNITYLOGi("initing servo.\n");
-        s_servo = this;
-        // Note about logs:
-        // By default: all modules are enabled. Only warn level-logs are displayed.
-        // To change the log level, add e.g. "--vslogger-level debug" to .args.
-        // To only print logs from specific modules, add their names to pfilters.
-        // For example:
-        // static char *pfilters[] = {
-        //   "servo",
-        //   "simpleservo",
-        //   "script::dom::bindings::error", // Show JS errors by default.
-        //   "canvas::webgl_thread", // Show GL errors by default.
-        //   "compositing",
-        //   "constellation",
-        // };
-        // .vslogger_mod_list = pfilters;
-        // .vslogger_mod_size = sizeof(pfilters) / sizeof(pfilters[0]);
-        char *args = nullptr;
-        const char *arg_ll = nullptr;
-        const char *arg_ll_debug = "debug";
-        const char *arg_ll_info = "info";
-        const char *arg_ll_warn = "warn";
-        const char *arg_ll_error = "error";
-        switch (servoUnityLogLevel) {
-            case SERVO_UNITY_LOG_LEVEL_DEBUG: arg_ll = arg_ll_debug; break;
-            case SERVO_UNITY_LOG_LEVEL_INFO: arg_ll = arg_ll_info; break;
-            case SERVO_UNITY_LOG_LEVEL_WARN: arg_ll = arg_ll_warn; break;
-            case SERVO_UNITY_LOG_LEVEL_ERROR: arg_ll = arg_ll_error; break;
-            default: break;
+        if (s_servoPrewarmed) {
+            SERVOUNITYLOGi("adopting prewarmed servo.\n");
+            m_engine = s_servoPrewarmed;
+            s_servoPrewarmed = nullptr;
+            m_engine->setClient(this);
+            if (s_servoPrewarmedSize.w != m_size.w || s_servoPrewarmedSize.h != m_size.h) m_engine->api().resize(m_size.w, m_size.h);
+            m_updateOnce = true; // Catch up on any wakeup that arrived before we were adopted.
+        } else {
+            m_engine = ServoUnityEngine::acquire(this, !servoUnityCopyParamString(s_param_RemoteHost).empty());
+            if (!m_engine) {
+                // Try again next update, in case another window releases its engine, or the engine's library copy has loaded.
+                return;
+            }
+            initServo(m_engine, m_size);
         }
-        if (arg_ll) asprintf(&args, "--vslogger-level %s", arg_ll);
-
-        CInitOptions cio {
-            .args = args,
-            .width = m_size.w,
-            .height = m_size.h,
-            .density = 1.0f,
-            .vslogger_mod_list = nullptr,
-            .vslogger_mod_size = 0,
-            .native_widget = nullptr
-        };
-        CHostCallbacks chc {
-            .on_load_started = on_load_started,
-            .on_load_ended = on_load_ended,
-            .on_title_changed = on_title_changed,
-            .on_allow_navigation = on_allow_navigation,
-            .on_url_changed = on_url_changed,
-            .on_history_changed = on_history_changed,
-            .on_animating_changed = on_animating_changed,
-            .on_shutdown_complete = on_shutdown_complete,
-            .on_ime_show = on_ime_show,
-            .on_ime_hide = on_ime_hide,
-            .get_clipboard_contents = get_clipboard_contents,
-            .set_clipboard_contents = set_clipboard_contents,
-            .on_media_session_metadata = on_media_session_metadata,
-            .on_media_session_playback_state_change = on_media_session_playback_state_change,
-            .on_media_session_set_position_state = on_media_session_set_position_state,
-            .prompt_alert = prompt_alert,
-            .prompt_ok_cancel = prompt_ok_cancel,
-            .prompt_yes_no = prompt_yes_no,
-            .prompt_input = prompt_input,
-            .on_devtools_started = on_devtools_started,
-            .show_context_menu = show_context_menu,
-            .on_log_output = on_log_output
-        };
-
-        // init_with_gl will capture the active GL context for later use by fill_gl_texture.
-        // This will be the Unity GL context.
-        init_with_gl(cio, wakeup, chc);
-        free(args);
-
         m_servoGLInited = true;
     }
 
+    uint64_t nowNs = getTimeNowNs();
+    updateWakeupsRate(nowNs);
+
     // Updates first.
-    bool update;
-    {
-        std::lock_guard<std::mutex> lock(m_updateLock);
-        if (m_updateOnce || m_updateContinuously) {
-            update = true;
-            m_updateOnce = false;
-        } else {
-            update = false;
+    bool update = m_updateOnce.exchange(false) || m_updateContinuously;
+    if (update) {
+        {
+            SERVOUNITYTRACE("perform_updates");
+            m_engine->api().perform_updates();
         }
+        uint64_t us = (getTimeNowNs() - nowNs) / 1000;
+        m_performUpdatesCount.fetch_add(1, std::memory_order_relaxed);
+        m_performUpdatesTotalUs.fetch_add(us, std::memory_order_relaxed);
+        storeMax(m_performUpdatesMaxUs, us);
+        latencyUpdated();
     }
-    if (update) perform_updates();
 
     // Service task queue.
-    while (true) {
-        std::function<void()> task;
+    size_t tasksRun = runServoTasks();
+
+    // Only copy Servo's frame into the texture if something might have changed it.
+    bool fill = m_textureDirty.exchange(false) || update || tasksRun > 0;
+    if (fill) {
+        // fill_gl_texture sets the GL context to the same Unity GL context.
+        uint64_t fillStartNs = getTimeNowNs();
         {
-            std::lock_guard<std::mutex> lock(m_servoTasksLock);
-            if (m_servoTasks.empty()) {
-                break;
-            } else {
-                task = m_servoTasks.front();
-                m_servoTasks.pop_front();
-            }
+            SERVOUNITYTRACE("fill_gl_texture");
+            m_engine->api().fill_gl_texture(m_texID, m_size.w, m_size.h);
+        }
+        uint64_t us = (getTimeNowNs() - fillStartNs) / 1000;
+        m_fillTotalUs.fetch_add(us, std::memory_order_relaxed);
+        storeMax(m_fillMaxUs, us);
+        m_textureFillsPerformed.fetch_add(1, std::memory_order_relaxed);
+        latencyFilled();
+        if (update && !m_timeToFirstFrameUs) {
+            uint64_t us = (getTimeNowNs() - m_timeCreatedNs) / 1000;
+            m_timeToFirstFrameUs = (us ? us : 1);
         }
-        task();
+    } else {
+        m_textureFillsSkipped.fetch_add(1, std::memory_order_relaxed);
     }
 
-    // fill_gl_texture sets the GL context to the same Unity GL context.
-    fill_gl_texture(m_texID, m_size.w, m_size.h);
+    // Go idle if there's nothing left to do, then check again in case work arrived while we were doing so.
+    if (!hasPendingWork() && tryMarkIdle() && hasPendingWork()) markActive();
+}
+
+// Must be called from render thread.
+bool ServoUnityWindowGL::hasPendingWork(void) {
+    return m_updateOnce || m_updateContinuously || m_textureDirty || m_servoTaskBatchCount > 0 || m_servoTasks.sizeApprox() > 0;
+}
 
+void ServoUnityWindowGL::forceTextureRefresh(void) {
+    m_textureDirty = true;
+    markActive();
 }
 
 void ServoUnityWindowGL::cleanupRenderer(void) {
+    SERVOUNITYTRACE("cleanupRenderer");
     if (!m_servoGLInited) {
         SERVOUNITYLOGw("Cleanup renderer called with no renderer active.\n");
         return;
     }
+    if (m_shutdownState != ShutdownState::None) {
+        SERVOUNITYLOGw("Cleanup renderer called with renderer cleanup already underway.\n");
+        return;
+    }
     SERVOUNITYLOGd("Cleaning up renderer...\n");
 
-    // First, clear waiting tasks and ensure no new tasks are queued while shutting down.
-    std::lock_guard<std::mutex> tasksLock(m_servoTasksLock);
-    m_servoTasks.clear();
+    // First, clear waiting tasks. Any tasks queued while shutting down are discarded when shutdown completes.
+    clearServoTasks();
 
-    // Next, we'll request shutdown and wait on callback on_shutdown_complete before
-    // finishing with deinit().
+    // Next, we'll request shutdown. Rather than blocking the render thread until Servo
+    // calls back on_shutdown_complete, subsequent window updates each call perform_updates()
+    // once until it does (or until we time out), and then finish with deinit().
     m_waitingForShutdown = true;
-    utilTime timeStart = getTimeNow();
-    request_shutdown();
-    while (m_waitingForShutdown == true) {
-        if (millisecondsElapsedSince(timeStart) > 2000L) {
+    m_shutdownTimeStartNs = getTimeNowNs();
+    m_shutdownState = ShutdownState::InProgress;
+    m_engine->api().request_shutdown();
+    markActive();
+}
+
+// Advances an in-progress shutdown by at most one perform_updates(). Must be called from render thread.
+void ServoUnityWindowGL::updateShutdown(void) {
+    if (m_waitingForShutdown) {
+        if (getTimeNowNs() - m_shutdownTimeStartNs <= SERVO_SHUTDOWN_TIMEOUT_MS * 1000000ull) {
+            SERVOUNITYTRACE("perform_updates");
+            m_engine->api().perform_updates();
+            if (m_waitingForShutdown) return;
+        } else {
             SERVOUNITYLOGw("Timed out waiting for Servo shutdown.\n");
-            break;
         }
-        perform_updates();
     }
 
-    deinit();
+    {
+        SERVOUNITYTRACE("deinit");
+        m_engine->api().deinit();
+    }
+    m_shutdownState = ShutdownState::Complete;
     m_servoGLInited = false;
-    s_servo = nullptr;
+    m_engine->release(false);
+    m_engine = nullptr;
+    clearServoTasks();
+    m_latencySampleCount = 0;
 
     queueBrowserEventCallbackTask(uidExt(), ServoUnityBrowserEvent_Shutdown, 0, 0);
     SERVOUNITYLOGd("Cleaning up renderer... DONE.\n");
 }
 
-void ServoUnityWindowGL::runOnServoThread(std::function<void()> task) {
-    std::lock_guard<std::mutex> lock(m_servoTasksLock);
-    m_servoTasks.push_back(task);
+void ServoUnityWindowGL::runOnServoThread(const SERVOTASK& task) {
+    SERVOTASK t = task;
+    t.timeQueuedNs = getTimeNowNs();
+    if (!m_servoTasks.push(t)) {
+        releaseServoTask(t);
+        return;
+    }
+    markActive();
+}
+
+// Must be called from render thread.
+size_t ServoUnityWindowGL::runServoTasks(void) {
+    SERVOUNITYTRACE("runServoTasks");
+    uint64_t overflowCount = m_servoTasks.overflowCount();
+    if (overflowCount != m_servoTasksOverflowCountReported) {
+        SERVOUNITYLOGw("Servo task queue full. %" PRIu64 " task(s) dropped.\n", overflowCount - m_servoTasksOverflowCountReported);
+        m_servoTasksOverflowCountReported = overflowCount;
+    }
+
+    // Append newly-queued tasks to any carried over from the previous frame.
+    size_t count = m_servoTaskBatchCount;
+    while (count < SERVO_TASK_QUEUE_SIZE && m_servoTasks.pop(m_servoTaskBatch[count])) count++;
+    storeMax(m_servoTaskQueueHighWater, count + m_servoTasks.sizeApprox());
+
+    uint64_t pointerMovesCoalesced = 0, scrollsCoalesced = 0;
+    count = coalesceServoTasks(m_servoTaskBatch, count, &pointerMovesCoalesced, &scrollsCoalesced);
+    if (pointerMovesCoalesced) m_pointerMovesCoalesced.fetch_add(pointerMovesCoalesced, std::memory_order_relaxed);
+    if (scrollsCoalesced) m_scrollsCoalesced.fetch_add(scrollsCoalesced, std::memory_order_relaxed);
+    m_inputEventsCoalescedLastFrame.store(pointerMovesCoalesced + scrollsCoalesced, std::memory_order_relaxed);
+
+    // Run tasks in priority order until the budget is exhausted. At least one task is always run, so the queue makes progress under any budget.
+    int maxTasks = s_param_MaxServoTasksPerFrame.load(std::memory_order_relaxed);
+    float budgetMs = s_param_ServoTaskTimeBudgetMs.load(std::memory_order_relaxed);
+    uint64_t deadlineNs = (budgetMs > 0.0f ? getTimeNowNs() + (uint64_t)(budgetMs * 1000000.0f) : 0);
+    size_t run = 0;
+    bool budgetExhausted = false;
+    for (int priority = ServoTaskPriority_Control; priority <= ServoTaskPriority_Low && !budgetExhausted; priority++) {
+        for (size_t i = 0; i < count; i++) {
+            SERVOTASK& task = m_servoTaskBatch[i];
+            if (task.type == ServoTaskType::None || servoTaskPriority(task.type) != priority) continue;
+            if (run > 0 && ((maxTasks > 0 && run >= (size_t)maxTasks) || (deadlineNs && getTimeNowNs() >= deadlineNs))) {
+                budgetExhausted = true;
+                break;
+            }
+            runServoTask(task);
+            latencyDispatched(task);
+            releaseServoTask(task);
+            task.type = ServoTaskType::None;
+            run++;
+        }
+    }
+
+    // Carry over whatever is left, preserving its order.
+    size_t deferred = 0;
+    if (run < count) {
+        for (size_t i = 0; i < count; i++) {
+            if (m_servoTaskBatch[i].type == ServoTaskType::None) continue;
+            if (deferred != i) m_servoTaskBatch[deferred] = m_servoTaskBatch[i];
+            deferred++;
+        }
+        m_servoTasksDeferred.fetch_add(deferred, std::memory_order_relaxed);
+    }
+    m_servoTaskBatchCount = deferred;
+    m_servoTasksDeferredLastFrame.store(deferred, std::memory_order_relaxed);
+    return run;
+}
+
+ServoUnityWindowGL::ServoTaskPriority ServoUnityWindowGL::servoTaskPriority(ServoTaskType type)
+{
+    switch (type) {
+        case ServoTaskType::Navigate:
+        case ServoTaskType::Reload:
+        case ServoTaskType::Stop:
+        case ServoTaskType::GoBack:
+        case ServoTaskType::GoForward:
+        case ServoTaskType::GoHome:
+            return ServoTaskPriority_Control;
+        case ServoTaskType::Refresh:
+            return ServoTaskPriority_Low;
+        default:
+            return ServoTaskPriority_Input;
+    }
+}
+
+// Merges redundant input in place, preserving the relative order of everything that remains.
+// Input tasks always run in order relative to each other (see runServoTasks), so only the
+// input tasks are considered when looking for a predecessor to merge with:
+// - A run of pointer moves collapses to the last (latest) position.
+// - A run of scrolls anchored at the same position collapses to one scroll with the deltas summed.
+// Presses, releases, clicks, keys and browser controls are never merged.
+// Returns the new task count.
+size_t ServoUnityWindowGL::coalesceServoTasks(SERVOTASK *tasks, size_t count, uint64_t *pointerMovesCoalesced_p, uint64_t *scrollsCoalesced_p)
+{
+    size_t out = 0;
+    size_t prevInput = SIZE_MAX; // Index (in output) of the last input task kept.
+    for (size_t in = 0; in < count; in++) {
+        const SERVOTASK& task = tasks[in];
+        if (prevInput != SIZE_MAX) {
+            SERVOTASK& prev = tasks[prevInput];
+            if (task.type == ServoTaskType::MouseMove && prev.type == ServoTaskType::MouseMove) {
+                uint64_t timeQueuedNs = prev.timeQueuedNs;
+                prev = task;
+                prev.timeQueuedNs = timeQueuedNs;
+                (*pointerMovesCoalesced_p)++;
+                continue;
+            }
+            if (task.type == ServoTaskType::Scroll && prev.type == ServoTaskType::Scroll && task.scroll.x == prev.scroll.x && task.scroll.y == prev.scroll.y) {
+                prev.scroll.dx += task.scroll.dx;
+                prev.scroll.dy += task.scroll.dy;
+                (*scrollsCoalesced_p)++;
+                continue;
+            }
+        }
+        if (servoTaskPriority(task.type) == ServoTaskPriority_Input) prevInput = out;
+        if (out != in) tasks[out] = task;
+        out++;
+    }
+    return out;
+}
+
+// Must be called from render thread, or when no other thread can be running tasks.
+void ServoUnityWindowGL::clearServoTasks(void) {
+    for (size_t i = 0; i < m_servoTaskBatchCount; i++) releaseServoTask(m_servoTaskBatch[i]);
+    m_servoTaskBatchCount = 0;
+    m_servoTasksDeferredLastFrame.store(0, std::memory_order_relaxed);
+    m_servoTasks.drain([this](const SERVOTASK& task) {
+        releaseServoTask(task);
+    });
+}
+
+void ServoUnityWindowGL::releaseServoTask(const SERVOTASK& task) {
+    if (task.type == ServoTaskType::Navigate) m_servoTaskStrings.release(task.navigate.urlOrSearchString);
+}
+
+// Latency tracking. Input tasks are tracked from dispatch until the first texture fill which follows
+// a perform_updates, at which point their latencies are recorded. All must be called from render thread.
+void ServoUnityWindowGL::latencyDispatched(const SERVOTASK& task) {
+    if (task.type < ServoTaskType::MouseMove || task.type > ServoTaskType::KeyUp) return; // Input tasks only.
+    if (m_latencySampleCount == SERVO_LATENCY_SAMPLES_MAX) {
+        m_latencySamplesDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    m_latencySamples[m_latencySampleCount++] = {task.timeQueuedNs, getTimeNowNs(), 0};
+}
+
+void ServoUnityWindowGL::latencyUpdated(void) {
+    if (!m_latencySampleCount) return;
+    uint64_t now = getTimeNowNs();
+    for (size_t i = 0; i < m_latencySampleCount; i++) {
+        if (!m_latencySamples[i].updatedNs) m_latencySamples[i].updatedNs = now;
+    }
+}
+
+void ServoUnityWindowGL::latencyFilled(void) {
+    if (!m_latencySampleCount) return;
+    uint64_t now = getTimeNowNs();
+    size_t out = 0;
+    for (size_t i = 0; i < m_latencySampleCount; i++) {
+        const LATENCYSAMPLE& s = m_latencySamples[i];
+        if (!s.updatedNs) {
+            m_latencySamples[out++] = s; // Still waiting on perform_updates.
+            continue;
+        }
+        m_latency[ServoUnityLatencyStage_Queue].record((s.dispatchedNs - s.queuedNs) / 1000);
+        m_latency[ServoUnityLatencyStage_Update].record((s.updatedNs - s.dispatchedNs) / 1000);
+        m_latency[ServoUnityLatencyStage_Fill].record((now - s.updatedNs) / 1000);
+        m_latency[ServoUnityLatencyStage_Total].record((now - s.queuedNs) / 1000);
+    }
+    m_latencySampleCount = out;
+}
+
+bool ServoUnityWindowGL::latencyStats(int stage, ServoUnityLatencyStats *stats_out) {
+    if (stage < 0 || stage >= ServoUnityLatencyStage_Max) return false;
+    const utilHistogram& h = m_latency[stage];
+    stats_out->count = h.count();
+    stats_out->p50Ms = h.percentile(0.50) / 1000.0f;
+    stats_out->p95Ms = h.percentile(0.95) / 1000.0f;
+    stats_out->p99Ms = h.percentile(0.99) / 1000.0f;
+    stats_out->maxMs = h.max() / 1000.0f;
+    return true;
+}
+
+void ServoUnityWindowGL::resetLatencyStats(void) {
+    for (int i = 0; i < ServoUnityLatencyStage_Max; i++) m_latency[i].reset();
+    m_latencySamplesDropped.store(0, std::memory_order_relaxed);
+}
+
+void ServoUnityWindowGL::updateWakeupsRate(uint64_t nowNs) {
+    uint64_t elapsedNs = nowNs - m_wakeupsRateStartNs;
+    if (elapsedNs < 1000000000ull) return;
+    uint64_t wakeups = m_wakeups.load(std::memory_order_relaxed);
+    m_wakeupsPerSecond.store((double)(wakeups - m_wakeupsRateStartCount) * 1e9 / (double)elapsedNs, std::memory_order_relaxed);
+    m_wakeupsRateStartNs = nowNs;
+    m_wakeupsRateStartCount = wakeups;
+}
+
+bool ServoUnityWindowGL::windowStats(ServoUnityWindowStats *stats_out) {
+    stats_out->renderEvents = m_renderEvents.load(std::memory_order_relaxed);
+    stats_out->framesSkipped = m_textureFillsSkipped.load(std::memory_order_relaxed);
+    stats_out->performUpdatesCount = m_performUpdatesCount.load(std::memory_order_relaxed);
+    stats_out->performUpdatesTotalUs = m_performUpdatesTotalUs.load(std::memory_order_relaxed);
+    stats_out->performUpdatesMaxUs = m_performUpdatesMaxUs.load(std::memory_order_relaxed);
+    stats_out->fillCount = m_textureFillsPerformed.load(std::memory_order_relaxed);
+    stats_out->fillTotalUs = m_fillTotalUs.load(std::memory_order_relaxed);
+    stats_out->fillMaxUs = m_fillMaxUs.load(std::memory_order_relaxed);
+    // Tasks carried over by the last update are out of the queue, but still waiting.
+    stats_out->taskQueueDepth = m_servoTasks.sizeApprox() + m_servoTasksDeferredLastFrame.load(std::memory_order_relaxed);
+    stats_out->taskQueueHighWater = m_servoTaskQueueHighWater.load(std::memory_order_relaxed);
+    stats_out->browserEventQueueDepth = m_browserEventCallbackTasksDepth.load(std::memory_order_relaxed);
+    stats_out->wakeups = m_wakeups.load(std::memory_order_relaxed);
+    stats_out->wakeupsPerSecond = m_wakeupsPerSecond.load(std::memory_order_relaxed);
+    return true;
+}
+
+static void navigateToURLOrSearchString(const ServoUnityEngine::API& api, const std::string& urlOrSearchString)
+{
+    if (api.is_uri_valid(urlOrSearchString.c_str())) {
+        api.load_uri(urlOrSearchString.c_str());
+    } else {
+        std::string uri;
+        // It's not a valid URI, but might be a domain name without method.
+        // Look for bare minimum of a '.'' before any '/'.
+        size_t dotPos = urlOrSearchString.find('.');
+        size_t slashPos = urlOrSearchString.find('/');
+        if (dotPos != std::string::npos && (slashPos == std::string::npos || slashPos > dotPos)) {
+            std::string withMethod = std::string("https://" + urlOrSearchString);
+            if (api.is_uri_valid(withMethod.c_str())) {
+                uri = withMethod;
+            } else {
+                uri = servoUnityCopyParamString(s_param_SearchURI) + urlOrSearchString;
+            }
+        } else {
+            uri = servoUnityCopyParamString(s_param_SearchURI) + urlOrSearchString;
+        }
+        if (api.is_uri_valid(uri.c_str())) {
+            api.load_uri(uri.c_str());
+        } else {
+            SERVOUNITYLOGe("Malformed search string.\n");
+        }
+    }
+}
+
+// Must be called from render thread.
+void ServoUnityWindowGL::runServoTask(const SERVOTASK& task) {
+    const ServoUnityEngine::API& api = m_engine->api();
+    switch (task.type) {
+        case ServoTaskType::MouseMove:
+            api.mouse_move(task.pointer.x, task.pointer.y);
+            break;
+        case ServoTaskType::MouseDown:
+            api.mouse_down(task.button.x, task.button.y, task.button.button);
+            break;
+        case ServoTaskType::MouseUp:
+            api.mouse_up(task.button.x, task.button.y, task.button.button);
+            break;
+        case ServoTaskType::Click:
+            api.click((float)task.pointer.x, (float)task.pointer.y);
+            break;
+        case ServoTaskType::Scroll:
+            api.scroll(task.scroll.dx, task.scroll.dy, task.scroll.x, task.scroll.y);
+            break;
+        case ServoTaskType::KeyDown:
+            api.key_down(task.key.keyCode, task.key.keyType);
+            break;
+        case ServoTaskType::KeyUp:
+            api.key_up(task.key.keyCode, task.key.keyType);
+            break;
+        case ServoTaskType::Refresh:
+            api.refresh();
+            break;
+        case ServoTaskType::Reload:
+            api.reload();
+            break;
+        case ServoTaskType::Stop:
+            api.stop();
+            break;
+        case ServoTaskType::GoBack:
+            api.go_back();
+            break;
+        case ServoTaskType::GoForward:
+            api.go_forward();
+            break;
+        case ServoTaskType::GoHome:
+            // TODO: fetch the homepage from prefs.
+            {
+                const std::string homepage = servoUnityCopyParamString(s_param_Homepage);
+                if (api.is_uri_valid(homepage.c_str())) {
+                    api.load_uri(homepage.c_str());
+                }
+            }
+            break;
+        case ServoTaskType::Navigate:
+            navigateToURLOrSearchString(api, std::string(m_servoTaskStrings.get(task.navigate.urlOrSearchString)));
+            break;
+        default:
+            break;
+    }
 }
 
 void ServoUnityWindowGL::queueBrowserEventCallbackTask(int uidExt, int eventType, int eventData1, int eventData2) {
     std::lock_guard<std::mutex> lock(m_browserEventCallbackTasksLock);
     BROWSEREVENTCALLBACKTASK task = {uidExt, eventType, eventData1, eventData2};
     m_browserEventCallbackTasks.push_back(task);
+    m_browserEventCallbackTasksDepth.store(m_browserEventCallbackTasks.size(), std::memory_order_relaxed);
 }
 
 void ServoUnityWindowGL::serviceWindowEvents() {
+    SERVOUNITYTRACE("serviceWindowEvents");
     // Service task queue.
     while (true) {
         BROWSEREVENTCALLBACKTASK task;
@@ -332,6 +796,7 @@ void ServoUnityWindowGL::serviceWindowEvents() {
             } else {
                 task = m_browserEventCallbackTasks.front();
                 m_browserEventCallbackTasks.pop_front();
+                m_browserEventCallbackTasksDepth.store(m_browserEventCallbackTasks.size(), std::memory_order_relaxed);
             }
         }
         if (m_browserEventCallback) (*m_browserEventCallback)(task.uidExt, task.eventType, task.eventData1, task.eventData2);
@@ -348,6 +813,32 @@ std::string ServoUnityWindowGL::windowURL(void)
     return m_URL;
 }
 
+uint64_t ServoUnityWindowGL::counter(int counterID)
+{
+    switch (counterID) {
+        case ServoUnityWindowCounter_PointerMovesCoalesced:
+            return m_pointerMovesCoalesced.load(std::memory_order_relaxed);
+        case ServoUnityWindowCounter_ScrollsCoalesced:
+            return m_scrollsCoalesced.load(std::memory_order_relaxed);
+        case ServoUnityWindowCounter_InputEventsCoalescedLastFrame:
+            return m_inputEventsCoalescedLastFrame.load(std::memory_order_relaxed);
+        case ServoUnityWindowCounter_LatencySamplesDropped:
+            return m_latencySamplesDropped.load(std::memory_order_relaxed);
+        case ServoUnityWindowCounter_TasksDeferred:
+            return m_servoTasksDeferred.load(std::memory_order_relaxed);
+        case ServoUnityWindowCounter_TasksDeferredLastFrame:
+            return m_servoTasksDeferredLastFrame.load(std::memory_order_relaxed);
+        case ServoUnityWindowCounter_TextureFillsPerformed:
+            return m_textureFillsPerformed.load(std::memory_order_relaxed);
+        case ServoUnityWindowCounter_TextureFillsSkipped:
+            return m_textureFillsSkipped.load(std::memory_order_relaxed);
+        case ServoUnityWindowCounter_TimeToFirstFrameUs:
+            return m_timeToFirstFrameUs.load(std::memory_order_relaxed);
+        default:
+            return 0;
+    }
+}
+
 void ServoUnityWindowGL::pointerEnter() {
 	SERVOUNITYLOGd("ServoUnityWindowGL::pointerEnter()\n");
 }
@@ -356,13 +847,6 @@ void ServoUnityWindowGL::pointerExit() {
 	SERVOUNITYLOGd("ServoUnityWindowGL::pointerExit()\n");
 }
 
-void ServoUnityWindowGL::pointerOver(int x, int y) {
-	SERVOUNITYLOGd("ServoUnityWindowGL::pointerOver(%d, %d)\n", x, y);
-    if (!m_servoGLInited) return;
-
-    runOnServoThread([=] {mouse_move(x, y);});
-}
-
 static CMouseButton getServoButton(int button) {
     switch (button) {
         case ServoUnityPointerEventMouseButtonID_Left:
@@ -381,34 +865,41 @@ static CMouseButton getServoButton(int button) {
     };
 }
 
-void ServoUnityWindowGL::pointerPress(int button, int x, int y) {
-	SERVOUNITYLOGd("ServoUnityWindowGL::pointerPress(%d, %d, %d)\n", button, x, y);
-    if (!m_servoGLInited) return;
-    runOnServoThread([=] {mouse_down(x, y, getServoButton(button));});
-}
-
-void ServoUnityWindowGL::pointerRelease(int button, int x, int y) {
-	SERVOUNITYLOGd("ServoUnityWindowGL::pointerRelease(%d, %d, %d)\n", button, x, y);
-    if (!m_servoGLInited) return;
-    runOnServoThread([=] {mouse_up(x, y, getServoButton(button));});
-}
-
-void ServoUnityWindowGL::pointerClick(int button, int x, int y) {
-    SERVOUNITYLOGd("ServoUnityWindowGL::pointerClick(%d, %d, %d)\n", button, x, y);
-    if (!m_servoGLInited) return;
-    if (button != 0) return; // Servo assumes that "clicks" arise only from the primary button.
-    runOnServoThread([=] {click((float)x, (float)y);});
-}
-
-void ServoUnityWindowGL::pointerScrollDiscrete(int x_scroll, int y_scroll, int x, int y) {
-	SERVOUNITYLOGd("ServoUnityWindowGL::pointerScrollDiscrete(%d, %d, %d, %d)\n", x_scroll, y_scroll, x, y);
-    if (!m_servoGLInited) return;
-    runOnServoThread([=] {scroll(x_scroll, y_scroll, x, y);});
+// Translate a ServoUnityPointerEventID_* event into a task for the Servo thread.
+// Returns false if the event has no Servo equivalent.
+bool ServoUnityWindowGL::makePointerTask(int eventID, int eventParam0, int eventParam1, int x, int y, SERVOTASK *task_p)
+{
+    switch (eventID) {
+        case ServoUnityPointerEventID_Over:
+            *task_p = {ServoTaskType::MouseMove};
+            task_p->pointer = {x, y};
+            return true;
+        case ServoUnityPointerEventID_Press:
+            *task_p = {ServoTaskType::MouseDown};
+            task_p->button = {x, y, getServoButton(eventParam0)};
+            return true;
+        case ServoUnityPointerEventID_Release:
+            *task_p = {ServoTaskType::MouseUp};
+            task_p->button = {x, y, getServoButton(eventParam0)};
+            return true;
+        case ServoUnityPointerEventID_Click:
+            if (eventParam0 != 0) return false; // Servo assumes that "clicks" arise only from the primary button.
+            *task_p = {ServoTaskType::Click};
+            task_p->pointer = {x, y};
+            return true;
+        case ServoUnityPointerEventID_ScrollDiscrete:
+            *task_p = {ServoTaskType::Scroll};
+            task_p->scroll = {eventParam0, eventParam1, x, y};
+            return true;
+        default:
+            return false;
+    }
 }
 
-void ServoUnityWindowGL::keyEvent(int upDown, int keyCode, int character) {
-	SERVOUNITYLOGd("ServoUnityWindowGL::keyEvent(%d, %d, %d)\n", upDown, keyCode, character);
-    if (!m_servoGLInited) return;
+// Translate a key event into a task for the Servo thread.
+// Returns false if the key has no Servo equivalent.
+bool ServoUnityWindowGL::makeKeyTask(int upDown, int keyCode, int character, SERVOTASK *task_p)
+{
     int kc = character;
     CKeyType kt;
     switch (keyCode) {
@@ -486,88 +977,141 @@ void ServoUnityWindowGL::keyEvent(int upDown, int keyCode, int character) {
         case ServoUnityKeyCode_KeypadPlus: kt = CKeyType::kCharacter; kc = '+'; break;
         case ServoUnityKeyCode_KeypadEnter: kt = CKeyType::kEnter; break;
         case ServoUnityKeyCode_KeypadEquals: kt = CKeyType::kCharacter; kc = '='; break;
-        default: return;
+        default: return false;
     }
 
-    if (upDown == 1) runOnServoThread([=] {key_down(kc, kt);});
-    else runOnServoThread([=] {key_up(kc, kt);});
+
+    *task_p = {upDown == 1 ? ServoTaskType::KeyDown : ServoTaskType::KeyUp};
+    task_p->key = {(uint32_t)kc, kt};
+    return true;
+}
+
+void ServoUnityWindowGL::pointerOver(int x, int y) {
+	SERVOUNITYLOGd("ServoUnityWindowGL::pointerOver(%d, %d)\n", x, y);
+    if (!m_servoGLInited) return;
+    SERVOTASK task;
+    if (makePointerTask(ServoUnityPointerEventID_Over, 0, 0, x, y, &task)) runOnServoThread(task);
+}
+
+void ServoUnityWindowGL::pointerPress(int button, int x, int y) {
+	SERVOUNITYLOGd("ServoUnityWindowGL::pointerPress(%d, %d, %d)\n", button, x, y);
+    if (!m_servoGLInited) return;
+    SERVOTASK task;
+    if (makePointerTask(ServoUnityPointerEventID_Press, button, 0, x, y, &task)) runOnServoThread(task);
+}
+
+void ServoUnityWindowGL::pointerRelease(int button, int x, int y) {
+	SERVOUNITYLOGd("ServoUnityWindowGL::pointerRelease(%d, %d, %d)\n", button, x, y);
+    if (!m_servoGLInited) return;
+    SERVOTASK task;
+    if (makePointerTask(ServoUnityPointerEventID_Release, button, 0, x, y, &task)) runOnServoThread(task);
+}
+
+void ServoUnityWindowGL::pointerClick(int button, int x, int y) {
+    SERVOUNITYLOGd("ServoUnityWindowGL::pointerClick(%d, %d, %d)\n", button, x, y);
+    if (!m_servoGLInited) return;
+    SERVOTASK task;
+    if (makePointerTask(ServoUnityPointerEventID_Click, button, 0, x, y, &task)) runOnServoThread(task);
+}
+
+void ServoUnityWindowGL::pointerScrollDiscrete(int x_scroll, int y_scroll, int x, int y) {
+	SERVOUNITYLOGd("ServoUnityWindowGL::pointerScrollDiscrete(%d, %d, %d, %d)\n", x_scroll, y_scroll, x, y);
+    if (!m_servoGLInited) return;
+    SERVOTASK task;
+    if (makePointerTask(ServoUnityPointerEventID_ScrollDiscrete, x_scroll, y_scroll, x, y, &task)) runOnServoThread(task);
+}
+
+void ServoUnityWindowGL::keyEvent(int upDown, int keyCode, int character) {
+	SERVOUNITYLOGd("ServoUnityWindowGL::keyEvent(%d, %d, %d)\n", upDown, keyCode, character);
+    if (!m_servoGLInited) return;
+    SERVOTASK task;
+    if (makeKeyTask(upDown, keyCode, character, &task)) runOnServoThread(task);
+}
+
+int ServoUnityWindowGL::submitInputEvents(const ServoUnityInputEvent *events, int count) {
+    if (!m_servoGLInited) return count; // Dropped, as for the single-event calls.
+
+    // Translate into tasks in stack-sized chunks, and queue each chunk with a single reservation.
+    SERVOTASK tasks[SERVO_INPUT_EVENT_BATCH_SIZE];
+    int taskEventIndex[SERVO_INPUT_EVENT_BATCH_SIZE];
+    uint64_t timeQueuedNs = getTimeNowNs();
+    int i = 0;
+    while (i < count) {
+        size_t n = 0;
+        while (i < count && n < SERVO_INPUT_EVENT_BATCH_SIZE) {
+            const ServoUnityInputEvent& e = events[i];
+            bool ok;
+            if (e.type == ServoUnityInputEventType_Pointer) ok = makePointerTask(e.eventID, e.param0, e.param1, e.windowX, e.windowY, &tasks[n]);
+            else if (e.type == ServoUnityInputEventType_Key) ok = makeKeyTask(e.eventID, e.param0, e.param1, &tasks[n]);
+            else ok = false;
+            if (ok) {
+                tasks[n].timeQueuedNs = timeQueuedNs;
+                taskEventIndex[n++] = i;
+            }
+            i++;
+        }
+        size_t queued = m_servoTasks.push(tasks, n);
+        if (queued) markActive();
+        if (queued < n) {
+            // Queue full. Events before the first task that didn't fit were accepted.
+            int accepted = taskEventIndex[queued];
+            SERVOUNITYLOGw("Input event queue full; dropped %d of %d events.\n", count - accepted, count);
+            return accepted;
+        }
+    }
+    return count;
 }
 
 void ServoUnityWindowGL::refresh()
 {
     if (!m_servoGLInited) return;
-    runOnServoThread([=] {::refresh();});
+    runOnServoThread({ServoTaskType::Refresh});
 }
 
 void ServoUnityWindowGL::reload()
 {
     if (!m_servoGLInited) return;
-    runOnServoThread([=] {::reload();});
+    runOnServoThread({ServoTaskType::Reload});
 }
 
 void ServoUnityWindowGL::stop()
 {
     if (!m_servoGLInited) return;
-    runOnServoThread([=] {::stop();});
+    runOnServoThread({ServoTaskType::Stop});
 }
 
 void ServoUnityWindowGL::goBack()
 {
     if (!m_servoGLInited) return;
-    runOnServoThread([=] {go_back();});
+    runOnServoThread({ServoTaskType::GoBack});
 }
 
 void ServoUnityWindowGL::goForward()
 {
     if (!m_servoGLInited) return;
-    runOnServoThread([=] {go_forward();});
+    runOnServoThread({ServoTaskType::GoForward});
 }
 
 void ServoUnityWindowGL::goHome()
 {
     if (!m_servoGLInited) return;
-    // TODO: fetch the homepage from prefs.
-    runOnServoThread([=] {
-        if (is_uri_valid(s_param_Homepage.c_str())) {
-            load_uri(s_param_Homepage.c_str());
-        };
-    });
+    runOnServoThread({ServoTaskType::GoHome});
 }
 
 void ServoUnityWindowGL::navigate(const std::string& urlOrSearchString)
 {
     if (!m_servoGLInited) return;
-    runOnServoThread([=] {
-        if (is_uri_valid(urlOrSearchString.c_str())) {
-            load_uri(urlOrSearchString.c_str());
-        } else {
-            std::string uri;
-            // It's not a valid URI, but might be a domain name without method.
-            // Look for bare minimum of a '.'' before any '/'.
-            size_t dotPos = urlOrSearchString.find('.');
-            size_t slashPos = urlOrSearchString.find('/');
-            if (dotPos != std::string::npos && (slashPos == std::string::npos || slashPos > dotPos)) {
-                std::string withMethod = std::string("https://" + urlOrSearchString);
-                if (is_uri_valid(withMethod.c_str())) {
-                    uri = withMethod;
-                } else {
-                    uri = s_param_SearchURI + urlOrSearchString;
-                }
-            } else {
-                uri = s_param_SearchURI + urlOrSearchString;
-            }
-            if (is_uri_valid(uri.c_str())) {
-                load_uri(uri.c_str());
-            } else {
-                SERVOUNITYLOGe("Malformed search string.\n");
-            }
-        }
-    });
+    SERVOTASK task = {ServoTaskType::Navigate};
+    task.navigate.urlOrSearchString = m_servoTaskStrings.store(urlOrSearchString.c_str());
+    if (task.navigate.urlOrSearchString < 0) {
+        SERVOUNITYLOGe("Unable to queue navigation: string arena full.\n");
+        return;
+    }
+    runOnServoThread(task);
 }
 
 //
-// Callback implementations. These are all necesarily static, so have to fetch the active instance
-// via the static instance pointer s_servo.
+// Callback implementations. Each window's engine routes its callbacks to the window that owns it.
 //
 // Callbacks can come from any Servo thread (and there are many) so care must be taken
 // to ensure that any call back into Unity is on the Unity thread, or any work done
@@ -576,78 +1120,80 @@ void ServoUnityWindowGL::navigate(const std::string& urlOrSearchString)
 
 void ServoUnityWindowGL::on_load_started(void)
 {
+    SERVOUNITYTRACE("on_load_started");
     SERVOUNITYLOGd("servo callback on_load_started\n");
-    if (!s_servo) return;
-    s_servo->queueBrowserEventCallbackTask(s_servo->uidExt(), ServoUnityBrowserEvent_LoadStateChanged, 1, 0);
+    queueBrowserEventCallbackTask(uidExt(), ServoUnityBrowserEvent_LoadStateChanged, 1, 0);
 }
 
 void ServoUnityWindowGL::on_load_ended(void)
 {
+    SERVOUNITYTRACE("on_load_ended");
     SERVOUNITYLOGd("servo callback on_load_ended\n");
-    if (!s_servo) return;
-    s_servo->queueBrowserEventCallbackTask(s_servo->uidExt(), ServoUnityBrowserEvent_LoadStateChanged, 0, 0);
+    queueBrowserEventCallbackTask(uidExt(), ServoUnityBrowserEvent_LoadStateChanged, 0, 0);
 }
 
 void ServoUnityWindowGL::on_title_changed(const char *title)
 {
+    SERVOUNITYTRACE("on_title_changed");
     SERVOUNITYLOGd("servo callback on_title_changed: %s\n", title);
-    if (!s_servo) return;
-    s_servo->m_title = std::string(title);
-    s_servo->queueBrowserEventCallbackTask(s_servo->uidExt(), ServoUnityBrowserEvent_TitleChanged, 0, 0);
+    m_title = std::string(title);
+    queueBrowserEventCallbackTask(uidExt(), ServoUnityBrowserEvent_TitleChanged, 0, 0);
 }
 
 bool ServoUnityWindowGL::on_allow_navigation(const char *url)
 {
+    SERVOUNITYTRACE("on_allow_navigation");
     SERVOUNITYLOGd("servo callback on_allow_navigation: %s\n", url);
     return true;
 }
 
 void ServoUnityWindowGL::on_url_changed(const char *url)
 {
+    SERVOUNITYTRACE("on_url_changed");
     SERVOUNITYLOGd("servo callback on_url_changed: %s\n", url);
-    if (!s_servo) return;
-    s_servo->m_URL = std::string(url);
-    s_servo->queueBrowserEventCallbackTask(s_servo->uidExt(), ServoUnityBrowserEvent_URLChanged, 0, 0);
+    m_URL = std::string(url);
+    queueBrowserEventCallbackTask(uidExt(), ServoUnityBrowserEvent_URLChanged, 0, 0);
 }
 
 void ServoUnityWindowGL::on_history_changed(bool can_go_back, bool can_go_forward)
 {
+    SERVOUNITYTRACE("on_history_changed");
     SERVOUNITYLOGd("servo callback on_history_changed: can_go_back:%s, can_go_forward:%s\n", can_go_back ? "true" : "false", can_go_forward ? "true" : "false");
-    if (!s_servo) return;
-    s_servo->queueBrowserEventCallbackTask(s_servo->uidExt(), ServoUnityBrowserEvent_HistoryChanged, can_go_back ? 1 : 0, can_go_forward ? 1 : 0);
+    queueBrowserEventCallbackTask(uidExt(), ServoUnityBrowserEvent_HistoryChanged, can_go_back ? 1 : 0, can_go_forward ? 1 : 0);
 }
 
 void ServoUnityWindowGL::on_animating_changed(bool animating)
 {
+    SERVOUNITYTRACE("on_animating_changed");
     SERVOUNITYLOGd("servo callback on_animating_changed(%s)\n", animating ? "true" : "false");
-    if (!s_servo) return;
-    std::lock_guard<std::mutex> lock(s_servo->m_updateLock);
-    s_servo->m_updateContinuously = animating;
+    m_updateContinuously = animating;
+    if (animating) markActive();
 }
 
 void ServoUnityWindowGL::on_shutdown_complete(void)
 {
+    SERVOUNITYTRACE("on_shutdown_complete");
     SERVOUNITYLOGd("servo callback on_shutdown_complete\n");
-    if (!s_servo) return;
-    s_servo->m_waitingForShutdown = false;
+    m_waitingForShutdown = false;
 }
 
 void ServoUnityWindowGL::on_ime_show(const char *text, int32_t x, int32_t y, int32_t width, int32_t height)
 {
+    SERVOUNITYTRACE("on_ime_show");
     SERVOUNITYLOGd("servo callback on_ime_show(text:%s, x:%d, y:%d, width:%d, height:%d)\n");
-    if (!s_servo) return;
-    s_servo->queueBrowserEventCallbackTask(s_servo->uidExt(), ServoUnityBrowserEvent_IMEStateChanged, 1, 0);
+    queueBrowserEventCallbackTask(uidExt(), ServoUnityBrowserEvent_IMEStateChanged, 1, 0);
 }
 
 void ServoUnityWindowGL::on_ime_hide(void)
 {
+    SERVOUNITYTRACE("on_ime_hide");
     SERVOUNITYLOGi("servo callback on_ime_hide\n");
-    if (!s_servo) return;
-    s_servo->queueBrowserEventCallbackTask(s_servo->uidExt(), ServoUnityBrowserEvent_IMEStateChanged, 0, 0);
+    queueBrowserEventCallbackTask(uidExt(), ServoUnityBrowserEvent_IMEStateChanged, 0, 0);
 }
 
 const char *ServoUnityWindowGL::get_clipboard_contents(void)
 {
+    SERVOUNITYTRACE("get_clipboard_contents");
     SERVOUNITYLOGi("servo callback get_clipboard_contents\n");
     SERVOUNITYLOGw("UNIMPLEMENTED\n");
     return nullptr;
@@ -655,18 +1201,21 @@ const char *ServoUnityWindowGL::get_clipboard_contents(void)
 
 void ServoUnityWindowGL::set_clipboard_contents(const char *contents)
 {
+    SERVOUNITYTRACE("set_clipboard_contents");
     SERVOUNITYLOGi("servo callback set_clipboard_contents: %s\n", contents);
     SERVOUNITYLOGw("UNIMPLEMENTED\n");
 }
 
 void ServoUnityWindowGL::on_media_session_metadata(const char *title, const char *album, const char *artist)
 {
+    SERVOUNITYTRACE("on_media_session_metadata");
     SERVOUNITYLOGi("servo callback on_media_session_metadata: title:%s, album:%s, artist:%s\n", title, album, artist);
     SERVOUNITYLOGw("UNIMPLEMENTED\n");
 }
 
 void ServoUnityWindowGL::on_media_session_playback_state_change(CMediaSessionPlaybackState state)
 {
+    SERVOUNITYTRACE("on_media_session_playback_state_change");
     const char *stateA;
     switch (state) {
         case CMediaSessionPlaybackState::None:
@@ -688,18 +1237,21 @@ void ServoUnityWindowGL::on_media_session_playback_state_change(CMediaSessionPla
 
 void ServoUnityWindowGL::on_media_session_set_position_state(double duration, double position, double playback_rate)
 {
+    SERVOUNITYTRACE("on_media_session_set_position_state");
     SERVOUNITYLOGi("servo callback on_media_session_set_position_state: duration:%f, position:%f, playback_rate:%f\n", duration, position, playback_rate);
     SERVOUNITYLOGw("UNIMPLEMENTED\n");
 }
 
 void ServoUnityWindowGL::prompt_alert(const char *message, bool trusted)
 {
+    SERVOUNITYTRACE("prompt_alert");
     SERVOUNITYLOGi("servo callback prompt_alert%s: %s\n", trusted ? " (trusted)" : "", message);
     SERVOUNITYLOGw("UNIMPLEMENTED\n");
 }
 
 CPromptResult ServoUnityWindowGL::prompt_ok_cancel(const char *message, bool trusted)
 {
+    SERVOUNITYTRACE("prompt_ok_cancel");
     SERVOUNITYLOGi("servo callback prompt_ok_cancel%s: %s\n", trusted ? " (trusted)" : "", message);
     SERVOUNITYLOGw("UNIMPLEMENTED\n");
     return CPromptResult::Dismissed;
@@ -707,6 +1259,7 @@ CPromptResult ServoUnityWindowGL::prompt_ok_cancel(const char *message, bool tru
 
 CPromptResult ServoUnityWindowGL::prompt_yes_no(const char *message, bool trusted)
 {
+    SERVOUNITYTRACE("prompt_yes_no");
     SERVOUNITYLOGi("servo callback prompt_yes_no%s: %s\n", trusted ? " (trusted)" : "", message);
     SERVOUNITYLOGw("UNIMPLEMENTED\n");
     return CPromptResult::Dismissed;
@@ -714,6 +1267,7 @@ CPromptResult ServoUnityWindowGL::prompt_yes_no(const char *message, bool truste
 
 const char *ServoUnityWindowGL::prompt_input(const char *message, const char *def, bool trusted)
 {
+    SERVOUNITYTRACE("prompt_input");
     SERVOUNITYLOGi("servo callback prompt_input%s: %s\n", trusted ? " (trusted)" : "", message);
     SERVOUNITYLOGw("UNIMPLEMENTED\n");
     return def;
@@ -721,6 +1275,7 @@ const char *ServoUnityWindowGL::prompt_input(const char *message, const char *de
 
 void ServoUnityWindowGL::on_devtools_started(CDevtoolsServerState result, unsigned int port, const char *token)
 {
+    SERVOUNITYTRACE("on_devtools_started");
     const char *resultA;
     switch (result) {
         case CDevtoolsServerState::Error:
@@ -739,25 +1294,22 @@ void ServoUnityWindowGL::on_devtools_started(CDevtoolsServerState result, unsign
 
 void ServoUnityWindowGL::show_context_menu(const char *title, const char *const *items_list, uint32_t items_size)
 {
+    SERVOUNITYTRACE("show_context_menu");
     SERVOUNITYLOGi("servo callback show_context_menu: title:%s\n", title);
-    for (int i = 0; i < items_size; i++) {
-        SERVOUNITYLOGi("    item %n:%s\n", i, items_list[i]);
+    for (uint32_t i = 0; i < items_size; i++) {
+        SERVOUNITYLOGi("    item %u:%s\n", i, items_list[i]);
     }
     SERVOUNITYLOGw("UNIMPLEMENTED\n");
-    on_context_menu_closed(CContextMenuResult::Dismissed_, 0);
-}
-
-void ServoUnityWindowGL::on_log_output(const char *buffer, uint32_t buffer_length)
-{
-    SERVOUNITYLOGi("servo callback on_log_output: %s\n", buffer);
+    m_engine->api().on_context_menu_closed(CContextMenuResult::Dismissed_, 0);
 }
 
 void ServoUnityWindowGL::wakeup(void)
 {
+    SERVOUNITYTRACE("wakeup");
     SERVOUNITYLOGd("servo callback wakeup on thread %" PRIu64 "\n", getThreadID());
-    if (!s_servo) return;
-    std::lock_guard<std::mutex> lock(s_servo->m_updateLock);
-    s_servo->m_updateOnce = true;
+    m_wakeups.fetch_add(1, std::memory_order_relaxed);
+    m_updateOnce = true;
+    markActive();
 }
 
 
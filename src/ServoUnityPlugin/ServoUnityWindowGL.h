@@ -18,11 +18,21 @@
 #include <cstdint>
 #include <string>
 #include <deque>
-#include <functional>
 #include <mutex>
+#include <atomic>
 #include "simpleservo.h"
+#include "ServoUnityEngine.h"
+#include "ServoUnityMPSCQueue.h"
+#include "ServoUnityStringArena.h"
+#include "utils.h"
 
-class ServoUnityWindowGL : public ServoUnityWindow
+#define SERVO_TASK_QUEUE_SIZE 1024 // Must be a power of two.
+#define SERVO_STRING_ARENA_SIZE 65536
+#define SERVO_INPUT_EVENT_BATCH_SIZE 64 // Events translated per bulk push in submitInputEvents.
+#define SERVO_SHUTDOWN_TIMEOUT_MS 2000L
+#define SERVO_LATENCY_SAMPLES_MAX 256 // Input events awaiting a texture fill before their latency is recorded.
+
+class ServoUnityWindowGL : public ServoUnityWindow, public ServoUnityEngineClient
 {
 private:
 	Size m_size;
@@ -36,50 +46,137 @@ private:
     PFN_WINDOWCREATEDCALLBACK m_windowCreatedCallback;
     PFN_WINDOWRESIZEDCALLBACK m_windowResizedCallback;
     PFN_BROWSEREVENTCALLBACK m_browserEventCallback;
+    ServoUnityEngine *m_engine; // Null until Servo is started for this window.
     bool m_servoGLInited;
-    std::deque< std::function<void()> > m_servoTasks;
-    std::mutex m_servoTasksLock;
+    enum class ServoTaskType : uint8_t {
+        None = 0,
+        MouseMove,
+        MouseDown,
+        MouseUp,
+        Click,
+        Scroll,
+        KeyDown,
+        KeyUp,
+        Refresh,
+        Reload,
+        Stop,
+        GoBack,
+        GoForward,
+        GoHome,
+        Navigate
+    };
+    typedef struct {
+        ServoTaskType type;
+        union {
+            struct { int32_t x; int32_t y; } pointer; // MouseMove, Click.
+            struct { int32_t x; int32_t y; CMouseButton button; } button; // MouseDown, MouseUp.
+            struct { int32_t dx; int32_t dy; int32_t x; int32_t y; } scroll; // Scroll.
+            struct { uint32_t keyCode; CKeyType keyType; } key; // KeyDown, KeyUp.
+            struct { int32_t urlOrSearchString; } navigate; // Navigate. Offset into m_servoTaskStrings.
+        };
+        uint64_t timeQueuedNs; // Set when queued. After coalescing, the time the earliest merged event was queued.
+    } SERVOTASK;
+    ServoUnityMPSCQueue<SERVOTASK, SERVO_TASK_QUEUE_SIZE> m_servoTasks;
+    ServoUnityStringArena<SERVO_STRING_ARENA_SIZE> m_servoTaskStrings;
+    uint64_t m_servoTasksOverflowCountReported;
+    SERVOTASK m_servoTaskBatch[SERVO_TASK_QUEUE_SIZE]; // Render thread only. Tasks drained from m_servoTasks, including any deferred from previous frames.
+    size_t m_servoTaskBatchCount;
+    enum ServoTaskPriority {
+        ServoTaskPriority_Control = 0, // Navigation and browser controls.
+        ServoTaskPriority_Input,
+        ServoTaskPriority_Low
+    };
+    std::atomic<uint64_t> m_servoTasksDeferred;
+    std::atomic<uint64_t> m_servoTasksDeferredLastFrame;
+    std::atomic<uint64_t> m_pointerMovesCoalesced;
+    std::atomic<uint64_t> m_scrollsCoalesced;
+    std::atomic<uint64_t> m_inputEventsCoalescedLastFrame;
+    typedef struct { uint64_t queuedNs; uint64_t dispatchedNs; uint64_t updatedNs; } LATENCYSAMPLE;
+    LATENCYSAMPLE m_latencySamples[SERVO_LATENCY_SAMPLES_MAX]; // Render thread only.
+    size_t m_latencySampleCount;
+    std::atomic<uint64_t> m_latencySamplesDropped;
+    utilHistogram m_latency[ServoUnityLatencyStage_Max]; // Microseconds.
+    std::atomic<bool> m_textureDirty; // Texture must be filled on next update even if Servo has not been updated.
+    std::atomic<uint64_t> m_textureFillsPerformed;
+    std::atomic<uint64_t> m_textureFillsSkipped;
+    std::atomic<uint64_t> m_renderEvents;
+    std::atomic<uint64_t> m_performUpdatesCount;
+    std::atomic<uint64_t> m_performUpdatesTotalUs;
+    std::atomic<uint64_t> m_performUpdatesMaxUs;
+    std::atomic<uint64_t> m_fillTotalUs;
+    std::atomic<uint64_t> m_fillMaxUs;
+    std::atomic<uint64_t> m_servoTaskQueueHighWater;
+    std::atomic<uint64_t> m_wakeups;
+    std::atomic<double> m_wakeupsPerSecond;
+    uint64_t m_wakeupsRateStartNs; // Render thread only.
+    uint64_t m_wakeupsRateStartCount; // Render thread only.
     typedef struct {int uidExt; int eventType; int eventData1; int eventData2; } BROWSEREVENTCALLBACKTASK;
     std::deque< BROWSEREVENTCALLBACKTASK > m_browserEventCallbackTasks;
     std::mutex m_browserEventCallbackTasksLock;
-    bool m_updateContinuously;
-    bool m_updateOnce;
-    std::mutex m_updateLock;
+    std::atomic<uint64_t> m_browserEventCallbackTasksDepth; // Updated with m_browserEventCallbackTasksLock held.
+    std::atomic<bool> m_updateContinuously;
+    std::atomic<bool> m_updateOnce;
     std::string m_title;
     std::string m_URL;
-    bool m_waitingForShutdown;
+    std::atomic<bool> m_waitingForShutdown; // Cleared by on_shutdown_complete, which may arrive on any thread.
+    enum class ShutdownState : uint8_t {
+        None = 0,
+        InProgress, // request_shutdown() called, waiting for on_shutdown_complete.
+        Complete // deinit() called. The window will not restart Servo.
+    };
+    ShutdownState m_shutdownState; // Render thread only.
+    uint64_t m_shutdownTimeStartNs;
+    uint64_t m_timeCreatedNs;
+    std::atomic<uint64_t> m_timeToFirstFrameUs;
+    static ServoUnityEngine *s_servoPrewarmed;
+    static Size s_servoPrewarmedSize;
 
-    static void on_load_started(void);
-    static void on_load_ended(void);
-    static void on_title_changed(const char *title);
-    static bool on_allow_navigation(const char *url);
-    static void on_url_changed(const char *url);
-    static void on_history_changed(bool can_go_back, bool can_go_forward);
-    static void on_animating_changed(bool animating);
-    static void on_shutdown_complete(void);
-    static void on_ime_show(const char *text, int32_t x, int32_t y, int32_t width, int32_t height);
-    static void on_ime_hide(void);
-    static const char *get_clipboard_contents(void);
-    static void set_clipboard_contents(const char *contents);
-    static void on_media_session_metadata(const char *title, const char *album, const char *artist);
-    static void on_media_session_playback_state_change(CMediaSessionPlaybackState state);
-    static void on_media_session_set_position_state(double duration, double position, double playback_rate);
-    static void prompt_alert(const char *message, bool trusted);
-    static CPromptResult prompt_ok_cancel(const char *message, bool trusted);
-    static CPromptResult prompt_yes_no(const char *message, bool trusted);
-    static const char *prompt_input(const char *message, const char *def, bool trusted);
-    static void on_devtools_started(CDevtoolsServerState result, unsigned int port, const char *token);
-    static void show_context_menu(const char *title, const char *const *items_list, uint32_t items_size);
-    static void on_log_output(const char *buffer, uint32_t buffer_length);
-    static void wakeup(void);
+    // ServoUnityEngineClient.
+    void on_load_started(void) override;
+    void on_load_ended(void) override;
+    void on_title_changed(const char *title) override;
+    bool on_allow_navigation(const char *url) override;
+    void on_url_changed(const char *url) override;
+    void on_history_changed(bool can_go_back, bool can_go_forward) override;
+    void on_animating_changed(bool animating) override;
+    void on_shutdown_complete(void) override;
+    void on_ime_show(const char *text, int32_t x, int32_t y, int32_t width, int32_t height) override;
+    void on_ime_hide(void) override;
+    const char *get_clipboard_contents(void) override;
+    void set_clipboard_contents(const char *contents) override;
+    void on_media_session_metadata(const char *title, const char *album, const char *artist) override;
+    void on_media_session_playback_state_change(CMediaSessionPlaybackState state) override;
+    void on_media_session_set_position_state(double duration, double position, double playback_rate) override;
+    void prompt_alert(const char *message, bool trusted) override;
+    CPromptResult prompt_ok_cancel(const char *message, bool trusted) override;
+    CPromptResult prompt_yes_no(const char *message, bool trusted) override;
+    const char *prompt_input(const char *message, const char *def, bool trusted) override;
+    void on_devtools_started(CDevtoolsServerState result, unsigned int port, const char *token) override;
+    void show_context_menu(const char *title, const char *const *items_list, uint32_t items_size) override;
+    void wakeup(void) override;
 
-    void runOnServoThread(std::function<void()> task);
+    static void initServo(ServoUnityEngine *engine, Size size);
+    void runOnServoThread(const SERVOTASK& task);
+    static bool makePointerTask(int eventID, int eventParam0, int eventParam1, int x, int y, SERVOTASK *task_p);
+    static bool makeKeyTask(int upDown, int keyCode, int character, SERVOTASK *task_p);
+    void runServoTask(const SERVOTASK& task);
+    size_t runServoTasks(void);
+    bool hasPendingWork(void);
+    void updateShutdown(void);
+    static ServoTaskPriority servoTaskPriority(ServoTaskType type);
+    static size_t coalesceServoTasks(SERVOTASK *tasks, size_t count, uint64_t *pointerMovesCoalesced_p, uint64_t *scrollsCoalesced_p);
+    void clearServoTasks(void);
+    void releaseServoTask(const SERVOTASK& task);
+    void latencyDispatched(const SERVOTASK& task);
+    void latencyUpdated(void);
+    void latencyFilled(void);
+    void updateWakeupsRate(uint64_t nowNs);
     void queueBrowserEventCallbackTask(int uidExt, int eventType, int eventData1, int eventData2);
 
 public:
 	static void initDevice();
 	static void finalizeDevice();
-    static ServoUnityWindowGL *s_servo;
+    static void prewarm(Size size);
 	ServoUnityWindowGL(int uid, int uidExt, Size size);
 	~ServoUnityWindowGL() ;
 
@@ -93,6 +190,11 @@ public:
     void serviceWindowEvents(void) override;
     std::string windowTitle(void) override;
     std::string windowURL(void) override;
+    uint64_t counter(int counterID) override;
+    bool latencyStats(int stage, ServoUnityLatencyStats *stats_out) override;
+    void resetLatencyStats(void) override;
+    bool windowStats(ServoUnityWindowStats *stats_out) override;
+    void forceTextureRefresh(void) override;
 
 	/// Request an update to the window texture. Must be called from render thread.
 	void requestUpdate(float timeDelta) override;
@@ -110,6 +212,7 @@ public:
     void pointerClick(int button, int x, int y) override;
     void pointerScrollDiscrete(int x_scroll, int y_scroll, int x, int y) override;
 	void keyEvent(int upDown, int keyCode, int character) override;
+    int submitInputEvents(const ServoUnityInputEvent *events, int count) override;
 
     void refresh() override;
     void reload() override;
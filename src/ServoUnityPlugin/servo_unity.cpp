@@ -15,12 +15,13 @@
 #include "servo_unity_c.h"
 #include "servo_unity_log.h"
 #include "servo_unity_internal.h"
+#include "servo_unity_trace.h"
 
 #include "ServoUnityWindowDX11.h"
 #include "ServoUnityWindowGL.h"
+#include "ServoUnitySlotMap.h"
 #include <memory>
 #include <assert.h>
-#include <map>
 #include "simpleservo.h"
 #include "utils.h"
 
@@ -45,8 +46,12 @@ static PFN_WINDOWCREATEDCALLBACK m_windowCreatedCallback = nullptr;
 static PFN_WINDOWRESIZEDCALLBACK m_windowResizedCallback = nullptr;
 static PFN_BROWSEREVENTCALLBACK m_browserEventCallback = nullptr;
 
-static std::map<int, std::unique_ptr<ServoUnityWindow>> s_windows;
-static int s_windowIndexNext = 1;
+#define SERVO_UNITY_WINDOWS_MAX 256 // Must be a power of two.
+
+// Window indices handed out to Unity are handles into this map. Any thread may look up a window, inside a ReadGuard.
+typedef ServoUnitySlotMap<ServoUnityWindow, SERVO_UNITY_WINDOWS_MAX> ServoUnityWindowMap;
+static ServoUnityWindowMap s_windows;
+std::atomic<int> ServoUnityWindow::s_activeWindowCount(0);
 
 static const char *s_servoVersion = nullptr; // To avoid repeated leaking of servo's version string, we'll stash it here.
 
@@ -54,8 +59,16 @@ static const char *s_servoVersion = nullptr; // To avoid repeated leaking of ser
 //  Configuration parameters
 
 bool s_param_CloseNativeWindowOnClose = true;
+std::mutex s_param_StringsLock;
 std::string s_param_SearchURI = SEARCH_URI_DEFAULT;
 std::string s_param_Homepage = HOMEPAGE_DEFAULT;
+std::string s_param_ServoLogModules;
+std::string s_param_ServoLogLevel;
+std::string s_param_RemoteHost;
+std::atomic<int> s_param_MaxServoTasksPerFrame(0);
+int s_param_ServoLogRateLimit = SERVO_LOG_RATE_LIMIT_DEFAULT;
+std::atomic<int> s_param_MaxLibraryCopies(LIBRARY_COPIES_MAX_DEFAULT);
+std::atomic<float> s_param_ServoTaskTimeBudgetMs(0.0f);
 
 // --------------------------------------------------------------------------
 
@@ -148,7 +161,26 @@ void servoUnitySetRenderEventFunc2Param(int windowIndex)
     s_RenderEventFunc12Param_windowIndex = windowIndex;
 }
 
-static void UNITY_INTERFACE_API OnRenderEvent(int eventID)
+static int s_RenderEventFunc3Param_width = 0;
+static int s_RenderEventFunc3Param_height = 0;
+
+void servoUnitySetRenderEventFunc3Params(int width, int height)
+{
+    s_RenderEventFunc3Param_width = width;
+    s_RenderEventFunc3Param_height = height;
+}
+
+static_assert(sizeof(ServoUnityRenderEventData) == 24, "ServoUnityRenderEventData layout is relied on by managed code.");
+static ServoUnityRenderEventData s_renderEventDataPool[SERVO_UNITY_RENDER_EVENT_DATA_POOL_SIZE];
+static uint64_t s_renderEventDataFrameLast = 0; // Render thread only.
+
+ServoUnityRenderEventData *servoUnityGetRenderEventDataPool(int *count_out)
+{
+    if (count_out) *count_out = SERVO_UNITY_RENDER_EVENT_DATA_POOL_SIZE;
+    return s_renderEventDataPool;
+}
+
+static bool renderEventRendererSupported(void)
 {
 	// Unknown / unsupported graphics device type? Do nothing
 	switch (s_RendererType) {
@@ -158,21 +190,71 @@ static void UNITY_INTERFACE_API OnRenderEvent(int eventID)
 		break; 
 	default:
 		SERVOUNITYLOGe("Unsupported renderer.\n");
-		return;
+		return false;
 	}
+	return true;
+}
+
+static void renderEventCheckFrame(uint64_t frame)
+{
+    if (frame < s_renderEventDataFrameLast) {
+        SERVOUNITYLOGw("Render event data for frame %" PRIu64 " follows data for frame %" PRIu64 ". Render event data slots are being refilled before their events have run.\n", frame, s_renderEventDataFrameLast);
+    } else {
+        s_renderEventDataFrameLast = frame;
+    }
+}
+
+static void renderEvent(int eventID, int windowIndex, float timeDelta, int width, int height)
+{
+    // Fast path: when every window is idle, there's nothing to update. The count never undercounts,
+    // so a window given work before this check is updated by this event.
+    if (eventID == 1 && ServoUnityWindow::activeWindowCount() <= 0) return;
+
+    if (!renderEventRendererSupported()) return;
 
 	switch (eventID) {
 	case 1:
-		servoUnityRequestWindowUpdate(s_RenderEventFunc12Param_windowIndex, s_RenderEventFunc1Param_timeDelta);
+		servoUnityRequestWindowUpdate(windowIndex, timeDelta);
 		break;
     case 2:
-        servoUnityCleanupRenderer(s_RenderEventFunc12Param_windowIndex);
+        servoUnityCleanupRenderer(windowIndex);
+        break;
+    case 3:
+        servoUnityPrewarm(width, height);
         break;
 	default:
 		break;
 	}
 }
 
+static void UNITY_INTERFACE_API OnRenderEvent(int eventID)
+{
+    renderEvent(eventID, s_RenderEventFunc12Param_windowIndex, s_RenderEventFunc1Param_timeDelta, s_RenderEventFunc3Param_width, s_RenderEventFunc3Param_height);
+    // Delete windows retired by servoUnityCleanupRenderer once no reader can still hold them.
+    s_windows.reclaim();
+}
+
+static void UNITY_INTERFACE_API OnRenderEventAndData(int eventID, void *data)
+{
+    if (!data) {
+        SERVOUNITYLOGe("Render event %d issued without data.\n", eventID);
+        return;
+    }
+    if (eventID == 4) {
+        ServoUnityUpdateAllWindowsData *u = (ServoUnityUpdateAllWindowsData *)data;
+        renderEventCheckFrame(u->frame);
+        u->windowCount = renderEventRendererSupported() ? servoUnityRequestAllWindowsUpdate(u->timeDelta, u->results, u->resultsCapacity) : 0;
+        std::atomic_thread_fence(std::memory_order_release);
+        u->resultsFrame = u->frame;
+        s_windows.reclaim();
+        return;
+    }
+    // Copy out first, as the slot may be refilled by the main thread as soon as we return.
+    ServoUnityRenderEventData d = *(const ServoUnityRenderEventData *)data;
+    renderEventCheckFrame(d.frame);
+    renderEvent(eventID, d.windowIndex, d.timeDelta, d.width, d.height);
+    s_windows.reclaim();
+}
 
 // GetRenderEventFunc, a function we export which is used to get a rendering event callback function.
 extern "C" UnityRenderingEvent UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API GetRenderEventFunc()
@@ -180,6 +262,12 @@ extern "C" UnityRenderingEvent UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API GetRen
 	return OnRenderEvent;
 }
 
+// GetRenderEventAndDataFunc, as GetRenderEventFunc, but the callback takes a ServoUnityRenderEventData *.
+extern "C" UnityRenderingEventAndData UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API GetRenderEventAndDataFunc()
+{
+	return OnRenderEventAndData;
+}
+
 //
 // ServoUnity plugin implementation.
 //
@@ -243,38 +331,50 @@ void servoUnityFinalise(void)
 
 void servoUnityKeyEvent(int windowIndex, int upDown, int keyCode, int character)
 {
-	auto window_iter = s_windows.find(windowIndex);
-	if (window_iter != s_windows.end()) {
-        window_iter->second->keyEvent(upDown, keyCode, character);
+	ServoUnityWindowMap::ReadGuard guard(s_windows);
+	ServoUnityWindow *window = s_windows.get(windowIndex);
+	if (window) {
+        window->keyEvent(upDown, keyCode, character);
 	}
 }
 
 int servoUnityGetWindowCount(void)
 {
-	return (int)s_windows.size();
+	return s_windows.size();
 }
 
 bool servoUnityRequestNewWindow(int uidExt, int widthPixelsRequested, int heightPixelsRequested)
 {
-	std::unique_ptr<ServoUnityWindow> window;
+	bool unsupported = false;
+	int windowIndex = s_windows.insert([&](int uid) {
+		std::unique_ptr<ServoUnityWindow> window;
 #ifdef SUPPORT_D3D11
-    if (s_RendererType == kUnityGfxRendererD3D11) {
-        SERVOUNITYLOGi("Servo window requested with DirectX 11 renderer.\n");
-		window = std::make_unique<ServoUnityWindowDX11>(s_windowIndexNext++, uidExt, ServoUnityWindow::Size({ widthPixelsRequested, heightPixelsRequested }));
-	} else
+		if (s_RendererType == kUnityGfxRendererD3D11) {
+			SERVOUNITYLOGi("Servo window requested with DirectX 11 renderer.\n");
+			window = std::make_unique<ServoUnityWindowDX11>(uid, uidExt, ServoUnityWindow::Size({ widthPixelsRequested, heightPixelsRequested }));
+		} else
 #endif // SUPPORT_D3D11
 #ifdef SUPPORT_OPENGL_CORE
-    if (s_RendererType == kUnityGfxRendererOpenGLCore) {
-        SERVOUNITYLOGi("Servo window requested with OpenGL renderer.\n");
-		window = std::make_unique<ServoUnityWindowGL>(s_windowIndexNext++, uidExt, ServoUnityWindow::Size({ widthPixelsRequested, heightPixelsRequested }));
-	} else
+		if (s_RendererType == kUnityGfxRendererOpenGLCore) {
+			SERVOUNITYLOGi("Servo window requested with OpenGL renderer.\n");
+			window = std::make_unique<ServoUnityWindowGL>(uid, uidExt, ServoUnityWindow::Size({ widthPixelsRequested, heightPixelsRequested }));
+		} else
 #endif // SUPPORT_OPENGL_CORE
-    {
-		SERVOUNITYLOGe("Cannot create window. Unknown/unsupported render type detected.\n");
+		{
+			unsupported = true;
+		}
+		return window;
+	});
+	if (!windowIndex) {
+		if (unsupported) SERVOUNITYLOGe("Cannot create window. Unknown/unsupported render type detected.\n");
+		else SERVOUNITYLOGe("Error creating window (limit is %d windows).\n", SERVO_UNITY_WINDOWS_MAX);
+		return false;
 	}
-	auto inserted = s_windows.emplace(window->uid(), move(window));
-	if (!inserted.second || !inserted.first->second->init(m_windowCreatedCallback, m_windowResizedCallback, m_browserEventCallback)) {
+	ServoUnityWindowMap::ReadGuard guard(s_windows);
+	ServoUnityWindow *window = s_windows.get(windowIndex);
+	if (!window || !window->init(m_windowCreatedCallback, m_windowResizedCallback, m_browserEventCallback)) {
 		SERVOUNITYLOGe("Error initing window.\n");
+		s_windows.erase(windowIndex);
 		return false;
 	}
 	return true;
@@ -287,13 +387,14 @@ bool servoUnitySetWindowUnityTextureID(int windowIndex, void *nativeTexturePtr)
         return false;
     }
    
-	auto window_iter = s_windows.find(windowIndex);
-	if (window_iter == s_windows.end()) {
+	ServoUnityWindowMap::ReadGuard guard(s_windows);
+	ServoUnityWindow *window = s_windows.get(windowIndex);
+	if (!window) {
 		SERVOUNITYLOGe("Requested to set unity texture ID for non-existent window with index %d.\n", windowIndex);
 		return false;
 	}
 
-	window_iter->second->setNativePtr(nativeTexturePtr);
+	window->setNativePtr(nativeTexturePtr);
 	SERVOUNITYLOGi("servoUnitySetWindowUnityTextureID set texturePtr %p.\n", nativeTexturePtr);
 	return true;
 }
@@ -304,6 +405,12 @@ void servoUnitySetParamBool(int param, bool flag)
 		case ServoUnityParam_b_CloseNativeWindowOnClose:
 			s_param_CloseNativeWindowOnClose = flag;
 			break;
+        case ServoUnityParam_b_Trace:
+            servoUnityTraceSetEnabled(flag);
+            break;
+        case ServoUnityParam_b_LogDeferredFormatting:
+            servoUnityLogSetDeferredFormatting(flag ? 1 : 0);
+            break;
 		default:
 			break;
 	}
@@ -311,11 +418,33 @@ void servoUnitySetParamBool(int param, bool flag)
 
 void servoUnitySetParamInt(int param, int val)
 {
-    // No parameters to set yet.
+    switch (param) {
+        case ServoUnityParam_i_MaxServoTasksPerFrame:
+            s_param_MaxServoTasksPerFrame = (val < 0 ? 0 : val);
+            break;
+        case ServoUnityParam_i_LogRateLimit:
+            servoUnityLogSiteLimitPerSecond = (val < 0 ? 0 : val);
+            break;
+        case ServoUnityParam_i_ServoLogRateLimit:
+            s_param_ServoLogRateLimit = (val < 0 ? 0 : val);
+            break;
+        case ServoUnityParam_i_MaxLibraryCopies:
+            s_param_MaxLibraryCopies = (val < 0 ? 0 : val);
+            break;
+        default:
+            break;
+    }
+}
+
+std::string servoUnityCopyParamString(const std::string& param)
+{
+    std::lock_guard<std::mutex> lock(s_param_StringsLock);
+    return param;
 }
 
 void servoUnitySetParamString(int param, const char *s)
 {
+    std::lock_guard<std::mutex> lock(s_param_StringsLock);
     switch (param) {
         case ServoUnityParam_s_SearchURI:
             s_param_SearchURI = std::string(s);
@@ -323,6 +452,15 @@ void servoUnitySetParamString(int param, const char *s)
         case ServoUnityParam_s_Homepage:
             s_param_Homepage = std::string(s);
             break;
+        case ServoUnityParam_s_ServoLogModules:
+            s_param_ServoLogModules = std::string(s);
+            break;
+        case ServoUnityParam_s_ServoLogLevel:
+            s_param_ServoLogLevel = std::string(s);
+            break;
+        case ServoUnityParam_s_RemoteHost:
+            s_param_RemoteHost = std::string(s);
+            break;
         default:
             break;
     }
@@ -330,7 +468,13 @@ void servoUnitySetParamString(int param, const char *s)
 
 void servoUnitySetParamFloat(int param, float val)
 {
-    // No parameters to set yet.
+    switch (param) {
+        case ServoUnityParam_f_ServoTaskTimeBudgetMs:
+            s_param_ServoTaskTimeBudgetMs = (val < 0.0f ? 0.0f : val);
+            break;
+        default:
+            break;
+    }
 }
 
 bool servoUnityGetParamBool(int param)
@@ -339,6 +483,12 @@ bool servoUnityGetParamBool(int param)
 		case ServoUnityParam_b_CloseNativeWindowOnClose:
 			return s_param_CloseNativeWindowOnClose;
 			break;
+        case ServoUnityParam_b_Trace:
+            return servoUnityTraceEnabled;
+            break;
+        case ServoUnityParam_b_LogDeferredFormatting:
+            return (servoUnityLogGetDeferredFormatting() != 0);
+            break;
 		default:
 			break;
 	}
@@ -347,19 +497,41 @@ bool servoUnityGetParamBool(int param)
 
 int servoUnityGetParamInt(int param)
 {
-    // No parameters to query yet.
+    switch (param) {
+        case ServoUnityParam_i_MaxServoTasksPerFrame:
+            return s_param_MaxServoTasksPerFrame;
+            break;
+        case ServoUnityParam_i_LogRateLimit:
+            return servoUnityLogSiteLimitPerSecond;
+            break;
+        case ServoUnityParam_i_ServoLogRateLimit:
+            return s_param_ServoLogRateLimit;
+            break;
+        case ServoUnityParam_i_MaxLibraryCopies:
+            return s_param_MaxLibraryCopies;
+            break;
+        default:
+            break;
+    }
 	return 0;
 }
 
 float servoUnityGetParamFloat(int param)
 {
-    // No parameters to query yet.
+    switch (param) {
+        case ServoUnityParam_f_ServoTaskTimeBudgetMs:
+            return s_param_ServoTaskTimeBudgetMs;
+            break;
+        default:
+            break;
+    }
 	return 0.0f;
 }
 
 void servoUnityGetParamString(int param, char *sbuf, int sbufLen)
 {
     if (!sbuf || sbufLen <= 0) return;
+    std::lock_guard<std::mutex> lock(s_param_StringsLock);
     switch (param) {
         case ServoUnityParam_s_SearchURI:
             strncpy(sbuf, s_param_SearchURI.c_str(), sbufLen - 1);
@@ -367,20 +539,36 @@ void servoUnityGetParamString(int param, char *sbuf, int sbufLen)
         case ServoUnityParam_s_Homepage:
             strncpy(sbuf, s_param_Homepage.c_str(), sbufLen - 1);
             break;
+        case ServoUnityParam_s_ServoLogModules:
+            strncpy(sbuf, s_param_ServoLogModules.c_str(), sbufLen - 1);
+            break;
+        case ServoUnityParam_s_ServoLogLevel:
+            strncpy(sbuf, s_param_ServoLogLevel.c_str(), sbufLen - 1);
+            break;
+        case ServoUnityParam_s_RemoteHost:
+            strncpy(sbuf, s_param_RemoteHost.c_str(), sbufLen - 1);
+            break;
         default:
             break;
     }
     sbuf[sbufLen - 1] = '\0'; // Guarantee nul-termination, even if truncated.
 }
 
+bool servoUnityWriteTrace(const char *path)
+{
+    return servoUnityTraceWrite(path);
+}
+
 bool servoUnityCloseWindow(int windowIndex)
 {
-	auto window_iter = s_windows.find(windowIndex);
-	if (window_iter == s_windows.end()) return false;
-	
-	window_iter->second->CloseServoWindow();	
-	s_windows.erase(window_iter);
-	return true;
+	{
+		ServoUnityWindowMap::ReadGuard guard(s_windows);
+		ServoUnityWindow *window = s_windows.get(windowIndex);
+		if (!window) return false;
+		window->CloseServoWindow();
+	}
+	// Outside the guard, so that the window can be deleted immediately unless the render thread is using it.
+	return s_windows.erase(windowIndex);
 }
 
 bool servoUnityCloseAllWindows(void)
@@ -391,16 +579,17 @@ bool servoUnityCloseAllWindows(void)
 
 bool servoUnityGetWindowTextureFormat(int windowIndex, int *width, int *height, int *format, bool *mipChain, bool *linear, void **nativeTextureID_p)
 {
-	auto window_iter = s_windows.find(windowIndex);
-	if (window_iter == s_windows.end()) return false;
+	ServoUnityWindowMap::ReadGuard guard(s_windows);
+	ServoUnityWindow *window = s_windows.get(windowIndex);
+	if (!window) return false;
 
-	ServoUnityWindow::Size size = window_iter->second->size();
+	ServoUnityWindow::Size size = window->size();
 	if (width) *width = size.w;
 	if (height) *height = size.h;
-	if (format) *format = window_iter->second->format();
+	if (format) *format = window->format();
 	if (mipChain) *mipChain = false;
 	if (linear) *linear = true;
-	if (nativeTextureID_p) *nativeTextureID_p = window_iter->second->nativePtr();
+	if (nativeTextureID_p) *nativeTextureID_p = window->nativePtr();
 	return true;
 }
 
@@ -432,121 +621,188 @@ uint64_t servoUnityGetBufferSizeForTextureFormat(int width, int height, int form
 
 bool servoUnityRequestWindowSizeChange(int windowIndex, int width, int height)
 {
-	auto window_iter = s_windows.find(windowIndex);
-	if (window_iter == s_windows.end()) return false;
+	ServoUnityWindowMap::ReadGuard guard(s_windows);
+	ServoUnityWindow *window = s_windows.get(windowIndex);
+	if (!window) return false;
 	
-	window_iter->second->setSize({ width, height });
+	window->setSize({ width, height });
 
     return true;
 }
 
 void servoUnityServiceWindowEvents(int windowIndex)
 {
-    auto window_iter = s_windows.find(windowIndex);
-    if (window_iter == s_windows.end()) {
+    ServoUnityWindowMap::ReadGuard guard(s_windows);
+    ServoUnityWindow *window = s_windows.get(windowIndex);
+    if (!window) {
         SERVOUNITYLOGe("Requested event service for non-existent window with index %d.\n", windowIndex);
         return;
     }
-    window_iter->second->serviceWindowEvents();
+    window->serviceWindowEvents();
 }
 
 void servoUnityGetWindowMetadata(int windowIndex, char *titleBuf, int titleBufLen, char *urlBuf, int urlBufLen)
 {
-    auto window_iter = s_windows.find(windowIndex);
-    if (window_iter == s_windows.end()) {
+    ServoUnityWindowMap::ReadGuard guard(s_windows);
+    ServoUnityWindow *window = s_windows.get(windowIndex);
+    if (!window) {
         SERVOUNITYLOGe("Requested window metadata for non-existent window with index %d.\n", windowIndex);
         return;
     }
     if (titleBuf && titleBufLen > 0) {
-        std::string title = window_iter->second->windowTitle();
+        std::string title = window->windowTitle();
         strncpy(titleBuf, title.c_str(), titleBufLen - 1);
         titleBuf[titleBufLen - 1] = '\0';  // Guarantee nul-termination, even if truncated.
     }
     if (urlBuf && urlBufLen > 0) {
-        std::string URL = window_iter->second->windowURL();
+        std::string URL = window->windowURL();
         strncpy(urlBuf, URL.c_str(), urlBufLen - 1);
         urlBuf[urlBufLen - 1] = '\0';  // Guarantee nul-termination, even if truncated.
     }
 }
 
+uint64_t servoUnityGetWindowCounter(int windowIndex, int counterID)
+{
+    ServoUnityWindowMap::ReadGuard guard(s_windows);
+    ServoUnityWindow *window = s_windows.get(windowIndex);
+    if (!window) return 0;
+    return window->counter(counterID);
+}
+
+bool servoUnityGetWindowLatencyStats(int windowIndex, int stage, ServoUnityLatencyStats *stats_out)
+{
+    if (!stats_out) return false;
+    ServoUnityWindowMap::ReadGuard guard(s_windows);
+    ServoUnityWindow *window = s_windows.get(windowIndex);
+    if (!window) return false;
+    return window->latencyStats(stage, stats_out);
+}
+
+void servoUnityResetWindowLatencyStats(int windowIndex)
+{
+    ServoUnityWindowMap::ReadGuard guard(s_windows);
+    ServoUnityWindow *window = s_windows.get(windowIndex);
+    if (!window) return;
+    window->resetLatencyStats();
+}
+
+bool servoUnityGetWindowStats(int windowIndex, ServoUnityWindowStats *stats_out)
+{
+    if (!stats_out) return false;
+    ServoUnityWindowMap::ReadGuard guard(s_windows);
+    ServoUnityWindow *window = s_windows.get(windowIndex);
+    if (!window) return false;
+    return window->windowStats(stats_out);
+}
+
+void servoUnityForceWindowTextureRefresh(int windowIndex)
+{
+    ServoUnityWindowMap::ReadGuard guard(s_windows);
+    ServoUnityWindow *window = s_windows.get(windowIndex);
+    if (!window) return;
+    window->forceTextureRefresh();
+}
+
 void servoUnityRequestWindowUpdate(int windowIndex, float timeDelta)
 {
-	auto window_iter = s_windows.find(windowIndex);
-	if (window_iter == s_windows.end()) {
+	ServoUnityWindowMap::ReadGuard guard(s_windows);
+	ServoUnityWindow *window = s_windows.get(windowIndex);
+	if (!window) {
 		SERVOUNITYLOGe("Requested update for non-existent window with index %d.\n", windowIndex);
 		return;
 	}
-	window_iter->second->requestUpdate(timeDelta);
+    if (window->isIdle()) return;
+	window->requestUpdate(timeDelta);
+}
+
+int servoUnityRequestAllWindowsUpdate(float timeDelta, ServoUnityWindowUpdateResult *results, int resultsCapacity)
+{
+    SERVOUNITYTRACE("requestAllWindowsUpdate");
+    int count = 0;
+    ServoUnityWindowMap::ReadGuard guard(s_windows);
+    s_windows.forEach([&](int windowIndex, ServoUnityWindow *window) {
+        bool idle = window->isIdle();
+        uint64_t startNs = idle ? 0 : getTimeNowNs();
+        if (!idle) window->requestUpdate(timeDelta);
+        if (results && count < resultsCapacity) {
+            results[count].windowIndex = windowIndex;
+            results[count].updated = (idle ? 0 : 1);
+            results[count].updateMs = (idle ? 0.0f : (float)((getTimeNowNs() - startNs) / 1e6));
+        }
+        count++;
+    });
+    return count;
+}
+
+void servoUnityPrewarm(int width, int height)
+{
+#ifdef SUPPORT_OPENGL_CORE
+    if (s_RendererType == kUnityGfxRendererOpenGLCore) {
+        SERVOUNITYLOGi("Prewarming Servo at %dx%d.\n", width, height);
+        ServoUnityWindowGL::prewarm(ServoUnityWindow::Size({width, height}));
+        return;
+    }
+#endif // SUPPORT_OPENGL_CORE
+    SERVOUNITYLOGw("Prewarm not supported with this renderer.\n");
 }
 
 void servoUnityCleanupRenderer(int windowIndex)
 {
-    auto window_iter = s_windows.find(windowIndex);
-    if (window_iter == s_windows.end()) {
+    ServoUnityWindowMap::ReadGuard guard(s_windows);
+    ServoUnityWindow *window = s_windows.get(windowIndex);
+    if (!window) {
         SERVOUNITYLOGe("Requested cleanup for non-existent window with index %d.\n", windowIndex);
         return;
     }
-    window_iter->second->cleanupRenderer();
+    window->cleanupRenderer();
 }
 
 void servoUnityWindowPointerEvent(int windowIndex, int eventID, int eventParam0, int eventParam1, int windowX, int windowY)
 {
-	auto window_iter = s_windows.find(windowIndex);
-	if (window_iter == s_windows.end()) return;
+	ServoUnityWindowMap::ReadGuard guard(s_windows);
+	ServoUnityWindow *window = s_windows.get(windowIndex);
+	if (!window) return;
 
-	switch (eventID) {
-	case ServoUnityPointerEventID_Enter:
-		window_iter->second->pointerEnter();
-		break;
-	case ServoUnityPointerEventID_Exit:
-		window_iter->second->pointerExit();
-		break;
-	case ServoUnityPointerEventID_Over:
-		window_iter->second->pointerOver(windowX, windowY);
-		break;
-	case ServoUnityPointerEventID_Press:
-		window_iter->second->pointerPress(eventParam0, windowX, windowY);
-		break;
-	case ServoUnityPointerEventID_Release:
-		window_iter->second->pointerRelease(eventParam0, windowX, windowY);
-		break;
-    case ServoUnityPointerEventID_Click:
-        window_iter->second->pointerClick(eventParam0, windowX, windowY);
-        break;
-	case ServoUnityPointerEventID_ScrollDiscrete:
-		window_iter->second->pointerScrollDiscrete(eventParam0, eventParam1, windowX, windowY);
-		break;
-	default:
-		break;
-	}
+	window->pointerEvent(eventID, eventParam0, eventParam1, windowX, windowY);
+}
+
+int servoUnitySubmitInputEvents(int windowIndex, const ServoUnityInputEvent *events, int count)
+{
+    if (!events || count <= 0) return 0;
+    ServoUnityWindowMap::ReadGuard guard(s_windows);
+    ServoUnityWindow *window = s_windows.get(windowIndex);
+    if (!window) return 0;
+
+    return window->submitInputEvents(events, count);
 }
 
 void servoUnityWindowBrowserControlEvent(int windowIndex, int eventID, int eventParam0, int eventParam1, const char *eventParamS)
 {
-    auto window_iter = s_windows.find(windowIndex);
-    if (window_iter == s_windows.end()) return;
+    ServoUnityWindowMap::ReadGuard guard(s_windows);
+    ServoUnityWindow *window = s_windows.get(windowIndex);
+    if (!window) return;
 
     switch (eventID) {
     case ServoUnityWindowBrowserControlEventID_Refresh:
-        window_iter->second->refresh();
+        window->refresh();
         break;
     case ServoUnityWindowBrowserControlEventID_Reload:
-        window_iter->second->reload();
+        window->reload();
         break;
     case ServoUnityWindowBrowserControlEventID_Stop:
-        window_iter->second->stop();
+        window->stop();
         break;
     case ServoUnityWindowBrowserControlEventID_GoBack:
-        window_iter->second->goBack();
+        window->goBack();
         break;
     case ServoUnityWindowBrowserControlEventID_GoForward:
-        window_iter->second->goForward();
+        window->goForward();
         break;
     case ServoUnityWindowBrowserControlEventID_GoHome:
-        window_iter->second->goHome();
+        window->goHome();
         break;
     case ServoUnityWindowBrowserControlEventID_Navigate:
-        window_iter->second->navigate(std::string(eventParamS));
+        window->navigate(std::string(eventParamS));
         break;
     default:
         break;
@@ -96,6 +96,12 @@
 
 #define HOMEPAGE_DEFAULT "https://servo.org/"
 #define SEARCH_URI_DEFAULT "https://www.google.com/search?client=firefox-b-d&q="
+#define SERVO_LOG_RATE_LIMIT_DEFAULT 1000
+#ifdef __APPLE__
+#  define LIBRARY_COPIES_MAX_DEFAULT 0 // No RTLD_DEEPBIND, so a copy's calls to its own exports may bind to the original.
+#else
+#  define LIBRARY_COPIES_MAX_DEFAULT 3
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -292,20 +298,148 @@ SERVO_UNITY_EXTERN void servoUnityServiceWindowEvents(int windowIndex);
 
 SERVO_UNITY_EXTERN void servoUnityGetWindowMetadata(int windowIndex, char *titleBuf, int titleBufLen, char *urlBuf, int urlBufLen);
 
+enum {
+    ServoUnityWindowCounter_PointerMovesCoalesced = 0, // Total pointer move events merged into a later move before reaching Servo.
+    ServoUnityWindowCounter_ScrollsCoalesced = 1, // Total scroll events merged into a later scroll at the same position before reaching Servo.
+    ServoUnityWindowCounter_InputEventsCoalescedLastFrame = 2, // Input events merged during the most recent window update.
+    ServoUnityWindowCounter_LatencySamplesDropped = 3, // Input events not included in latency statistics because too many were awaiting a texture fill.
+    ServoUnityWindowCounter_TasksDeferred = 4, // Total times a queued task was carried over to the next window update because the per-frame task budget was exhausted.
+    ServoUnityWindowCounter_TasksDeferredLastFrame = 5, // Tasks carried over by the most recent window update.
+    ServoUnityWindowCounter_TextureFillsPerformed = 6, // Window updates which copied Servo's frame into the Unity texture.
+    ServoUnityWindowCounter_TextureFillsSkipped = 7, // Window updates which skipped the copy because nothing had changed. Updates of idle windows return before this point and are not counted.
+    ServoUnityWindowCounter_TimeToFirstFrameUs = 8, // Microseconds from window creation to the first texture fill following a Servo update, or 0 if that hasn't happened yet.
+    ServoUnityWindowCounter_Max
+};
+
+///
+/// Read one of the window's performance counters.
+/// @param counterID One of the ServoUnityWindowCounter_* values.
+/// @return The counter value, or 0 if the window or counter does not exist.
+///
+SERVO_UNITY_EXTERN uint64_t servoUnityGetWindowCounter(int windowIndex, int counterID);
+
+///
+/// Stages of input latency. Each input event (pointer or key) is timestamped when it is queued,
+/// when it is dispatched to Servo, when perform_updates next runs, and when the next texture fill
+/// after that completes. All times are taken from a monotonic clock.
+///
+enum {
+    ServoUnityLatencyStage_Queue = 0, // Queued to dispatched to Servo.
+    ServoUnityLatencyStage_Update = 1, // Dispatched to the next perform_updates.
+    ServoUnityLatencyStage_Fill = 2, // perform_updates to completion of the next texture fill.
+    ServoUnityLatencyStage_Total = 3, // Queued to completion of the texture fill, i.e. input to pixels in the Unity texture.
+    ServoUnityLatencyStage_Max
+};
+
+typedef struct {
+    uint64_t count; // Number of samples.
+    float p50Ms;
+    float p95Ms;
+    float p99Ms;
+    float maxMs;
+} ServoUnityLatencyStats;
+
+///
+/// Get latency percentiles for one stage of the window's input handling, accumulated since the window
+/// was created or since the last call to servoUnityResetWindowLatencyStats.
+/// Percentiles are accurate to within 12.5%. Safe to call from any thread.
+/// @param stage One of the ServoUnityLatencyStage_* values.
+/// @return true if stats_out was filled, false if the window or stage does not exist or does not collect latency statistics.
+///
+SERVO_UNITY_EXTERN bool servoUnityGetWindowLatencyStats(int windowIndex, int stage, ServoUnityLatencyStats *stats_out);
+
+SERVO_UNITY_EXTERN void servoUnityResetWindowLatencyStats(int windowIndex);
+
+///
+/// Frame statistics for a window, accumulated since the window was created.
+/// Times are in microseconds, from a monotonic clock. Updates of idle windows return before reaching
+/// the window and are not counted.
+///
+typedef struct {
+    uint64_t renderEvents;           // Window updates (servoUnityRequestWindowUpdate or render event 1) processed.
+    uint64_t framesSkipped;          // Window updates which didn't copy Servo's frame into the Unity texture, because nothing had changed.
+    uint64_t performUpdatesCount;    // Calls to Servo's perform_updates.
+    uint64_t performUpdatesTotalUs;
+    uint64_t performUpdatesMaxUs;
+    uint64_t fillCount;              // Copies of Servo's frame into the Unity texture.
+    uint64_t fillTotalUs;
+    uint64_t fillMaxUs;
+    uint64_t taskQueueDepth;         // Tasks (input, navigation etc.) waiting to be passed to Servo, including any deferred by the per-frame task budget.
+    uint64_t taskQueueHighWater;     // Greatest taskQueueDepth seen by a window update.
+    uint64_t browserEventQueueDepth; // Browser events waiting for servoUnityServiceWindowEvents.
+    uint64_t wakeups;                // Requests from Servo for a call to perform_updates.
+    double wakeupsPerSecond;         // Wakeup rate, averaged over the most recent period of at least one second ending at a window update.
+} ServoUnityWindowStats;
+
+///
+/// Get frame statistics for a window. Cheap enough to call every frame. Safe to call from any thread.
+/// @return true if stats_out was filled, false if the window does not exist or does not collect statistics.
+///
+SERVO_UNITY_EXTERN bool servoUnityGetWindowStats(int windowIndex, ServoUnityWindowStats *stats_out);
+
 
 ///
 /// Must be called from rendering thread with active rendering context.
 /// As an alternative to invoking directly, an equivalent invocation can be invoked via call this sequence:
+///     data->windowIndex = windowIndex; data->timeDelta = timeDelta; data->frame = frame;
+///     (*GetRenderEventAndDataFunc())(1, data);
+/// or, for a single window only:
 ///     servoUnitySetRenderEventFunc1Params(windowIndex, timeDelta);
 ///     (*GetRenderEventFunc())(1);
 ///
 SERVO_UNITY_EXTERN void servoUnityRequestWindowUpdate(int windowIndex, float timeDelta);
 
+typedef struct {
+    int32_t windowIndex;
+    int32_t updated;  // 1 if the window was updated, 0 if it was idle and skipped.
+    float updateMs;   // Time taken by the window's update.
+} ServoUnityWindowUpdateResult;
+
 ///
+/// Update every window in one pass, as if by servoUnityRequestWindowUpdate() on each in turn.
 /// Must be called from rendering thread with active rendering context.
 /// As an alternative to invoking directly, an equivalent invocation can be invoked via call this sequence:
+///     data->timeDelta = timeDelta; data->frame = frame; data->results = results; data->resultsCapacity = resultsCapacity;
+///     (*GetRenderEventAndDataFunc())(4, data);
+/// which needs only one render event (and so only one invalidation of the caller's graphics state) per frame,
+/// however many windows there are.
+/// @param results If non-NULL, receives one entry per window, up to resultsCapacity entries.
+/// @return The number of windows, which may exceed resultsCapacity.
+///
+SERVO_UNITY_EXTERN int servoUnityRequestAllWindowsUpdate(float timeDelta, ServoUnityWindowUpdateResult *results, int resultsCapacity);
+
+///
+/// Parameters for render event 4 (update all windows). Owned by the caller, and must not be modified or freed
+/// until the event has run, which the caller can detect by resultsFrame becoming equal to frame.
+///
+typedef struct {
+    float timeDelta;
+    int32_t resultsCapacity;               // Number of entries in results.
+    uint64_t frame;                        // Caller's frame number. Must not decrease from one render event to the next.
+    uint64_t resultsFrame;                 // Set to frame by the render thread, after windowCount and results. Caller should set it to something else before issuing the event.
+    int32_t windowCount;                   // Set by the render thread. Entries written to results is the lesser of this and resultsCapacity.
+    int32_t reserved;
+    ServoUnityWindowUpdateResult *results; // May be NULL.
+} ServoUnityUpdateAllWindowsData;
+
+///
+/// Window updates only copy Servo's frame into the Unity texture when Servo has been updated, tasks have been
+/// passed to Servo, or the texture or window size has changed. Call this to force a copy on the next update,
+/// e.g. if the texture contents have been overwritten by something other than the plugin.
+///
+SERVO_UNITY_EXTERN void servoUnityForceWindowTextureRefresh(int windowIndex);
+
+///
+/// Must be called from rendering thread with active rendering context.
+/// As an alternative to invoking directly, an equivalent invocation can be invoked via call this sequence:
+///     data->windowIndex = windowIndex; data->frame = frame;
+///     (*GetRenderEventAndDataFunc())(2, data);
+/// or, for a single window only:
 ///     servoUnitySetRenderEventFunc2Param(windowIndex);
 ///     (*GetRenderEventFunc())(2);
+/// Cleanup does not block. It begins browser shutdown, which then advances by a bounded amount on each
+/// subsequent window update (servoUnityRequestWindowUpdate), so the caller must keep requesting updates
+/// until the window delivers ServoUnityBrowserEvent_Shutdown via the browser event callback.
 ///
 SERVO_UNITY_EXTERN void servoUnityCleanupRenderer(int windowIndex);
 
@@ -313,6 +447,48 @@ SERVO_UNITY_EXTERN void servoUnitySetRenderEventFunc1Params(int windowIndex, flo
 
 SERVO_UNITY_EXTERN void servoUnitySetRenderEventFunc2Param(int windowIndex);
 
+///
+/// Start the browser engine before any window needs it, e.g. during a loading screen, so that the first
+/// window's first update doesn't stall while the engine boots. The first window to update adopts the engine,
+/// resizing it if the window size differs from the prewarm size.
+/// Must be called from rendering thread with active rendering context.
+/// As an alternative to invoking directly, an equivalent invocation can be invoked via call this sequence:
+///     data->width = width; data->height = height; data->frame = frame;
+///     (*GetRenderEventAndDataFunc())(3, data);
+/// or:
+///     servoUnitySetRenderEventFunc3Params(width, height);
+///     (*GetRenderEventFunc())(3);
+///
+SERVO_UNITY_EXTERN void servoUnityPrewarm(int width, int height);
+
+SERVO_UNITY_EXTERN void servoUnitySetRenderEventFunc3Params(int width, int height);
+
+///
+/// Parameters for one render event issued via the function returned by GetRenderEventAndDataFunc(), e.g. with
+/// Unity's GL.IssuePluginEventAndData(). Unlike servoUnitySetRenderEventFunc*Param(s), which set parameters
+/// shared by all events, each event carries its own, so events for any number of windows may be issued in one
+/// frame. Event 1 (update) uses windowIndex and timeDelta, event 2 (cleanup) windowIndex, and event 3 (prewarm)
+/// width and height. Event 4 (update all windows) takes a ServoUnityUpdateAllWindowsData instead.
+///
+typedef struct {
+    int32_t windowIndex;
+    float timeDelta;
+    uint64_t frame;   // Caller's frame number. Must not decrease from one event to the next.
+    int32_t width;
+    int32_t height;
+} ServoUnityRenderEventData;
+
+#define SERVO_UNITY_RENDER_EVENT_DATA_POOL_SIZE 256
+
+///
+/// Get the plugin's pool of render event parameter slots. The pool lives as long as the plugin is loaded, so it
+/// can be fetched once and its slots then filled directly, in rotation, with no further calls into the plugin.
+/// A slot must not be refilled until the render thread has run the event it was issued with. As the render
+/// thread runs at most one frame behind, it is enough to use no more than half the pool per frame.
+/// If slots are refilled too early, the plugin logs a warning when it sees the frame number go backwards.
+///
+SERVO_UNITY_EXTERN ServoUnityRenderEventData *servoUnityGetRenderEventDataPool(int *count_out);
+
 
 enum {
 	ServoUnityPointerEventID_Enter = 0,
@@ -336,6 +512,33 @@ enum {
 
 SERVO_UNITY_EXTERN void servoUnityWindowPointerEvent(int windowIndex, int eventParam0, int eventParam1, int eventID, int windowX, int windowY);
 
+enum {
+    ServoUnityInputEventType_Pointer = 0,
+    ServoUnityInputEventType_Key = 1
+};
+
+///
+/// A single input event, for submission in bulk via servoUnitySubmitInputEvents.
+/// The layout is fixed (32 bytes, no padding) so that arrays can be passed directly from managed code.
+///
+typedef struct {
+    int64_t timestamp; // Caller-supplied event time, e.g. in microseconds. Not interpreted by the plugin; events are processed in array order.
+    int32_t type;      // ServoUnityInputEventType_*.
+    int32_t eventID;   // Pointer: ServoUnityPointerEventID_*. Key: 1 for key down, 0 for key up.
+    int32_t param0;    // Pointer: as eventParam0 of servoUnityWindowPointerEvent. Key: ServoUnityKeyCode_*.
+    int32_t param1;    // Pointer: as eventParam1 of servoUnityWindowPointerEvent. Key: character.
+    int32_t windowX;   // Pointer only.
+    int32_t windowY;   // Pointer only.
+} ServoUnityInputEvent;
+
+///
+/// Submit a batch of pointer and/or key events to a window in a single call.
+/// Equivalent to calling servoUnityWindowPointerEvent/servoUnityKeyEvent once per event, in order,
+/// but with a single window lookup and with events queued in bulk.
+/// @return The number of events accepted. Fewer than count are accepted only if the window's event queue is full.
+///
+SERVO_UNITY_EXTERN int servoUnitySubmitInputEvents(int windowIndex, const ServoUnityInputEvent *events, int count);
+
 enum {
     ServoUnityWindowBrowserControlEventID_Refresh = 0,
     ServoUnityWindowBrowserControlEventID_Reload = 1,
@@ -353,6 +556,16 @@ enum {
 	ServoUnityParam_b_CloseNativeWindowOnClose = 0,
     ServoUnityParam_s_SearchURI = 1,
     ServoUnityParam_s_Homepage = 2,
+    ServoUnityParam_i_MaxServoTasksPerFrame = 3, // Maximum queued tasks (input, navigation etc.) passed to Servo per window update. 0 (the default) means no limit.
+    ServoUnityParam_f_ServoTaskTimeBudgetMs = 4, // Time in milliseconds after which no more queued tasks are passed to Servo in a window update. 0.0 (the default) means no limit.
+    ServoUnityParam_b_Trace = 5, // Record a trace of plugin activity, for servoUnityWriteTrace. Setting to true discards any previous trace. Default false.
+    ServoUnityParam_b_LogDeferredFormatting = 6, // Format log output from non-Unity threads when it is flushed by servoUnityFlushLog, rather than when it is logged. Default false.
+    ServoUnityParam_i_LogRateLimit = 7, // Maximum log messages per second from any one place in the plugin. Further messages are counted and the count logged. 0 means no limit. Default 100.
+    ServoUnityParam_s_ServoLogModules = 8, // Comma-separated list of Servo modules to log from, e.g. "constellation,script::dom::bindings::error". Empty (the default) means all modules. Takes effect when Servo is next started.
+    ServoUnityParam_s_ServoLogLevel = 9, // Servo's log level: "error", "warn", "info", "debug" or "trace". Empty (the default) follows servoUnitySetLogLevel. Takes effect when Servo is next started.
+    ServoUnityParam_s_RemoteHost = 10, // Path to servo_unity_remote_host. If set, each window started afterwards runs Servo in its own child process, rather than in Unity's. Empty (the default) means in-process. Linux only.
+    ServoUnityParam_i_ServoLogRateLimit = 11, // Maximum lines per second of Servo's own log output, from all windows together, in place of ServoUnityParam_i_LogRateLimit. 0 means no limit. Default 1000.
+    ServoUnityParam_i_MaxLibraryCopies = 12, // Maximum copies of the simpleservo library loaded to run in-process windows beyond the first. Each costs the library's size in memory (and on Windows, temporary disk space), and is kept until exit. Default 3, or 0 on macOS.
 	ServoUnityParam_Max
 };
 
@@ -365,6 +578,15 @@ SERVO_UNITY_EXTERN int servoUnityGetParamInt(int param);
 SERVO_UNITY_EXTERN float servoUnityGetParamFloat(int param);
 SERVO_UNITY_EXTERN void servoUnityGetParamString(int param, char *sbuf, int sbufLen);
 
+///
+/// Write the trace recorded since ServoUnityParam_b_Trace was last set to true, as a Chrome trace_event JSON
+/// file which can be loaded into chrome://tracing or https://ui.perfetto.dev. Spans cover window updates,
+/// perform_updates, task dispatch, texture fills, window event servicing, renderer cleanup, and Servo's
+/// callbacks, on whichever thread they ran. Tracing may be stopped or left running while writing.
+/// @return true if the file was written.
+///
+SERVO_UNITY_EXTERN bool servoUnityWriteTrace(const char *path);
+
 
 #ifdef __cplusplus
 }
@@ -15,10 +15,23 @@
 
 #pragma once
 #include <string>
+#include <atomic>
+#include <mutex>
 
 // --------------------------------------------------------------------------
 //  Configuration parameters
 
 extern bool s_param_CloseNativeWindowOnClose;
+// The string parameters are set on Unity's main thread but read on the render thread,
+// so are guarded by s_param_StringsLock. Read them via servoUnityCopyParamString().
+extern std::mutex s_param_StringsLock;
+std::string servoUnityCopyParamString(const std::string& param);
 extern std::string s_param_SearchURI;
 extern std::string s_param_Homepage;
+extern std::string s_param_ServoLogModules;
+extern std::string s_param_ServoLogLevel;
+extern std::string s_param_RemoteHost;
+extern std::atomic<int> s_param_MaxServoTasksPerFrame; // Read on render thread.
+extern std::atomic<int> s_param_MaxLibraryCopies; // Read on render thread.
+extern int s_param_ServoLogRateLimit; // Read by the log, as servoUnityLogSiteLimitPerSecond is.
+extern std::atomic<float> s_param_ServoTaskTimeBudgetMs; // Read on render thread.
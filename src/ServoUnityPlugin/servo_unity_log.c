@@ -11,6 +11,10 @@
 //
 
 #include "servo_unity_log.h"
+#include <stddef.h> // ptrdiff_t
+#include <stdint.h>
+#include <inttypes.h>
+#include "utils.h" // getTimeNowNs()
 
 #ifndef _WIN32
 #  include <pthread.h> // pthread_self(), pthread_equal()
@@ -36,14 +40,485 @@ static pthread_t servoUnityLogLoggerThread;
 #else
 static DWORD servoUnityLogLoggerThreadID;
 #endif
-#define SERVO_UNITY_LOG_WRONG_THREAD_BUFFER_SIZE 4096
-static char *servoUnityLogWrongThreadBuffer = NULL;
-static size_t servoUnityLogWrongThreadBufferSize = 0;
-static size_t servoUnityLogWrongThreadBufferCount = 0;
 
+//
+// Messages logged on a thread other than the logger thread are queued in a
+// fixed-size ring (a bounded multi-producer, single-consumer queue) until the
+// logger thread next logs or calls servoUnityLogFlush(). Producers claim a
+// record with a compare-and-swap and format directly into it, so logging
+// never allocates or takes a lock. If the ring is full the message is dropped,
+// and if it is longer than a record it is truncated; both are counted and
+// reported at the next flush.
+//
+// With deferred formatting on, a producer instead stores the format string
+// pointer and the raw argument values (and copies of any %s strings), and the
+// text is only formatted when the record is drained on the logger thread.
+// Formats must therefore remain valid until the next flush, which is the
+// case for the string literals used throughout the plugin. Formats using
+// conversions that can't be deferred (%n, %ls, %Lf etc.) are formatted
+// immediately as usual.
+//
+#define SERVO_UNITY_LOG_RING_RECORDS 256 // Must be a power of 2.
+#define SERVO_UNITY_LOG_RECORD_SIZE 1024 // Including level prefix and nul-terminator.
+
+#ifdef _MSC_VER
+typedef volatile LONG64 servoUnityLogAtomic;
+#  define LOG_ATOMIC_LOAD(p) ((uint64_t)InterlockedCompareExchange64((p), 0, 0))
+#  define LOG_ATOMIC_STORE(p, v) InterlockedExchange64((p), (LONG64)(v))
+#  define LOG_ATOMIC_CAS(p, expected, desired) (InterlockedCompareExchange64((p), (LONG64)(desired), (LONG64)(expected)) == (LONG64)(expected))
+#  define LOG_ATOMIC_INC(p) (InterlockedIncrement64(p) - 1) // Previous value, as __atomic_fetch_add.
+#  define LOG_ATOMIC_EXCHANGE(p, v) ((uint64_t)InterlockedExchange64((p), (LONG64)(v)))
+#else
+typedef uint64_t servoUnityLogAtomic;
+#  define LOG_ATOMIC_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#  define LOG_ATOMIC_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#  define LOG_ATOMIC_CAS(p, expected, desired) __extension__({ uint64_t e_ = (expected); __atomic_compare_exchange_n((p), &e_, (desired), 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED); })
+#  define LOG_ATOMIC_INC(p) __atomic_fetch_add((p), 1, __ATOMIC_RELAXED)
+#  define LOG_ATOMIC_EXCHANGE(p, v) __atomic_exchange_n((p), (v), __ATOMIC_RELAXED)
+#endif
+
+typedef struct {
+	servoUnityLogAtomic seq; // == position when free for the producer claiming it, position + 1 when ready for the consumer.
+	const char *format; // If non-NULL, data holds deferred arguments for this format, otherwise formatted text.
+	int level;
+	char data[SERVO_UNITY_LOG_RECORD_SIZE];
+} servoUnityLogRecord;
+
+static servoUnityLogRecord servoUnityLogRing[SERVO_UNITY_LOG_RING_RECORDS];
+static servoUnityLogAtomic servoUnityLogRingEnqueuePos = 0;
+static uint64_t servoUnityLogRingDequeuePos = 0; // Logger thread only.
+static servoUnityLogAtomic servoUnityLogRingDropped = 0;
+static servoUnityLogAtomic servoUnityLogRingTruncated = 0;
+static int servoUnityLogDeferredFormatting = 0;
+
+int servoUnityLogSiteLimitPerSecond = SERVO_UNITY_LOG_SITE_LIMIT_PER_SECOND_DEFAULT;
+
+// Collapsing of repeated messages. Logger thread only.
+#define SERVO_UNITY_LOG_REPEAT_REPORT_NS 1000000000ull
+static char servoUnityLogLastMessage[SERVO_UNITY_LOG_RECORD_SIZE];
+static size_t servoUnityLogLastMessageLen = 0;
+static uint64_t servoUnityLogRepeats = 0;
+static uint64_t servoUnityLogFirstRepeatNs = 0;
+
+static void servoUnityLogRingInit(void)
+{
+	static int inited = 0;
+	int i;
+	if (inited) return;
+	for (i = 0; i < SERVO_UNITY_LOG_RING_RECORDS; i++) LOG_ATOMIC_STORE(&servoUnityLogRing[i].seq, (uint64_t)i);
+	inited = 1;
+}
+
+static const char *logLevelStrings[] = {
+	"[debug] ",
+	"[info] ",
+	"[warning] ",
+	"[error] "
+};
+static const int logLevelStringsCount = (int)(sizeof(logLevelStrings) / sizeof(logLevelStrings[0]));
+
+// Formats the level prefix and message into buf, always nul-terminating.
+// Returns the length the whole message would have had, or 0 on a formatting error.
+static size_t servoUnityLogFormat(char *buf, size_t bufSize, const int logLevel, const char *format, va_list ap)
+{
+	size_t prefixLen = 0;
+	int len;
+
+	if (logLevel >= 0 && logLevel < logLevelStringsCount) {
+		prefixLen = strlen(logLevelStrings[logLevel]);
+		if (prefixLen >= bufSize) prefixLen = bufSize - 1;
+		memcpy(buf, logLevelStrings[logLevel], prefixLen);
+	}
+	buf[prefixLen] = '\0';
+	len = vsnprintf(buf + prefixLen, bufSize - prefixLen, format, ap);
+	if (len < 0) return 0;
+	return (prefixLen + (size_t)len);
+}
+
+//
+// Deferred formatting.
+//
+
+enum {
+	LOG_LENGTH_NONE = 0,
+	LOG_LENGTH_HH,
+	LOG_LENGTH_H,
+	LOG_LENGTH_L,
+	LOG_LENGTH_LL,
+	LOG_LENGTH_J,
+	LOG_LENGTH_Z,
+	LOG_LENGTH_T
+};
+
+typedef struct {
+	char text[32]; // The conversion specification, nul-terminated, e.g. "%-8.3f".
+	int widthStar;
+	int precisionStar;
+	int precision; // -1 if none given, or given as '*'.
+	int length;
+	char conversion;
+} servoUnityLogSpec;
+
+// Parses the conversion specification starting at the '%' at p.
+// Returns a pointer to the character following it, or NULL if it can't be deferred.
+static const char *servoUnityLogParseSpec(const char *p, servoUnityLogSpec *spec)
+{
+	const char *q = p + 1;
+	size_t len;
+
+	while (*q && strchr("-+ #0", *q)) q++;
+	spec->widthStar = 0;
+	if (*q == '*') {
+		spec->widthStar = 1;
+		q++;
+	} else {
+		while (*q >= '0' && *q <= '9') q++;
+	}
+	spec->precisionStar = 0;
+	spec->precision = -1;
+	if (*q == '.') {
+		q++;
+		if (*q == '*') {
+			spec->precisionStar = 1;
+			q++;
+		} else {
+			spec->precision = 0;
+			while (*q >= '0' && *q <= '9') spec->precision = spec->precision*10 + (*q++ - '0');
+		}
+	}
+	switch (*q) {
+	case 'h': q++; if (*q == 'h') { q++; spec->length = LOG_LENGTH_HH; } else spec->length = LOG_LENGTH_H; break;
+	case 'l': q++; if (*q == 'l') { q++; spec->length = LOG_LENGTH_LL; } else spec->length = LOG_LENGTH_L; break;
+	case 'j': q++; spec->length = LOG_LENGTH_J; break;
+	case 'z': q++; spec->length = LOG_LENGTH_Z; break;
+	case 't': q++; spec->length = LOG_LENGTH_T; break;
+	default: spec->length = LOG_LENGTH_NONE; break;
+	}
+	spec->conversion = *q;
+	if (!*q || !strchr("diuoxXcspfFeEgGaA%", *q)) return NULL;
+	if ((*q == 'c' || *q == 's' || *q == 'p') && spec->length != LOG_LENGTH_NONE) return NULL; // Wide characters.
+	q++;
+	len = (size_t)(q - p);
+	if (len >= sizeof(spec->text)) return NULL;
+	memcpy(spec->text, p, len);
+	spec->text[len] = '\0';
+	return q;
+}
+
+static int servoUnityLogPut(char *data, size_t *offset, const void *value, size_t size)
+{
+	if (*offset + size > SERVO_UNITY_LOG_RECORD_SIZE) return 0;
+	memcpy(data + *offset, value, size);
+	*offset += size;
+	return 1;
+}
+
+static void servoUnityLogGet(const char *data, size_t *offset, void *value, size_t size)
+{
+	memcpy(value, data + *offset, size);
+	*offset += size;
+}
+
+// Stores the arguments for format in the record. Returns 0 if the format can't be deferred, or the arguments don't fit.
+static int servoUnityLogEncode(servoUnityLogRecord *record, const char *format, va_list ap)
+{
+	servoUnityLogSpec spec;
+	const char *p = format;
+	size_t offset = 0;
+	int ok = 1;
+	va_list ap2;
+
+	va_copy(ap2, ap);
+	while (ok && (p = strchr(p, '%'))) {
+		int64_t i;
+		uint64_t u;
+		double d;
+		int precision;
+		if (!(p = servoUnityLogParseSpec(p, &spec))) { ok = 0; break; }
+		if (spec.conversion == '%') continue;
+		if (spec.widthStar) { i = va_arg(ap2, int); ok = ok && servoUnityLogPut(record->data, &offset, &i, sizeof(i)); }
+		precision = spec.precision;
+		if (spec.precisionStar) { i = precision = va_arg(ap2, int); ok = ok && servoUnityLogPut(record->data, &offset, &i, sizeof(i)); }
+		switch (spec.conversion) {
+		case 'd': case 'i':
+			switch (spec.length) {
+			case LOG_LENGTH_L: i = va_arg(ap2, long); break;
+			case LOG_LENGTH_LL: i = va_arg(ap2, long long); break;
+			case LOG_LENGTH_J: i = va_arg(ap2, intmax_t); break;
+			case LOG_LENGTH_Z: case LOG_LENGTH_T: i = va_arg(ap2, ptrdiff_t); break;
+			default: i = va_arg(ap2, int); break;
+			}
+			ok = ok && servoUnityLogPut(record->data, &offset, &i, sizeof(i));
+			break;
+		case 'u': case 'o': case 'x': case 'X':
+			switch (spec.length) {
+			case LOG_LENGTH_L: u = va_arg(ap2, unsigned long); break;
+			case LOG_LENGTH_LL: u = va_arg(ap2, unsigned long long); break;
+			case LOG_LENGTH_J: u = va_arg(ap2, uintmax_t); break;
+			case LOG_LENGTH_Z: u = va_arg(ap2, size_t); break;
+			case LOG_LENGTH_T: u = (uint64_t)va_arg(ap2, ptrdiff_t); break;
+			default: u = va_arg(ap2, unsigned int); break;
+			}
+			ok = ok && servoUnityLogPut(record->data, &offset, &u, sizeof(u));
+			break;
+		case 'c':
+			i = va_arg(ap2, int);
+			ok = ok && servoUnityLogPut(record->data, &offset, &i, sizeof(i));
+			break;
+		case 'p':
+			u = (uint64_t)(uintptr_t)va_arg(ap2, void *);
+			ok = ok && servoUnityLogPut(record->data, &offset, &u, sizeof(u));
+			break;
+		case 's': {
+			const char *s = va_arg(ap2, const char *);
+			size_t len;
+			if (!s) s = "(null)";
+			len = strlen(s);
+			if (precision >= 0 && (size_t)precision < len) len = (size_t)precision;
+			ok = ok && servoUnityLogPut(record->data, &offset, s, len) && servoUnityLogPut(record->data, &offset, "", 1);
+			break;
+		}
+		default: // Floating point.
+			d = va_arg(ap2, double);
+			ok = ok && servoUnityLogPut(record->data, &offset, &d, sizeof(d));
+			break;
+		}
+	}
+	va_end(ap2);
+	if (ok) record->format = format;
+	return ok;
+}
+
+#define LOG_SNPRINTF(value) (spec.widthStar && spec.precisionStar ? snprintf(out + pos, room, spec.text, (int)width, (int)precision, value) : \
+	spec.widthStar ? snprintf(out + pos, room, spec.text, (int)width, value) : \
+	spec.precisionStar ? snprintf(out + pos, room, spec.text, (int)precision, value) : \
+	snprintf(out + pos, room, spec.text, value))
+
+// Formats a deferred record into out, always nul-terminating.
+// Returns the length the whole message would have had, or at least outSize if truncated.
+static size_t servoUnityLogDecode(const servoUnityLogRecord *record, char *out, size_t outSize)
+{
+	servoUnityLogSpec spec;
+	const char *p = record->format;
+	size_t pos = 0, offset = 0;
+
+	if (record->level >= 0 && record->level < logLevelStringsCount) {
+		pos = strlen(logLevelStrings[record->level]);
+		memcpy(out, logLevelStrings[record->level], pos);
+	}
+	while (*p) {
+		const char *next = strchr(p, '%');
+		size_t literalLen = (next ? (size_t)(next - p) : strlen(p));
+		size_t room;
+		int64_t width = 0, precision = 0;
+		int n;
+		if (literalLen) {
+			if (pos + literalLen >= outSize) { pos = outSize; break; }
+			memcpy(out + pos, p, literalLen);
+			pos += literalLen;
+		}
+		if (!next) break;
+		p = servoUnityLogParseSpec(next, &spec); // Succeeded when encoding.
+		room = outSize - pos;
+		if (spec.conversion == '%') {
+			if (room < 2) { pos = outSize; break; }
+			out[pos++] = '%';
+			continue;
+		}
+		if (spec.widthStar) servoUnityLogGet(record->data, &offset, &width, sizeof(width));
+		if (spec.precisionStar) servoUnityLogGet(record->data, &offset, &precision, sizeof(precision));
+		switch (spec.conversion) {
+		case 'd': case 'i': {
+			int64_t i;
+			servoUnityLogGet(record->data, &offset, &i, sizeof(i));
+			switch (spec.length) {
+			case LOG_LENGTH_L: n = LOG_SNPRINTF((long)i); break;
+			case LOG_LENGTH_LL: n = LOG_SNPRINTF((long long)i); break;
+			case LOG_LENGTH_J: n = LOG_SNPRINTF((intmax_t)i); break;
+			case LOG_LENGTH_Z: case LOG_LENGTH_T: n = LOG_SNPRINTF((ptrdiff_t)i); break;
+			default: n = LOG_SNPRINTF((int)i); break;
+			}
+			break;
+		}
+		case 'u': case 'o': case 'x': case 'X': {
+			uint64_t u;
+			servoUnityLogGet(record->data, &offset, &u, sizeof(u));
+			switch (spec.length) {
+			case LOG_LENGTH_L: n = LOG_SNPRINTF((unsigned long)u); break;
+			case LOG_LENGTH_LL: n = LOG_SNPRINTF((unsigned long long)u); break;
+			case LOG_LENGTH_J: n = LOG_SNPRINTF((uintmax_t)u); break;
+			case LOG_LENGTH_Z: n = LOG_SNPRINTF((size_t)u); break;
+			case LOG_LENGTH_T: n = LOG_SNPRINTF((ptrdiff_t)u); break;
+			default: n = LOG_SNPRINTF((unsigned int)u); break;
+			}
+			break;
+		}
+		case 'c': {
+			int64_t i;
+			servoUnityLogGet(record->data, &offset, &i, sizeof(i));
+			n = LOG_SNPRINTF((int)i);
+			break;
+		}
+		case 'p': {
+			uint64_t u;
+			servoUnityLogGet(record->data, &offset, &u, sizeof(u));
+			n = LOG_SNPRINTF((void *)(uintptr_t)u);
+			break;
+		}
+		case 's': {
+			const char *s = record->data + offset;
+			offset += strlen(s) + 1;
+			n = LOG_SNPRINTF(s);
+			break;
+		}
+		default: {
+			double d;
+			servoUnityLogGet(record->data, &offset, &d, sizeof(d));
+			n = LOG_SNPRINTF(d);
+			break;
+		}
+		}
+		if (n < 0 || (size_t)n >= room) { pos = outSize; break; } // _snprintf returns -1 on truncation.
+		pos += (size_t)n;
+	}
+	out[pos < outSize ? pos : outSize - 1] = '\0';
+	return pos;
+}
+
+// Copies the level prefix and length bytes of buffer into buf, appending a newline if
+// buffer doesn't end with one, and always nul-terminating.
+// Returns the length the whole message would have had.
+static size_t servoUnityLogCopy(char *buf, size_t bufSize, const int logLevel, const char *buffer, size_t length)
+{
+	size_t prefixLen = 0, total, n;
+	int newline = (length == 0 || buffer[length - 1] != '\n');
+
+	if (logLevel >= 0 && logLevel < logLevelStringsCount) {
+		prefixLen = strlen(logLevelStrings[logLevel]);
+		if (prefixLen >= bufSize) prefixLen = bufSize - 1;
+		memcpy(buf, logLevelStrings[logLevel], prefixLen);
+	}
+	total = prefixLen + length + newline;
+	n = (total < bufSize ? total : bufSize - 1); // Length to output.
+	if (n > prefixLen) memcpy(buf + prefixLen, buffer, (n - prefixLen < length ? n - prefixLen : length));
+	if (newline && n == total) buf[n - 1] = '\n';
+	buf[n] = '\0';
+	return total;
+}
+
+static int servoUnityLogIsLoggerThread(void)
+{
+#ifndef _WIN32
+	return pthread_equal(pthread_self(), servoUnityLogLoggerThread);
+#else
+	return (GetCurrentThreadId() == servoUnityLogLoggerThreadID);
+#endif
+}
+
+static void servoUnityLogReportRepeats(void)
+{
+	char buf[64];
+	if (!servoUnityLogRepeats) return;
+	snprintf(buf, sizeof(buf), "Last message repeated %" PRIu64 " times.\n", servoUnityLogRepeats);
+	buf[sizeof(buf) - 1] = '\0';
+	servoUnityLogRepeats = 0;
+	if (servoUnityLogLoggerCallback) (*servoUnityLogLoggerCallback)(buf);
+}
+
+// Passes a message to the callback, unless it repeats the previous one. Logger thread only.
+static void servoUnityLogDeliver(const char *msg)
+{
+	size_t len = strlen(msg);
+	if (len == servoUnityLogLastMessageLen && memcmp(msg, servoUnityLogLastMessage, len) == 0) {
+		if (!servoUnityLogRepeats++) servoUnityLogFirstRepeatNs = getTimeNowNs();
+		return;
+	}
+	servoUnityLogReportRepeats();
+	if (servoUnityLogLoggerCallback) (*servoUnityLogLoggerCallback)(msg);
+	if (len < sizeof(servoUnityLogLastMessage)) {
+		memcpy(servoUnityLogLastMessage, msg, len + 1);
+		servoUnityLogLastMessageLen = len;
+	} else {
+		servoUnityLogLastMessageLen = (size_t)-1; // Too long to compare; never matches.
+	}
+}
+
+// Claims the next free record for writing, or returns NULL if the ring is full.
+// The record must then be passed to servoUnityLogRingPublish. Any thread.
+static servoUnityLogRecord *servoUnityLogRingClaim(uint64_t *pos_out)
+{
+	servoUnityLogRecord *record;
+	uint64_t pos = LOG_ATOMIC_LOAD(&servoUnityLogRingEnqueuePos);
+	for (;;) {
+		record = &servoUnityLogRing[pos & (SERVO_UNITY_LOG_RING_RECORDS - 1)];
+		int64_t diff = (int64_t)(LOG_ATOMIC_LOAD(&record->seq) - pos);
+		if (diff == 0) {
+			if (LOG_ATOMIC_CAS(&servoUnityLogRingEnqueuePos, pos, pos + 1)) break;
+		} else if (diff < 0) {
+			LOG_ATOMIC_INC(&servoUnityLogRingDropped); // Full.
+			return NULL;
+		}
+		pos = LOG_ATOMIC_LOAD(&servoUnityLogRingEnqueuePos);
+	}
+	*pos_out = pos;
+	return record;
+}
+
+static void servoUnityLogRingPublish(servoUnityLogRecord *record, uint64_t pos)
+{
+	LOG_ATOMIC_STORE(&record->seq, pos + 1);
+}
+
+// Called on any thread other than the logger thread.
+static void servoUnityLogRingPush(const int logLevel, const char *format, va_list ap)
+{
+	uint64_t pos;
+	servoUnityLogRecord *record = servoUnityLogRingClaim(&pos);
+	if (!record) return;
+	record->level = logLevel;
+	if (!servoUnityLogDeferredFormatting || !servoUnityLogEncode(record, format, ap)) {
+		record->format = NULL;
+		if (servoUnityLogFormat(record->data, SERVO_UNITY_LOG_RECORD_SIZE, logLevel, format, ap) >= SERVO_UNITY_LOG_RECORD_SIZE) {
+			LOG_ATOMIC_INC(&servoUnityLogRingTruncated);
+		}
+	}
+	servoUnityLogRingPublish(record, pos);
+}
+
+// Must be called on the logger thread.
+static void servoUnityLogRingDrain(void)
+{
+	uint64_t dropped, truncated;
+	char buf[SERVO_UNITY_LOG_RECORD_SIZE];
+
+	for (;;) {
+		uint64_t pos = servoUnityLogRingDequeuePos;
+		servoUnityLogRecord *record = &servoUnityLogRing[pos & (SERVO_UNITY_LOG_RING_RECORDS - 1)];
+		if (LOG_ATOMIC_LOAD(&record->seq) != pos + 1) break; // Empty, or the next record is still being written.
+		if (record->format) {
+			if (servoUnityLogDecode(record, buf, sizeof(buf)) >= sizeof(buf)) LOG_ATOMIC_INC(&servoUnityLogRingTruncated);
+			servoUnityLogDeliver(buf);
+		} else {
+			servoUnityLogDeliver(record->data);
+		}
+		servoUnityLogRingDequeuePos = pos + 1;
+		LOG_ATOMIC_STORE(&record->seq, pos + SERVO_UNITY_LOG_RING_RECORDS);
+	}
+
+	dropped = LOG_ATOMIC_EXCHANGE(&servoUnityLogRingDropped, 0);
+	truncated = LOG_ATOMIC_EXCHANGE(&servoUnityLogRingTruncated, 0);
+	if (dropped || truncated) {
+		snprintf(buf, sizeof(buf), "%s%" PRIu64 " log messages from other threads were dropped and %" PRIu64 " truncated.\n", logLevelStrings[SERVO_UNITY_LOG_LEVEL_WARN], dropped, truncated);
+		buf[sizeof(buf) - 1] = '\0'; // _snprintf doesn't terminate on truncation.
+		servoUnityLogDeliver(buf);
+	}
+
+	if (servoUnityLogRepeats && getTimeNowNs() - servoUnityLogFirstRepeatNs >= SERVO_UNITY_LOG_REPEAT_REPORT_NS) servoUnityLogReportRepeats();
+}
 
 void servoUnityLogSetLogger(SERVO_UNITY_LOG_LOGGER_CALLBACK callback, int callBackOnlyIfOnSameThread)
 {
+	servoUnityLogRingInit();
 	servoUnityLogLoggerCallback = callback;
 	servoUnityLogLoggerCallBackOnlyIfOnSameThread = callBackOnlyIfOnSameThread;
 	if (callback && callBackOnlyIfOnSameThread) {
@@ -52,19 +527,61 @@ void servoUnityLogSetLogger(SERVO_UNITY_LOG_LOGGER_CALLBACK callback, int callBa
 #else
 		servoUnityLogLoggerThreadID = GetCurrentThreadId();
 #endif
-		if (!servoUnityLogWrongThreadBuffer) {
-			if ((servoUnityLogWrongThreadBuffer = malloc(sizeof(char) * SERVO_UNITY_LOG_WRONG_THREAD_BUFFER_SIZE))) {
-				servoUnityLogWrongThreadBufferSize = SERVO_UNITY_LOG_WRONG_THREAD_BUFFER_SIZE;
-			}
-		}
 	}
-	else {
-		if (servoUnityLogWrongThreadBuffer) {
-			free(servoUnityLogWrongThreadBuffer);
-			servoUnityLogWrongThreadBuffer = NULL;
-			servoUnityLogWrongThreadBufferSize = 0;
+}
+
+void servoUnityLogSetDeferredFormatting(int deferred)
+{
+	servoUnityLogDeferredFormatting = deferred;
+}
+
+int servoUnityLogGetDeferredFormatting(void)
+{
+	return servoUnityLogDeferredFormatting;
+}
+
+static void servoUnityLogOutput(const char *tag, const int logLevel, const char *buf);
+
+// Returns non-zero if the site is within its rate limit. Any thread.
+static int servoUnityLogSiteAllow(servoUnityLogSite *site, const int logLevel)
+{
+	servoUnityLogAtomic *windowStartNs = (servoUnityLogAtomic *)&site->windowStartNs;
+	servoUnityLogAtomic *count = (servoUnityLogAtomic *)&site->count;
+	servoUnityLogAtomic *suppressed = (servoUnityLogAtomic *)&site->suppressed;
+	uint64_t now, start, n;
+	int limit = (site->limitPerSecond ? *site->limitPerSecond : servoUnityLogSiteLimitPerSecond);
+
+	if (limit <= 0) return 1;
+	now = getTimeNowNs();
+	start = LOG_ATOMIC_LOAD(windowStartNs);
+	if (now - start >= 1000000000ull && LOG_ATOMIC_CAS(windowStartNs, start, now)) {
+		uint64_t s = LOG_ATOMIC_EXCHANGE(suppressed, 0);
+		LOG_ATOMIC_EXCHANGE(count, 0);
+		if (s) {
+			const char *file = strrchr(site->file, '/');
+			if (!file) file = strrchr(site->file, '\\');
+			if (site->line > 0) servoUnityLog(NULL, logLevel, "%" PRIu64 " further messages from %s:%d were suppressed.\n", s, (file ? file + 1 : site->file), site->line);
+			else servoUnityLog(NULL, logLevel, "%" PRIu64 " further messages from %s were suppressed.\n", s, site->file);
 		}
 	}
+	n = (uint64_t)LOG_ATOMIC_INC(count); // Previous value.
+	if (n >= (uint64_t)limit) {
+		LOG_ATOMIC_INC(suppressed);
+		return 0;
+	}
+	return 1;
+}
+
+void servoUnityLogAtSite(servoUnityLogSite *site, const char *tag, const int logLevel, const char *format, ...)
+{
+	if (logLevel < servoUnityLogLevel) return;
+	if (!format || !format[0]) return;
+	if (!servoUnityLogSiteAllow(site, logLevel)) return;
+
+	va_list ap;
+	va_start(ap, format);
+	servoUnityLogv(tag, logLevel, format, ap);
+	va_end(ap);
 }
 
 void servoUnityLog(const char *tag, const int logLevel, const char *format, ...)
@@ -81,81 +598,77 @@ void servoUnityLog(const char *tag, const int logLevel, const char *format, ...)
 void servoUnityLogv(const char *tag, const int logLevel, const char *format, va_list ap)
 {
 	va_list ap2;
-	char *buf = NULL;
+	char stackBuf[SERVO_UNITY_LOG_RECORD_SIZE];
+	char *buf = stackBuf;
 	size_t len;
-	const char *logLevelStrings[] = {
-		"debug",
-		"info",
-		"warning",
-		"error"
-	};
-	const size_t logLevelStringsCount = (sizeof(logLevelStrings) / sizeof(logLevelStrings[0]));
-	size_t logLevelStringLen;
 
 	if (logLevel < servoUnityLogLevel) return;
 	if (!format || !format[0]) return;
 
-	// Count length required to unpack varargs.
+	if (servoUnityLogLoggerCallback && servoUnityLogLoggerCallBackOnlyIfOnSameThread && !servoUnityLogIsLoggerThread()) {
+		servoUnityLogRingPush(logLevel, format, ap);
+		return;
+	}
+
+	// Format on the stack; only a rare long message needs the heap.
 	va_copy(ap2, ap);
-#ifdef _WIN32
-	len = _vscprintf(format, ap);
-#else
-	len = vsnprintf(NULL, 0, format, ap2);
-#endif
+	len = servoUnityLogFormat(stackBuf, sizeof(stackBuf), logLevel, format, ap2);
 	va_end(ap2);
 	if (len < 1) return;
-
-	// Add characters required for logLevelString.
-	if (logLevel >= 0 && logLevel < (int)logLevelStringsCount) {
-		logLevelStringLen = 3 + strlen(logLevelStrings[logLevel]); // +3 for brackets and a space, e.g. "[debug] ".
-	}
-	else {
-		logLevelStringLen = 0;
+	if (len >= sizeof(stackBuf)) {
+		buf = (char *)malloc(len + 1);
+		if (buf) servoUnityLogFormat(buf, len + 1, logLevel, format, ap);
+		else buf = stackBuf; // Fall back to truncated output.
 	}
 
-	buf = (char *)malloc((logLevelStringLen + len + 1) * sizeof(char)); // +1 for nul-term.
+	servoUnityLogOutput(tag, logLevel, buf);
+	if (buf != stackBuf) free(buf);
+}
 
-	if (logLevelStringLen > 0) {
-		snprintf(buf, logLevelStringLen + 1, "[%s] ", logLevelStrings[logLevel]);
+void servoUnityLogBuffer(servoUnityLogSite *site, const char *tag, const int logLevel, const char *buffer, size_t length)
+{
+	char stackBuf[SERVO_UNITY_LOG_RECORD_SIZE];
+	char *buf = stackBuf;
+	size_t len;
+
+	if (logLevel < servoUnityLogLevel) return;
+	if (!buffer || !length) return;
+	if (site && !servoUnityLogSiteAllow(site, logLevel)) return;
+
+	if (servoUnityLogLoggerCallback && servoUnityLogLoggerCallBackOnlyIfOnSameThread && !servoUnityLogIsLoggerThread()) {
+		uint64_t pos;
+		servoUnityLogRecord *record = servoUnityLogRingClaim(&pos);
+		if (!record) return;
+		record->level = logLevel;
+		record->format = NULL;
+		if (servoUnityLogCopy(record->data, SERVO_UNITY_LOG_RECORD_SIZE, logLevel, buffer, length) >= SERVO_UNITY_LOG_RECORD_SIZE) {
+			LOG_ATOMIC_INC(&servoUnityLogRingTruncated);
+		}
+		servoUnityLogRingPublish(record, pos);
+		return;
 	}
 
-	vsnprintf(buf + logLevelStringLen, len + 1, format, ap);
-	len += logLevelStringLen;
+	len = servoUnityLogCopy(stackBuf, sizeof(stackBuf), logLevel, buffer, length);
+	if (len >= sizeof(stackBuf)) {
+		buf = (char *)malloc(len + 1);
+		if (buf) servoUnityLogCopy(buf, len + 1, logLevel, buffer, length);
+		else buf = stackBuf; // Fall back to truncated output.
+	}
+	servoUnityLogOutput(tag, logLevel, buf);
+	if (buf != stackBuf) free(buf);
+}
 
+// Outputs a complete message. Called on the logger thread, or any thread if thread-restricted callback is not in use.
+static void servoUnityLogOutput(const char *tag, const int logLevel, const char *buf)
+{
 	if (servoUnityLogLoggerCallback) {
-
-		if (!servoUnityLogLoggerCallBackOnlyIfOnSameThread) {
+		// On log thread (or any thread is OK), print anything queued by other threads first, then the current message.
+		if (servoUnityLogLoggerCallBackOnlyIfOnSameThread) {
+			servoUnityLogRingDrain();
+			servoUnityLogDeliver(buf);
+		} else {
 			(*servoUnityLogLoggerCallback)(buf);
 		}
-		else {
-#ifndef _WIN32
-			if (!pthread_equal(pthread_self(), servoUnityLogLoggerThread))
-#else
-			if (GetCurrentThreadId() != servoUnityLogLoggerThreadID)
-#endif
-			{
-				// On non-log thread, put it into buffer if we can.
-				if (servoUnityLogWrongThreadBuffer && (servoUnityLogWrongThreadBufferCount < servoUnityLogWrongThreadBufferSize)) {
-					if (len <= (servoUnityLogWrongThreadBufferSize - (servoUnityLogWrongThreadBufferCount + 4))) { // +4 to reserve space for "...\0".
-						strncpy(&servoUnityLogWrongThreadBuffer[servoUnityLogWrongThreadBufferCount], buf, len + 1);
-						servoUnityLogWrongThreadBufferCount += len;
-					}
-					else {
-						strncpy(&servoUnityLogWrongThreadBuffer[servoUnityLogWrongThreadBufferCount], "...", 4);
-						servoUnityLogWrongThreadBufferCount = servoUnityLogWrongThreadBufferSize; // Mark buffer as full.
-					}
-				}
-			}
-			else {
-				// On log thread, print buffer if anything was in it, then the current message.
-				if (servoUnityLogWrongThreadBufferCount > 0) {
-					(*servoUnityLogLoggerCallback)(servoUnityLogWrongThreadBuffer);
-					servoUnityLogWrongThreadBufferCount = 0;
-				}
-				(*servoUnityLogLoggerCallback)(buf);
-			}
-		}
-
 	}
 	else {
 #if defined(__ANDROID__)
@@ -189,20 +702,11 @@ void servoUnityLogv(const char *tag, const int logLevel, const char *format, va_
 		fprintf(stderr, "%s", buf);
 #endif
 	}
-	free(buf);
 }
 
 void servoUnityLogFlush(void)
 {
-    if (!servoUnityLogLoggerCallback
-        || !servoUnityLogLoggerCallBackOnlyIfOnSameThread
-        || servoUnityLogWrongThreadBufferCount <= 0) return;
-#ifndef _WIN32
-    if (!pthread_equal(pthread_self(), servoUnityLogLoggerThread)) return;
-#else
-    if (GetCurrentThreadId() != servoUnityLogLoggerThreadID) return;
-#endif
-
-    (*servoUnityLogLoggerCallback)(servoUnityLogWrongThreadBuffer);
-    servoUnityLogWrongThreadBufferCount = 0;
+	if (!servoUnityLogLoggerCallback || !servoUnityLogLoggerCallBackOnlyIfOnSameThread) return;
+	if (!servoUnityLogIsLoggerThread()) return;
+	servoUnityLogRingDrain();
 }
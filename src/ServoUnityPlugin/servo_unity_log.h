@@ -17,6 +17,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdint.h>
 #ifndef _WIN32 // errno is defined in stdlib.h on Windows.
 #  ifdef EMSCRIPTEN // errno is not in sys/
 #    include <errno.h>
@@ -94,15 +95,81 @@ typedef void (SERVO_UNITY_CALLBACK *SERVO_UNITY_LOG_LOGGER_CALLBACK)(const char
 */
 SERVO_UNITY_EXTERN void servoUnityLogSetLogger(SERVO_UNITY_LOG_LOGGER_CALLBACK callback, int callBackOnlyIfOnSameThread);
 
+/*!
+	@brief   Defer formatting of log output from secondary threads until it is flushed.
+	@details
+		When a callback was installed with callBackOnlyIfOnSameThread set, log output from
+		other threads is queued until the next servoUnityLogFlush(). With deferred formatting,
+		only the format string pointer and the argument values are queued, and the message
+		is formatted by servoUnityLogFlush() on the callback thread. This makes logging much
+		cheaper for the secondary thread, but requires that the format string passed to
+		servoUnityLog remains valid until the next flush (e.g. is a string literal).
+		Strings passed as %s arguments are copied and need not remain valid.
+	@param      deferred Non-zero to defer formatting, 0 (the default) to format immediately.
+*/
+SERVO_UNITY_EXTERN void servoUnityLogSetDeferredFormatting(int deferred);
+SERVO_UNITY_EXTERN int servoUnityLogGetDeferredFormatting(void);
+
+/*!
+	@brief   Per-call-site state for rate limiting. One is declared by each use of the SERVOUNITYLOG* macros.
+*/
+typedef struct {
+	const char *file;
+	int line;
+	int64_t windowStartNs; // Accessed atomically.
+	int64_t count; // Accessed atomically.
+	int64_t suppressed; // Accessed atomically.
+	const int *limitPerSecond; // This site's limit, or NULL to use servoUnityLogSiteLimitPerSecond.
+} servoUnityLogSite;
+
+/*!
+	@var int servoUnityLogSiteLimitPerSecond
+	@brief   Maximum number of messages per second logged from any one call site.
+	@details
+		Messages beyond the limit are discarded before being formatted, and a count of them
+		is logged when the call site next logs after the current second has elapsed.
+		0 means no limit. The default is SERVO_UNITY_LOG_SITE_LIMIT_PER_SECOND_DEFAULT.
+*/
+#define SERVO_UNITY_LOG_SITE_LIMIT_PER_SECOND_DEFAULT 100
+SERVO_UNITY_EXTERN extern int servoUnityLogSiteLimitPerSecond;
+
+/*!
+	@brief   As servoUnityLog, but subject to rate limiting of the call site.
+	@see servoUnityLogSiteLimitPerSecond
+*/
+SERVO_UNITY_EXTERN void servoUnityLogAtSite(servoUnityLogSite *site, const char *tag, const int logLevel, const char *format, ...);
+
+#define SERVOUNITYLOG_AT_SITE(logLevel, ...) do { \
+		static servoUnityLogSite servoUnityLogSite_ = {__FILE__, __LINE__, 0, 0, 0, NULL}; \
+		servoUnityLogAtSite(&servoUnityLogSite_, NULL, logLevel, __VA_ARGS__); \
+	} while (0)
+
+/*!
+	@brief   Log a message which is already formatted.
+	@details
+		This avoids the cost of formatting for text which arrives complete, e.g. from Servo's
+		own logging. The text is copied as is, preceded by the level prefix, and followed by
+		a newline if it doesn't already end with one.
+	@param      site Call site for rate limiting, or NULL for none.
+	@param      buffer The message text. Need not be nul-terminated.
+	@param      length The length of the message text in bytes.
+*/
+SERVO_UNITY_EXTERN void servoUnityLogBuffer(servoUnityLogSite *site, const char *tag, const int logLevel, const char *buffer, size_t length);
+
+#define SERVOUNITYLOGBUFFER(logLevel, buffer, length) do { \
+		static servoUnityLogSite servoUnityLogSite_ = {__FILE__, __LINE__, 0, 0, 0, NULL}; \
+		servoUnityLogBuffer(&servoUnityLogSite_, NULL, logLevel, buffer, length); \
+	} while (0)
+
 #ifndef NDEBUG
-#  define SERVOUNITYLOGd(...) servoUnityLog(NULL, SERVO_UNITY_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#  define SERVOUNITYLOGd(...) SERVOUNITYLOG_AT_SITE(SERVO_UNITY_LOG_LEVEL_DEBUG, __VA_ARGS__)
 #else
 #  define SERVOUNITYLOGd(...)
 #endif
-#define SERVOUNITYLOGi(...) servoUnityLog(NULL, SERVO_UNITY_LOG_LEVEL_INFO, __VA_ARGS__)
-#define SERVOUNITYLOGw(...) servoUnityLog(NULL, SERVO_UNITY_LOG_LEVEL_WARN, __VA_ARGS__)
-#define SERVOUNITYLOGe(...) servoUnityLog(NULL, SERVO_UNITY_LOG_LEVEL_ERROR, __VA_ARGS__)
-#define SERVOUNITYLOGperror(s) servoUnityLog(NULL, SERVO_UNITY_LOG_LEVEL_ERROR, ((s != NULL) ? "%s: %s\n" : "%s%s\n"), ((s != NULL) ? s : ""), strerror(errno))
+#define SERVOUNITYLOGi(...) SERVOUNITYLOG_AT_SITE(SERVO_UNITY_LOG_LEVEL_INFO, __VA_ARGS__)
+#define SERVOUNITYLOGw(...) SERVOUNITYLOG_AT_SITE(SERVO_UNITY_LOG_LEVEL_WARN, __VA_ARGS__)
+#define SERVOUNITYLOGe(...) SERVOUNITYLOG_AT_SITE(SERVO_UNITY_LOG_LEVEL_ERROR, __VA_ARGS__)
+#define SERVOUNITYLOGperror(s) SERVOUNITYLOG_AT_SITE(SERVO_UNITY_LOG_LEVEL_ERROR, ((s != NULL) ? "%s: %s\n" : "%s%s\n"), ((s != NULL) ? s : ""), strerror(errno))
 
 /*!
     @brief Flush any log logged on non-callback thread.
@@ -110,6 +177,9 @@ SERVO_UNITY_EXTERN void servoUnityLogSetLogger(SERVO_UNITY_LOG_LOGGER_CALLBACK c
         callBackOnlyIfOnSameThread set to true, this call will flush any log output
         that occured on a non-callback thread, provided that this function is
         invoked on a callback-OK thread.
+        In this case, consecutive identical messages are also collapsed into one, followed
+        by a "Last message repeated N times." line, which is output when a different message
+        is logged or at the first flush at least 1 second after the first repeat.
  */
 SERVO_UNITY_EXTERN void servoUnityLogFlush(void);
 
@@ -0,0 +1,135 @@
+//
+// servo_unity_trace.cpp
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0.If a copy of the MPL was not distributed with this
+// file, You can obtain one at https ://mozilla.org/MPL/2.0/.
+//
+// Copyright (c) 2019-2020 Mozilla, Inc.
+//
+// Author(s): Philip Lamb
+//
+
+#include "servo_unity_trace.h"
+#include <cinttypes>
+#include <cstdio>
+#include <new>
+#include "servo_unity_log.h"
+#include "utils.h"
+
+std::atomic<bool> servoUnityTraceEnabled(false);
+
+namespace {
+
+struct TraceSpan {
+    const char *name;
+    uint64_t startNs;
+    uint64_t durationNs;
+};
+
+// One per thread which has recorded a span. Only the owning thread writes to
+// a buffer. Buffers are never freed, as the writer may read them at any time.
+struct TraceBuffer {
+    uint64_t tid;
+    TraceBuffer *next;
+    std::atomic<uint32_t> epoch; // Spans belong to the trace started at this epoch.
+    std::atomic<size_t> count; // Published with release, after the span is written.
+    std::atomic<uint64_t> dropped;
+    TraceSpan spans[SERVO_UNITY_TRACE_SPANS_PER_THREAD];
+};
+
+std::atomic<TraceBuffer *> s_buffers(nullptr);
+std::atomic<uint32_t> s_epoch(0);
+thread_local TraceBuffer *t_buffer = nullptr;
+
+TraceBuffer *threadBuffer(void)
+{
+    if (t_buffer) return t_buffer;
+    TraceBuffer *b = new (std::nothrow) TraceBuffer;
+    if (!b) return nullptr;
+    b->tid = getThreadID();
+    b->epoch.store(s_epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    b->count.store(0, std::memory_order_relaxed);
+    b->dropped.store(0, std::memory_order_relaxed);
+    TraceBuffer *head = s_buffers.load(std::memory_order_relaxed);
+    do {
+        b->next = head;
+    } while (!s_buffers.compare_exchange_weak(head, b, std::memory_order_release, std::memory_order_relaxed));
+    t_buffer = b;
+    return b;
+}
+
+// Writes a string as a JSON string body. Span names are literals, but escape anyway.
+void writeJSONString(FILE *fp, const char *s)
+{
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', fp);
+        if ((unsigned char)*s >= 0x20) fputc(*s, fp);
+    }
+}
+
+} // namespace
+
+void servoUnityTraceSetEnabled(bool enable)
+{
+    if (enable) s_epoch.fetch_add(1, std::memory_order_acq_rel); // Each thread discards its old spans at its next span.
+    servoUnityTraceEnabled.store(enable, std::memory_order_release);
+}
+
+void servoUnityTraceRecord(const char *name, uint64_t startNs, uint64_t endNs)
+{
+    TraceBuffer *b = threadBuffer();
+    if (!b) return;
+    uint32_t epoch = s_epoch.load(std::memory_order_acquire);
+    if (b->epoch.load(std::memory_order_relaxed) != epoch) {
+        b->count.store(0, std::memory_order_relaxed);
+        b->dropped.store(0, std::memory_order_relaxed);
+        b->epoch.store(epoch, std::memory_order_release);
+    }
+    size_t n = b->count.load(std::memory_order_relaxed);
+    if (n >= SERVO_UNITY_TRACE_SPANS_PER_THREAD) {
+        b->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    b->spans[n].name = name;
+    b->spans[n].startNs = startNs;
+    b->spans[n].durationNs = endNs - startNs;
+    b->count.store(n + 1, std::memory_order_release);
+}
+
+bool servoUnityTraceWrite(const char *path)
+{
+    if (!path || !path[0]) return false;
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        SERVOUNITYLOGe("Unable to open trace file '%s' for writing.\n", path);
+        return false;
+    }
+
+    uint32_t epoch = s_epoch.load(std::memory_order_acquire);
+    uint64_t spans = 0, dropped = 0;
+    bool first = true;
+    fputs("{\"traceEvents\":[", fp);
+    for (TraceBuffer *b = s_buffers.load(std::memory_order_acquire); b; b = b->next) {
+        if (b->epoch.load(std::memory_order_acquire) != epoch) continue;
+        size_t count = b->count.load(std::memory_order_acquire);
+        for (size_t i = 0; i < count; i++) {
+            const TraceSpan& s = b->spans[i];
+            fputs(first ? "\n{\"name\":\"" : ",\n{\"name\":\"", fp);
+            writeJSONString(fp, s.name);
+            fprintf(fp, "\",\"cat\":\"servo_unity\",\"ph\":\"X\",\"pid\":1,\"tid\":%" PRIu64 ",\"ts\":%" PRIu64 ".%03u,\"dur\":%" PRIu64 ".%03u}",
+                    b->tid, s.startNs / 1000, (unsigned)(s.startNs % 1000), s.durationNs / 1000, (unsigned)(s.durationNs % 1000));
+            first = false;
+        }
+        spans += count;
+        dropped += b->dropped.load(std::memory_order_relaxed);
+    }
+    fputs("\n],\"displayTimeUnit\":\"ns\"}\n", fp);
+    bool ok = (ferror(fp) == 0);
+    if (fclose(fp) != 0) ok = false;
+
+    if (!ok) SERVOUNITYLOGe("Error writing trace file '%s'.\n", path);
+    else SERVOUNITYLOGi("Wrote %" PRIu64 " trace spans to '%s'.\n", spans, path);
+    if (dropped) SERVOUNITYLOGw("%" PRIu64 " trace spans were dropped because a thread's trace buffer was full.\n", dropped);
+    return ok;
+}
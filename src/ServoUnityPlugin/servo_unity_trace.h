@@ -0,0 +1,58 @@
+//
+// servo_unity_trace.h
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0.If a copy of the MPL was not distributed with this
+// file, You can obtain one at https ://mozilla.org/MPL/2.0/.
+//
+// Copyright (c) 2019-2020 Mozilla, Inc.
+//
+// Author(s): Philip Lamb
+//
+// Opt-in tracing of plugin activity, for viewing in chrome://tracing or
+// Perfetto. Each thread records spans into its own fixed-size buffer, so
+// recording takes no locks. When tracing is off, a span costs one relaxed
+// atomic load.
+//
+// Usage: place SERVOUNITYTRACE("name") at the top of a scope. The span lasts
+// until the end of the scope. The name must be a string literal.
+//
+
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include "utils.h"
+
+#define SERVO_UNITY_TRACE_SPANS_PER_THREAD 65536 // Further spans on a thread are dropped until tracing is restarted.
+
+extern std::atomic<bool> servoUnityTraceEnabled;
+
+/// Start or stop recording. Starting discards any previously recorded spans.
+void servoUnityTraceSetEnabled(bool enable);
+
+/// Write all spans recorded since tracing was last started, in Chrome trace_event JSON format.
+/// Spans still being recorded while writing may be omitted.
+bool servoUnityTraceWrite(const char *path);
+
+void servoUnityTraceRecord(const char *name, uint64_t startNs, uint64_t endNs);
+
+class ServoUnityTraceSpan
+{
+private:
+    const char *m_name;
+    uint64_t m_startNs;
+
+public:
+    explicit ServoUnityTraceSpan(const char *name) :
+        m_name(servoUnityTraceEnabled.load(std::memory_order_relaxed) ? name : nullptr),
+        m_startNs(m_name ? getTimeNowNs() : 0) {}
+    ~ServoUnityTraceSpan() {
+        if (m_name) servoUnityTraceRecord(m_name, m_startNs, getTimeNowNs());
+    }
+    ServoUnityTraceSpan(const ServoUnityTraceSpan&) = delete;
+    void operator=(const ServoUnityTraceSpan&) = delete;
+};
+
+#define SERVOUNITYTRACE_CONCAT2(a, b) a##b
+#define SERVOUNITYTRACE_CONCAT(a, b) SERVOUNITYTRACE_CONCAT2(a, b)
+#define SERVOUNITYTRACE(name) ServoUnityTraceSpan SERVOUNITYTRACE_CONCAT(servoUnityTraceSpan_, __LINE__)(name)
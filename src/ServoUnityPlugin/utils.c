@@ -21,12 +21,16 @@
 #elif defined(__WIN32)
 #  include <Processthreadsapi.h>
 #elif defined(__linux__)
-#  include <sys/types.h>
+#  include <unistd.h>
+#  include <sys/syscall.h>
 #endif
 
 #ifdef _WIN32
 #  include <windows.h>
 #  include <sys/timeb.h>
+#elif defined(__APPLE__)
+#  include <mach/mach_time.h>
+#  include <sys/time.h>
 #else
 #  include <time.h>
 #  include <sys/time.h>
@@ -40,7 +44,7 @@ uint64_t getThreadID()
 #elif defined(__WIN32)
     tid = (uint64_t)GetCurrentThreadId(); // Cast from DWORD.
 #elif defined(__linux__)
-    tid = (uint64_t)gettid(); // Cast from pid_t.
+    tid = (uint64_t)syscall(SYS_gettid); // gettid() wrapper only in glibc 2.30 and later.
 #elif defined(__unix__) // Other BSD not elsewhere defined.
     tid = (uint64_t) = pthread_getthreadid_np(); // Cast from int.
 #endif
@@ -76,3 +80,25 @@ unsigned long millisecondsElapsedSince(utilTime time)
     utilTime timeNow = getTimeNow();
     return ((timeNow.secs - time.secs)*1000 + (timeNow.millisecs - time.millisecs)); // The second addend can be negative.
 }
+
+uint64_t getTimeNowNs(void)
+{
+#if defined(_WIN32)
+    static LARGE_INTEGER freq = {0}; // Fixed at boot, so a racing first call is harmless.
+    LARGE_INTEGER count;
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    // Split to avoid overflow of count * 1e9.
+    return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000000ull + (uint64_t)(count.QuadPart % freq.QuadPart) * 1000000000ull / (uint64_t)freq.QuadPart;
+#elif defined(__APPLE__)
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase); // Cheap; the system caches it.
+    uint64_t t = mach_absolute_time();
+    if (timebase.numer == timebase.denom) return t; // Intel: ticks are nanoseconds.
+    return (t / timebase.denom) * timebase.numer + (t % timebase.denom) * timebase.numer / timebase.denom;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
@@ -18,6 +18,9 @@
 
 #include <stdint.h>
 #include <inttypes.h>
+#ifdef __cplusplus
+#  include <atomic>
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -31,10 +34,103 @@ typedef struct {
     int  millisecs;
 } utilTime;
 
+// Wall-clock time, with millisecond resolution. Not suitable for measuring
+// intervals, since it jumps if the system clock is adjusted.
 extern utilTime getTimeNow(void);
 extern unsigned long millisecondsElapsedSince(utilTime time);
 
+// Monotonic time in nanoseconds, from an arbitrary origin. Use this for
+// measuring intervals.
+extern uint64_t getTimeNowNs(void);
+
 #ifdef __cplusplus
 }
-#endif
+
+// A fixed-size, log-linear histogram of unsigned values (e.g. durations).
+// Each power of two is split into 8 linear sub-buckets, so any reported
+// percentile is within 12.5% of the true value. Values are clamped to 2^40 - 1
+// (a little over 18 minutes in nanoseconds). One thread records values; any
+// thread may read percentiles. Buckets are atomic, so readers never block the
+// recording thread (a read concurrent with recording is a close
+// approximation, not a snapshot).
+class utilHistogram
+{
+private:
+    static constexpr int kSubBucketBits = 3;
+    static constexpr int kSubBuckets = 1 << kSubBucketBits;
+    static constexpr int kMaxBits = 40;
+    static constexpr int kBuckets = (kMaxBits - kSubBucketBits + 1) * kSubBuckets;
+
+    std::atomic<uint64_t> m_buckets[kBuckets];
+    std::atomic<uint64_t> m_count;
+    std::atomic<uint64_t> m_max;
+
+    static int bucketIndex(uint64_t value) {
+        if (value < (uint64_t)kSubBuckets * 2) return (int)value;
+        int msb = 63;
+        while (!(value & (1ull << msb))) msb--;
+        int shift = msb - kSubBucketBits;
+        return (shift + 1) * kSubBuckets + (int)((value >> shift) - kSubBuckets);
+    }
+
+    // Largest value that falls in bucket `index`.
+    static uint64_t bucketUpperBound(int index) {
+        if (index < kSubBuckets * 2) return (uint64_t)index;
+        int shift = index / kSubBuckets - 1;
+        uint64_t lower = (uint64_t)(kSubBuckets + index % kSubBuckets) << shift;
+        return lower + (1ull << shift) - 1;
+    }
+
+public:
+    utilHistogram() {
+        reset();
+    }
+
+    utilHistogram(const utilHistogram&) = delete;
+    void operator=(const utilHistogram&) = delete;
+
+    void record(uint64_t value) {
+        if (value >= (1ull << kMaxBits)) value = (1ull << kMaxBits) - 1;
+        m_buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        if (value > m_max.load(std::memory_order_relaxed)) m_max.store(value, std::memory_order_relaxed); // Single recording thread.
+    }
+
+    void reset() {
+        for (int i = 0; i < kBuckets; i++) m_buckets[i].store(0, std::memory_order_relaxed);
+        m_count.store(0, std::memory_order_relaxed);
+        m_max.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const {
+        return m_count.load(std::memory_order_relaxed);
+    }
+
+    uint64_t max() const {
+        return m_max.load(std::memory_order_relaxed);
+    }
+
+    /// @param p Percentile, in the range (0, 1], e.g. 0.99 for p99.
+    /// @return The upper bound of the bucket containing the requested percentile, or 0 if no values have been recorded.
+    uint64_t percentile(double p) const {
+        uint64_t total = 0;
+        for (int i = 0; i < kBuckets; i++) total += m_buckets[i].load(std::memory_order_relaxed);
+        if (total == 0) return 0;
+        uint64_t target = (uint64_t)(p * (double)total + 0.5);
+        if (target < 1) target = 1;
+        if (target > total) target = total;
+        uint64_t seen = 0;
+        for (int i = 0; i < kBuckets; i++) {
+            seen += m_buckets[i].load(std::memory_order_relaxed);
+            if (seen >= target) {
+                uint64_t bound = bucketUpperBound(i);
+                uint64_t mx = max();
+                return (mx && mx < bound ? mx : bound);
+            }
+        }
+        return max();
+    }
+};
+
+#endif // __cplusplus
 #endif // !utils_h
@@ -0,0 +1,394 @@
+//
+// servo_unity_remote_host.cpp
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0.If a copy of the MPL was not distributed with this
+// file, You can obtain one at https ://mozilla.org/MPL/2.0/.
+//
+// Copyright (c) 2019-2020 Mozilla, Inc.
+//
+// Author(s): Philip Lamb
+//
+// Runs one window's Servo engine on behalf of the plugin, in a process of its
+// own, so that a Servo panic doesn't take down Unity, and a slow page doesn't
+// hold up Unity's render thread. Started by the plugin when
+// ServoUnityParam_s_RemoteHost is set (Linux only). Not meant to be run by hand.
+//
+// The host inherits a memfd holding a ServoUnityRemoteShared and a socket to
+// the plugin (see ServoUnityRemote.h). It creates its own OpenGL context (EGL,
+// without a window system where possible), starts Servo in it, then loops:
+// - When Servo calls wakeup(), or every frame while Servo is animating, it
+//   calls perform_updates().
+// - When the plugin signals, it passes on the messages queued by the plugin.
+// - After either, it fills a texture with Servo's frame, reads the pixels
+//   straight into the frame buffer it owns in shared memory, and publishes it.
+// Callbacks from Servo are queued to the plugin as messages. Those which need
+// an immediate answer (prompts, clipboard, context menus, navigation) are
+// answered here, as the plugin's window would answer them.
+//
+// It exits after deinit() when asked to by the plugin, or if the plugin goes
+// away.
+//
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include "simpleservo.h"
+#include "ServoUnityRemote.h"
+
+#define ANIMATION_FRAME_MS 16
+
+static ServoUnityRemoteShared *s_shared = nullptr;
+static int s_wakeupFd = -1;
+static std::atomic<bool> s_animating(false);
+static std::atomic<uint64_t> s_messagesDropped(0);
+
+static EGLDisplay s_eglDisplay = EGL_NO_DISPLAY;
+static EGLContext s_eglContext = EGL_NO_CONTEXT;
+static EGLSurface s_eglSurface = EGL_NO_SURFACE;
+
+static GLuint s_texture = 0;
+static GLuint s_framebuffer = 0;
+static int32_t s_textureWidth = 0;
+static int32_t s_textureHeight = 0;
+
+static uint32_t s_frame = 0; // Index of the frame buffer the host owns.
+static uint64_t s_frameSeq = 0;
+
+static bool createGLContext(void)
+{
+    // Prefer a surfaceless display, so no window system is needed.
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay) s_eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if (s_eglDisplay == EGL_NO_DISPLAY || !eglInitialize(s_eglDisplay, NULL, NULL)) {
+        s_eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (s_eglDisplay == EGL_NO_DISPLAY || !eglInitialize(s_eglDisplay, NULL, NULL)) {
+            fprintf(stderr, "servo_unity_remote_host: Unable to initialise EGL.\n");
+            return false;
+        }
+    }
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        fprintf(stderr, "servo_unity_remote_host: EGL does not support desktop OpenGL.\n");
+        return false;
+    }
+    const EGLint configAttribs[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_NONE};
+    const EGLint configAttribsNoSurface[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+    EGLConfig config;
+    EGLint count = 0;
+    bool pbuffer = eglChooseConfig(s_eglDisplay, configAttribs, &config, 1, &count) && count > 0;
+    if (!pbuffer && (!eglChooseConfig(s_eglDisplay, configAttribsNoSurface, &config, 1, &count) || count == 0)) {
+        fprintf(stderr, "servo_unity_remote_host: No suitable EGL config.\n");
+        return false;
+    }
+    const EGLint contextAttribs[] = {EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 2, EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE};
+    s_eglContext = eglCreateContext(s_eglDisplay, config, EGL_NO_CONTEXT, contextAttribs);
+    if (s_eglContext == EGL_NO_CONTEXT) s_eglContext = eglCreateContext(s_eglDisplay, config, EGL_NO_CONTEXT, NULL);
+    if (s_eglContext == EGL_NO_CONTEXT) {
+        fprintf(stderr, "servo_unity_remote_host: Unable to create OpenGL context (EGL error 0x%x).\n", eglGetError());
+        return false;
+    }
+    if (pbuffer) {
+        const EGLint pbufferAttribs[] = {EGL_WIDTH, 16, EGL_HEIGHT, 16, EGL_NONE};
+        s_eglSurface = eglCreatePbufferSurface(s_eglDisplay, config, pbufferAttribs);
+    }
+    if (!eglMakeCurrent(s_eglDisplay, s_eglSurface, s_eglSurface, s_eglContext)) {
+        fprintf(stderr, "servo_unity_remote_host: Unable to make OpenGL context current (EGL error 0x%x).\n", eglGetError());
+        return false;
+    }
+    return true;
+}
+
+static void destroyGLContext(void)
+{
+    if (s_framebuffer) glDeleteFramebuffers(1, &s_framebuffer);
+    if (s_texture) glDeleteTextures(1, &s_texture);
+    s_framebuffer = s_texture = 0;
+    if (s_eglDisplay == EGL_NO_DISPLAY) return;
+    eglMakeCurrent(s_eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (s_eglSurface != EGL_NO_SURFACE) eglDestroySurface(s_eglDisplay, s_eglSurface);
+    if (s_eglContext != EGL_NO_CONTEXT) eglDestroyContext(s_eglDisplay, s_eglContext);
+    eglTerminate(s_eglDisplay);
+    s_eglDisplay = EGL_NO_DISPLAY;
+}
+
+//
+// Messages to the plugin.
+//
+
+static void signalPlugin(void)
+{
+    if (!s_shared->toPluginSignalled.exchange(true, std::memory_order_acq_rel)) {
+        char b = 0;
+        if (write(SERVO_UNITY_REMOTE_SOCKET_FD, &b, 1) < 0) {} // If the plugin has gone, the main loop will find out.
+    }
+}
+
+static void send(ServoUnityRemoteMessageType type, const char *str = nullptr, int32_t i0 = 0, int32_t i1 = 0, int32_t i2 = 0, int32_t i3 = 0)
+{
+    ServoUnityRemoteMessage msg = {type, {i0, i1, i2, i3}, {0.0f, 0.0f}, -1};
+    if (!servoUnityRemoteSend(s_shared->toPlugin, s_shared->toPluginStrings, s_shared->toPluginSignalled, SERVO_UNITY_REMOTE_SOCKET_FD, msg, str)) s_messagesDropped++;
+}
+
+//
+// Servo callbacks. These may come from any Servo thread.
+//
+
+static void on_load_started(void) { send(ServoUnityRemoteMessageType::LoadStarted); }
+static void on_load_ended(void) { send(ServoUnityRemoteMessageType::LoadEnded); }
+static void on_title_changed(const char *title) { send(ServoUnityRemoteMessageType::TitleChanged, title ? title : ""); }
+static bool on_allow_navigation(const char *url) { return true; }
+static void on_url_changed(const char *url) { send(ServoUnityRemoteMessageType::URLChanged, url ? url : ""); }
+static void on_history_changed(bool can_go_back, bool can_go_forward) { send(ServoUnityRemoteMessageType::HistoryChanged, nullptr, can_go_back ? 1 : 0, can_go_forward ? 1 : 0); }
+static void on_shutdown_complete(void) { send(ServoUnityRemoteMessageType::ShutdownComplete); }
+static void on_ime_show(const char *text, int32_t x, int32_t y, int32_t width, int32_t height) { send(ServoUnityRemoteMessageType::IMEShow, text ? text : "", x, y, width, height); }
+static void on_ime_hide(void) { send(ServoUnityRemoteMessageType::IMEHide); }
+static const char *get_clipboard_contents(void) { return nullptr; }
+static void set_clipboard_contents(const char *contents) {}
+static void on_media_session_metadata(const char *title, const char *album, const char *artist) {}
+static void on_media_session_playback_state_change(CMediaSessionPlaybackState state) {}
+static void on_media_session_set_position_state(double duration, double position, double playback_rate) {}
+static void prompt_alert(const char *message, bool trusted) {}
+static CPromptResult prompt_ok_cancel(const char *message, bool trusted) { return CPromptResult::Dismissed; }
+static CPromptResult prompt_yes_no(const char *message, bool trusted) { return CPromptResult::Dismissed; }
+static const char *prompt_input(const char *message, const char *def, bool trusted) { return def; }
+static void on_devtools_started(CDevtoolsServerState result, unsigned int port, const char *token) { send(ServoUnityRemoteMessageType::DevtoolsStarted, nullptr, result, (int32_t)port); }
+static void show_context_menu(const char *title, const char *const *items_list, uint32_t items_size) { on_context_menu_closed(CContextMenuResult::Dismissed_, 0); }
+
+static void on_animating_changed(bool animating)
+{
+    s_animating = animating;
+    send(ServoUnityRemoteMessageType::AnimatingChanged, nullptr, animating ? 1 : 0);
+}
+
+static void on_log_output(const char *buffer, uint32_t buffer_length)
+{
+    std::string s(buffer, buffer_length);
+    send(ServoUnityRemoteMessageType::LogOutput, s.c_str());
+}
+
+static void wakeup(void)
+{
+    uint64_t one = 1;
+    if (write(s_wakeupFd, &one, sizeof(one)) < 0) {} // Only fails if the counter is saturated, in which case the main loop is awake anyway.
+}
+
+//
+// Frames.
+//
+
+// Fills a texture with Servo's frame, then copies it into the host's frame buffer and publishes it.
+static void publishFrame(int32_t width, int32_t height)
+{
+    if (width <= 0 || height <= 0) return;
+    if (width > SERVO_UNITY_REMOTE_FRAME_SIZE_MAX) width = SERVO_UNITY_REMOTE_FRAME_SIZE_MAX;
+    if (height > SERVO_UNITY_REMOTE_FRAME_SIZE_MAX) height = SERVO_UNITY_REMOTE_FRAME_SIZE_MAX;
+    if (!s_texture || width != s_textureWidth || height != s_textureHeight) {
+        if (!s_texture) glGenTextures(1, &s_texture);
+        glBindTexture(GL_TEXTURE_2D, s_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        if (!s_framebuffer) glGenFramebuffers(1, &s_framebuffer);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, s_framebuffer);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, s_texture, 0);
+        s_textureWidth = width;
+        s_textureHeight = height;
+    }
+
+    fill_gl_texture(s_texture, width, height);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, s_framebuffer);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, servoUnityRemoteFrameBuffer(s_shared, s_frame));
+    ServoUnityRemoteFrame& frame = s_shared->frames[s_frame];
+    frame.seq = ++s_frameSeq;
+    frame.width = width;
+    frame.height = height;
+    s_frame = s_shared->frameLatest.exchange(s_frame | SERVO_UNITY_REMOTE_FRAME_FRESH, std::memory_order_acq_rel) & ~SERVO_UNITY_REMOTE_FRAME_FRESH;
+    signalPlugin();
+}
+
+//
+// Messages from the plugin. Returns false when the host should exit.
+//
+
+static bool handle(const ServoUnityRemoteMessage& msg, int32_t *width_p, int32_t *height_p)
+{
+    const char *str = (msg.str >= 0 ? s_shared->toHostStrings.get(msg.str) : nullptr);
+    switch (msg.type) {
+        case ServoUnityRemoteMessageType::RequestShutdown: request_shutdown(); break;
+        case ServoUnityRemoteMessageType::Deinit: return false;
+        case ServoUnityRemoteMessageType::Resize:
+            *width_p = msg.i[0];
+            *height_p = msg.i[1];
+            resize(msg.i[0], msg.i[1]);
+            break;
+        case ServoUnityRemoteMessageType::MouseMove: mouse_move(msg.f[0], msg.f[1]); break;
+        case ServoUnityRemoteMessageType::MouseDown: mouse_down(msg.f[0], msg.f[1], (CMouseButton)msg.i[0]); break;
+        case ServoUnityRemoteMessageType::MouseUp: mouse_up(msg.f[0], msg.f[1], (CMouseButton)msg.i[0]); break;
+        case ServoUnityRemoteMessageType::Click: click(msg.f[0], msg.f[1]); break;
+        case ServoUnityRemoteMessageType::Scroll: scroll(msg.i[0], msg.i[1], msg.i[2], msg.i[3]); break;
+        case ServoUnityRemoteMessageType::KeyDown: key_down((uint32_t)msg.i[0], (CKeyType)msg.i[1]); break;
+        case ServoUnityRemoteMessageType::KeyUp: key_up((uint32_t)msg.i[0], (CKeyType)msg.i[1]); break;
+        case ServoUnityRemoteMessageType::Refresh: refresh(); break;
+        case ServoUnityRemoteMessageType::Reload: reload(); break;
+        case ServoUnityRemoteMessageType::Stop: stop(); break;
+        case ServoUnityRemoteMessageType::GoBack: go_back(); break;
+        case ServoUnityRemoteMessageType::GoForward: go_forward(); break;
+        case ServoUnityRemoteMessageType::LoadURI: if (str) load_uri(str); break;
+        case ServoUnityRemoteMessageType::ContextMenuClosed: on_context_menu_closed((CContextMenuResult)msg.i[0], (uint32_t)msg.i[1]); break;
+        default:
+            fprintf(stderr, "servo_unity_remote_host: Unexpected message %u from plugin.\n", (unsigned int)msg.type);
+            break;
+    }
+    return true;
+}
+
+static uint64_t nowMs(void)
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int main(int argc, char *argv[])
+{
+    prctl(PR_SET_PDEATHSIG, SIGKILL); // Don't outlive Unity, even if it dies mid-frame.
+    signal(SIGPIPE, SIG_IGN);
+
+    struct stat st;
+    if (fstat(SERVO_UNITY_REMOTE_SHM_FD, &st) == -1 || (size_t)st.st_size < servoUnityRemoteSharedSize()) {
+        fprintf(stderr, "servo_unity_remote_host: No shared memory from plugin. This program is started by the servo_unity plugin.\n");
+        return EXIT_FAILURE;
+    }
+    void *mem = mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, SERVO_UNITY_REMOTE_SHM_FD, 0);
+    if (mem == MAP_FAILED) {
+        perror("servo_unity_remote_host: mmap");
+        return EXIT_FAILURE;
+    }
+    s_shared = (ServoUnityRemoteShared *)mem; // Constructed by the plugin.
+    if (s_shared->magic != SERVO_UNITY_REMOTE_MAGIC || s_shared->version != SERVO_UNITY_REMOTE_VERSION) {
+        fprintf(stderr, "servo_unity_remote_host: Plugin protocol version mismatch.\n");
+        return EXIT_FAILURE;
+    }
+    s_wakeupFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (s_wakeupFd == -1) {
+        perror("servo_unity_remote_host: eventfd");
+        return EXIT_FAILURE;
+    }
+    if (!createGLContext()) return EXIT_FAILURE;
+
+    int32_t width = s_shared->width;
+    int32_t height = s_shared->height;
+    std::string args(s_shared->args, strnlen(s_shared->args, SERVO_UNITY_REMOTE_INIT_STRING_SIZE));
+    std::string logModulesList(s_shared->logModules, strnlen(s_shared->logModules, SERVO_UNITY_REMOTE_INIT_STRING_SIZE));
+    std::vector<std::string> logModules;
+    std::vector<const char *> logModulePtrs;
+    for (size_t start = 0; start < logModulesList.size();) {
+        size_t end = logModulesList.find(',', start);
+        if (end == std::string::npos) end = logModulesList.size();
+        if (end > start) logModules.push_back(logModulesList.substr(start, end - start));
+        start = end + 1;
+    }
+    for (const std::string& m : logModules) logModulePtrs.push_back(m.c_str());
+
+    CInitOptions cio {
+        .args = (args.empty() ? nullptr : args.c_str()),
+        .width = width,
+        .height = height,
+        .density = s_shared->density,
+        .vslogger_mod_list = (logModulePtrs.empty() ? nullptr : logModulePtrs.data()),
+        .vslogger_mod_size = (uint32_t)logModulePtrs.size(),
+        .native_widget = nullptr
+    };
+    CHostCallbacks chc {
+        .on_load_started = on_load_started,
+        .on_load_ended = on_load_ended,
+        .on_title_changed = on_title_changed,
+        .on_allow_navigation = on_allow_navigation,
+        .on_url_changed = on_url_changed,
+        .on_history_changed = on_history_changed,
+        .on_animating_changed = on_animating_changed,
+        .on_shutdown_complete = on_shutdown_complete,
+        .on_ime_show = on_ime_show,
+        .on_ime_hide = on_ime_hide,
+        .get_clipboard_contents = get_clipboard_contents,
+        .set_clipboard_contents = set_clipboard_contents,
+        .on_media_session_metadata = on_media_session_metadata,
+        .on_media_session_playback_state_change = on_media_session_playback_state_change,
+        .on_media_session_set_position_state = on_media_session_set_position_state,
+        .prompt_alert = prompt_alert,
+        .prompt_ok_cancel = prompt_ok_cancel,
+        .prompt_yes_no = prompt_yes_no,
+        .prompt_input = prompt_input,
+        .on_devtools_started = on_devtools_started,
+        .show_context_menu = show_context_menu,
+        .on_log_output = on_log_output
+    };
+    init_with_egl(cio, wakeup, chc);
+
+    uint64_t nextAnimationFrameMs = 0;
+    bool running = true;
+    while (running) {
+        int timeout = -1;
+        if (s_animating) {
+            uint64_t now = nowMs();
+            timeout = (nextAnimationFrameMs > now ? (int)(nextAnimationFrameMs - now) : 0);
+        }
+        struct pollfd fds[2] = {{SERVO_UNITY_REMOTE_SOCKET_FD, POLLIN, 0}, {s_wakeupFd, POLLIN, 0}};
+        int n = poll(fds, 2, timeout);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("servo_unity_remote_host: poll");
+            break;
+        }
+
+        bool update = false;
+        bool tasks = false;
+        if (fds[1].revents & POLLIN) {
+            uint64_t count;
+            if (read(s_wakeupFd, &count, sizeof(count)) > 0) update = true;
+        }
+        if (s_animating && nowMs() >= nextAnimationFrameMs) {
+            update = true;
+            nextAnimationFrameMs = nowMs() + ANIMATION_FRAME_MS;
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            char buf[64];
+            ssize_t r = read(SERVO_UNITY_REMOTE_SOCKET_FD, buf, sizeof(buf));
+            if (r == 0 || (r < 0 && errno != EINTR && errno != EAGAIN)) break; // The plugin has gone.
+            s_shared->toHostSignalled.store(false, std::memory_order_release);
+            ServoUnityRemoteMessage msg;
+            while (running && s_shared->toHost.pop(msg)) {
+                running = handle(msg, &width, &height);
+                if (msg.str >= 0) s_shared->toHostStrings.release(msg.str);
+                tasks = true;
+            }
+            if (!running) break;
+        }
+
+        if (update) perform_updates();
+        if (update || tasks) publishFrame(width, height);
+    }
+
+    deinit();
+    destroyGLContext();
+    if (s_messagesDropped) fprintf(stderr, "servo_unity_remote_host: %llu message(s) to the plugin dropped.\n", (unsigned long long)s_messagesDropped.load());
+    return EXIT_SUCCESS;
+}
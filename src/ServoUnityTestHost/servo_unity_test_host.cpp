@@ -0,0 +1,1122 @@
+//
+// servo_unity_test_host.cpp
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0.If a copy of the MPL was not distributed with this
+// file, You can obtain one at https ://mozilla.org/MPL/2.0/.
+//
+// Copyright (c) 2019-2020 Mozilla, Inc.
+//
+// Author(s): Philip Lamb
+//
+// A minimal stand-in for the Unity player, for repeatable performance testing
+// of the plugin outside Unity. It loads the plugin, presents it with mock
+// IUnityInterfaces/IUnityGraphics (OpenGL Core renderer), and then drives it
+// the way ServoUnityController.cs and ServoUnityWindow.cs do:
+//
+// - A "main" thread runs a frame loop at a fixed rate, servicing window events
+//   and issuing render event 1 (window update) for each window every frame,
+//   then render event 2 (cleanup) for each window on quit.
+// - A render thread, which owns the OpenGL context, executes issued render
+//   events in order. As in Unity's multithreaded renderer, the main thread may
+//   run at most one frame ahead of the render thread.
+//
+// At exit it reports the render-thread cost of the plugin per frame, the
+// main-thread cost of the C API calls per frame, and the plugin's own window
+// counters and latency statistics.
+//
+// Usage: servo_unity_test_host [options] path/to/plugin
+//   -hz <n>          Target frame rate. Default 60.
+//   -seconds <n>     Time to run before quitting. Default 10.
+//   -windows <n>     Number of windows. Default 1.
+//   -size <w>x<h>    Window size in pixels. Default 1920x1080.
+//   -url <url>       Navigate each window to this URL once created.
+//   -input <n>       Pointer move events to submit per window per frame. Default 0.
+//   -inputapi <api>  Submit input with one servoUnitySubmitInputEvents call per window per frame
+//                    ("batch", the default) or one servoUnityWindowPointerEvent call per event
+//                    ("single"), and report the main-thread cost per event.
+//   -prewarm         Prewarm the engine (render event 3) before creating windows.
+//   -updateall       Update all windows with a single render event 4 per frame, instead
+//                    of render event 1 per window, and report each window's update time.
+//   -st              Single-threaded rendering: render events run on the main thread.
+//   -csv <path>      Write per-frame timings to a CSV file.
+//   -trace <path>    Record plugin activity and write it as a Chrome trace to <path> at exit.
+//   -loglevel <n>    Plugin log level (0=debug .. 3=error). Default 2.
+//   -servologlevel <level>    Servo's log level (error, warn, info, debug or trace).
+//   -servologmodules <list>   Comma-separated Servo modules to log from.
+//   -quitbudget <ms> Fail if any render event during quit takes longer than <ms>.
+//   -maxlatency <ms> Fail if any window's p95 input-to-texture latency exceeds <ms>.
+//   -allocs          Count heap allocations made by the plugin's input calls once running,
+//                    and fail if there are any.
+//   -remote <path>   Run each window's Servo in a servo_unity_remote_host process at <path> (Linux only).
+//   -copies <n>      Allow up to <n> copies of the simpleservo library for in-process windows
+//                    beyond the first (ServoUnityParam_i_MaxLibraryCopies).
+//   -logbench <n>    Instead of running windows, time <n> log calls from a secondary
+//                    thread with immediate and with deferred log formatting, and exit.
+//   -queuebench <n>  Instead of running windows, pass <n> task records from two producer
+//                    threads to a consumer thread, through a mutex-guarded std::deque of
+//                    std::function (as the plugin once did) and through ServoUnityMPSCQueue,
+//                    and exit. Doesn't need the plugin.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <new>
+#include <dlfcn.h>
+#ifdef __APPLE__
+#  include <OpenGL/OpenGL.h>
+#  include <OpenGL/gl3.h>
+#else
+#  include <EGL/egl.h>
+#  include <EGL/eglext.h>
+#  include <GL/gl.h>
+#endif
+#include "IUnityInterface.h"
+#include "IUnityGraphics.h"
+#include "servo_unity_c.h"
+#include "servo_unity_log.h"
+#include "utils.h"
+#include "ServoUnityMPSCQueue.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static uint64_t usSince(Clock::time_point t0)
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t0).count();
+}
+
+//
+// Heap allocation counting (-allocs). Replaces the global operator new, which the plugin's
+// C++ allocations also resolve to, and counts allocations on any thread which has set a counter.
+//
+
+static thread_local std::atomic<uint64_t> *t_allocCounter = nullptr;
+
+void *operator new(size_t size)
+{
+    if (t_allocCounter) t_allocCounter->fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+// Not inlined, as then GCC mistakes the free() for a mismatched deallocation.
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, size_t size) noexcept
+{
+    free(p);
+}
+
+//
+// The plugin's exported functions, resolved at load time, as Unity does.
+//
+
+#define PLUGIN_FUNCTIONS(X) \
+    X(servoUnityRegisterLogCallback) \
+    X(servoUnitySetLogLevel) \
+    X(servoUnityFlushLog) \
+    X(servoUnityGetVersion) \
+    X(servoUnityInit) \
+    X(servoUnityFinalise) \
+    X(servoUnityRequestNewWindow) \
+    X(servoUnityGetWindowTextureFormat) \
+    X(servoUnitySetWindowUnityTextureID) \
+    X(servoUnityCloseWindow) \
+    X(servoUnityServiceWindowEvents) \
+    X(servoUnityGetWindowCounter) \
+    X(servoUnityGetWindowLatencyStats) \
+    X(servoUnityGetWindowStats) \
+    X(servoUnitySetParamBool) \
+    X(servoUnitySetParamInt) \
+    X(servoUnitySetParamString) \
+    X(servoUnityLog) \
+    X(servoUnityWriteTrace) \
+    X(servoUnityGetRenderEventDataPool) \
+    X(servoUnitySubmitInputEvents) \
+    X(servoUnityWindowPointerEvent) \
+    X(servoUnityWindowBrowserControlEvent)
+
+struct Plugin {
+    void *handle;
+    void (UNITY_INTERFACE_API *UnityPluginLoad)(IUnityInterfaces *);
+    void (UNITY_INTERFACE_API *UnityPluginUnload)(void);
+    UnityRenderingEventAndData (UNITY_INTERFACE_API *GetRenderEventAndDataFunc)(void);
+#define DECLARE_FUNCTION(name) decltype(&::name) name;
+    PLUGIN_FUNCTIONS(DECLARE_FUNCTION)
+#undef DECLARE_FUNCTION
+};
+
+static Plugin s_plugin;
+
+static bool loadPlugin(const char *path)
+{
+    s_plugin.handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!s_plugin.handle) {
+        fprintf(stderr, "Unable to load plugin '%s': %s\n", path, dlerror());
+        return false;
+    }
+    bool ok = true;
+#define RESOLVE_FUNCTION(name) \
+    if (!(*(void **)&s_plugin.name = dlsym(s_plugin.handle, #name))) { fprintf(stderr, "Plugin is missing '%s'.\n", #name); ok = false; }
+    RESOLVE_FUNCTION(UnityPluginLoad)
+    RESOLVE_FUNCTION(UnityPluginUnload)
+    RESOLVE_FUNCTION(GetRenderEventAndDataFunc)
+    PLUGIN_FUNCTIONS(RESOLVE_FUNCTION)
+#undef RESOLVE_FUNCTION
+    return ok;
+}
+
+//
+// Mock Unity interfaces.
+//
+
+static IUnityGraphicsDeviceEventCallback s_deviceEventCallback = NULL;
+static int s_nextEventID = 1000;
+
+static UnityGfxRenderer UNITY_INTERFACE_API graphicsGetRenderer()
+{
+    return kUnityGfxRendererOpenGLCore;
+}
+
+static void UNITY_INTERFACE_API graphicsRegisterDeviceEventCallback(IUnityGraphicsDeviceEventCallback callback)
+{
+    s_deviceEventCallback = callback;
+}
+
+static void UNITY_INTERFACE_API graphicsUnregisterDeviceEventCallback(IUnityGraphicsDeviceEventCallback callback)
+{
+    if (s_deviceEventCallback == callback) s_deviceEventCallback = NULL;
+}
+
+static int UNITY_INTERFACE_API graphicsReserveEventIDRange(int count)
+{
+    int first = s_nextEventID;
+    s_nextEventID += count;
+    return first;
+}
+
+static IUnityGraphics s_graphics;
+
+static IUnityInterface* UNITY_INTERFACE_API interfacesGetInterfaceSplit(unsigned long long guidHigh, unsigned long long guidLow)
+{
+    UnityInterfaceGUID g = GetUnityInterfaceGUID<IUnityGraphics>();
+    if (guidHigh == g.m_GUIDHigh && guidLow == g.m_GUIDLow) return &s_graphics;
+    return NULL;
+}
+
+static IUnityInterface* UNITY_INTERFACE_API interfacesGetInterface(UnityInterfaceGUID guid)
+{
+    return interfacesGetInterfaceSplit(guid.m_GUIDHigh, guid.m_GUIDLow);
+}
+
+static void UNITY_INTERFACE_API interfacesRegisterInterfaceSplit(unsigned long long guidHigh, unsigned long long guidLow, IUnityInterface *ptr)
+{
+}
+
+static void UNITY_INTERFACE_API interfacesRegisterInterface(UnityInterfaceGUID guid, IUnityInterface *ptr)
+{
+}
+
+static IUnityInterfaces s_interfaces;
+
+static void initUnityInterfaces(void)
+{
+    s_graphics.GetRenderer = graphicsGetRenderer;
+    s_graphics.RegisterDeviceEventCallback = graphicsRegisterDeviceEventCallback;
+    s_graphics.UnregisterDeviceEventCallback = graphicsUnregisterDeviceEventCallback;
+    s_graphics.ReserveEventIDRange = graphicsReserveEventIDRange;
+    s_interfaces.GetInterface = interfacesGetInterface;
+    s_interfaces.RegisterInterface = interfacesRegisterInterface;
+    s_interfaces.GetInterfaceSplit = interfacesGetInterfaceSplit;
+    s_interfaces.RegisterInterfaceSplit = interfacesRegisterInterfaceSplit;
+}
+
+//
+// OpenGL context, current on whichever thread renders.
+//
+
+#ifdef __APPLE__
+static CGLContextObj s_cglContext = NULL;
+#else
+static EGLDisplay s_eglDisplay = EGL_NO_DISPLAY;
+static EGLContext s_eglContext = EGL_NO_CONTEXT;
+static EGLSurface s_eglSurface = EGL_NO_SURFACE;
+#endif
+
+static bool createGLContext(void)
+{
+#ifdef __APPLE__
+    CGLPixelFormatAttribute attribs[] = {kCGLPFAOpenGLProfile, (CGLPixelFormatAttribute)kCGLOGLPVersion_3_2_Core, kCGLPFAAccelerated, (CGLPixelFormatAttribute)0};
+    CGLPixelFormatObj pix;
+    GLint npix;
+    if (CGLChoosePixelFormat(attribs, &pix, &npix) != kCGLNoError || !pix) return false;
+    CGLError err = CGLCreateContext(pix, NULL, &s_cglContext);
+    CGLDestroyPixelFormat(pix);
+    if (err != kCGLNoError) return false;
+    return CGLSetCurrentContext(s_cglContext) == kCGLNoError;
+#else
+    // Prefer a surfaceless display, so no window system is needed.
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay) s_eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if (s_eglDisplay == EGL_NO_DISPLAY || !eglInitialize(s_eglDisplay, NULL, NULL)) {
+        s_eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (s_eglDisplay == EGL_NO_DISPLAY || !eglInitialize(s_eglDisplay, NULL, NULL)) {
+            fprintf(stderr, "Unable to initialise EGL.\n");
+            return false;
+        }
+    }
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        fprintf(stderr, "EGL does not support desktop OpenGL.\n");
+        return false;
+    }
+    const EGLint configAttribs[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_NONE};
+    const EGLint configAttribsNoSurface[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+    EGLConfig config;
+    EGLint count = 0;
+    bool pbuffer = eglChooseConfig(s_eglDisplay, configAttribs, &config, 1, &count) && count > 0;
+    if (!pbuffer && (!eglChooseConfig(s_eglDisplay, configAttribsNoSurface, &config, 1, &count) || count == 0)) {
+        fprintf(stderr, "No suitable EGL config.\n");
+        return false;
+    }
+    const EGLint contextAttribs[] = {EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 2, EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE};
+    s_eglContext = eglCreateContext(s_eglDisplay, config, EGL_NO_CONTEXT, contextAttribs);
+    if (s_eglContext == EGL_NO_CONTEXT) s_eglContext = eglCreateContext(s_eglDisplay, config, EGL_NO_CONTEXT, NULL);
+    if (s_eglContext == EGL_NO_CONTEXT) {
+        fprintf(stderr, "Unable to create OpenGL context (EGL error 0x%x).\n", eglGetError());
+        return false;
+    }
+    if (pbuffer) {
+        const EGLint pbufferAttribs[] = {EGL_WIDTH, 16, EGL_HEIGHT, 16, EGL_NONE};
+        s_eglSurface = eglCreatePbufferSurface(s_eglDisplay, config, pbufferAttribs);
+    }
+    if (!eglMakeCurrent(s_eglDisplay, s_eglSurface, s_eglSurface, s_eglContext)) {
+        fprintf(stderr, "Unable to make OpenGL context current (EGL error 0x%x).\n", eglGetError());
+        return false;
+    }
+    return true;
+#endif
+}
+
+static void destroyGLContext(void)
+{
+#ifdef __APPLE__
+    CGLSetCurrentContext(NULL);
+    if (s_cglContext) CGLDestroyContext(s_cglContext);
+    s_cglContext = NULL;
+#else
+    if (s_eglDisplay == EGL_NO_DISPLAY) return;
+    eglMakeCurrent(s_eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (s_eglSurface != EGL_NO_SURFACE) eglDestroySurface(s_eglDisplay, s_eglSurface);
+    if (s_eglContext != EGL_NO_CONTEXT) eglDestroyContext(s_eglDisplay, s_eglContext);
+    eglTerminate(s_eglDisplay);
+    s_eglDisplay = EGL_NO_DISPLAY;
+    s_eglSurface = EGL_NO_SURFACE;
+    s_eglContext = EGL_NO_CONTEXT;
+#endif
+}
+
+//
+// Render thread. Executes commands issued by the main thread, in order.
+//
+
+struct FrameTiming {
+    uint64_t mainUs;   // Main thread time spent in plugin calls.
+    uint64_t renderUs; // Render thread time spent in plugin render events.
+    int events;        // Render events executed.
+};
+
+class RenderThread
+{
+private:
+    struct Command {
+        UnityRenderingEventAndData func; // If non-NULL, a plugin render event.
+        int eventID;
+        void *data;
+        std::function<void(void)> job; // Otherwise, if set, a host job. If neither, end of frame.
+    };
+
+    bool m_singleThreaded;
+    std::thread m_thread;
+    std::mutex m_lock;
+    std::condition_variable m_cond;
+    std::deque<Command> m_commands;
+    bool m_quit;
+    uint64_t m_framesIssued;
+    uint64_t m_framesCompleted; // Guarded by m_lock.
+    bool m_contextOK;
+
+    uint64_t m_frameRenderUs;
+    int m_frameEvents;
+    std::vector<uint64_t> m_frameRenderTimes; // Guarded by m_lock.
+    std::vector<int> m_frameEventCounts; // Guarded by m_lock.
+    std::atomic<uint64_t> m_maxEventUs;
+
+    void execute(Command& cmd) {
+        if (cmd.func) {
+            Clock::time_point t0 = Clock::now();
+            (*cmd.func)(cmd.eventID, cmd.data);
+            uint64_t us = usSince(t0);
+            m_frameRenderUs += us;
+            if (us > m_maxEventUs) m_maxEventUs = us;
+            m_frameEvents++;
+        } else if (cmd.job) {
+            cmd.job();
+        } else {
+            glFlush();
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_frameRenderTimes.push_back(m_frameRenderUs);
+            m_frameEventCounts.push_back(m_frameEvents);
+            m_frameRenderUs = 0;
+            m_frameEvents = 0;
+            m_framesCompleted++;
+            m_cond.notify_all();
+        }
+    }
+
+    void run(std::promise<bool> *started) {
+        m_contextOK = createGLContext();
+        started->set_value(m_contextOK);
+        if (!m_contextOK) return;
+        std::unique_lock<std::mutex> lock(m_lock);
+        while (true) {
+            m_cond.wait(lock, [this]{ return m_quit || !m_commands.empty(); });
+            if (m_commands.empty()) break; // Quit, with all commands executed.
+            Command cmd = std::move(m_commands.front());
+            m_commands.pop_front();
+            lock.unlock();
+            execute(cmd);
+            lock.lock();
+        }
+        lock.unlock();
+        destroyGLContext();
+    }
+
+    void submit(Command cmd) {
+        if (m_singleThreaded) {
+            execute(cmd);
+        } else {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_commands.push_back(std::move(cmd));
+            m_cond.notify_all();
+        }
+    }
+
+public:
+    explicit RenderThread(bool singleThreaded) : m_singleThreaded(singleThreaded), m_quit(false), m_framesIssued(0), m_framesCompleted(0), m_contextOK(false), m_frameRenderUs(0), m_frameEvents(0), m_maxEventUs(0) {}
+
+    bool start() {
+        if (m_singleThreaded) return (m_contextOK = createGLContext());
+        std::promise<bool> started;
+        std::future<bool> f = started.get_future();
+        m_thread = std::thread(&RenderThread::run, this, &started);
+        return f.get();
+    }
+
+    void stop() {
+        if (m_singleThreaded) {
+            if (m_contextOK) destroyGLContext();
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_quit = true;
+            m_cond.notify_all();
+        }
+        if (m_thread.joinable()) m_thread.join();
+    }
+
+    // Equivalent of GL.IssuePluginEventAndData().
+    void issuePluginEventAndData(UnityRenderingEventAndData func, int eventID, void *data) {
+        submit(Command{func, eventID, data, nullptr});
+    }
+
+    // Run a job on the render thread and wait for it to complete, as Unity does for e.g. Texture2D.GetNativeTexturePtr().
+    void runSync(std::function<void(void)> job) {
+        if (m_singleThreaded) {
+            job();
+            return;
+        }
+        std::promise<void> done;
+        std::future<void> f = done.get_future();
+        submit(Command{NULL, 0, NULL, [&job, &done]() { job(); done.set_value(); }});
+        f.get();
+    }
+
+    // Marks the end of a frame's commands. Blocks while the render thread is more than one frame behind.
+    void endFrame() {
+        submit(Command{NULL, 0, NULL, nullptr});
+        m_framesIssued++;
+        if (m_singleThreaded) return;
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_cond.wait(lock, [this]{ return m_framesCompleted + 1 >= m_framesIssued; });
+    }
+
+    // Longest single render event since the last call to resetMaxEventTime(), in microseconds.
+    uint64_t maxEventTime() const { return m_maxEventUs; }
+    void resetMaxEventTime() { m_maxEventUs = 0; }
+
+    void finish() {
+        if (m_singleThreaded) return;
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_cond.wait(lock, [this]{ return m_framesCompleted >= m_framesIssued; });
+    }
+
+    void frameTimings(std::vector<uint64_t>& renderUs, std::vector<int>& events) {
+        std::lock_guard<std::mutex> lock(m_lock);
+        renderUs = m_frameRenderTimes;
+        events = m_frameEventCounts;
+    }
+};
+
+//
+// Host-side window state, as held by ServoUnityWindow.cs.
+//
+
+struct HostWindow {
+    int uid;
+    int windowIndex;
+    int width;
+    int height;
+    GLuint texture;
+    bool shutdown;
+};
+
+// The plugin's render event parameter slots, filled in rotation, as ServoUnityPlugin.cs does.
+struct RenderEventDataPool {
+    ServoUnityRenderEventData *slots = nullptr;
+    int count = 0;
+    int nextSlot = 0;
+
+    ServoUnityRenderEventData *next(int windowIndex, float timeDelta, uint64_t frame, int width = 0, int height = 0) {
+        ServoUnityRenderEventData *d = &slots[nextSlot];
+        nextSlot = (nextSlot + 1) % count;
+        d->windowIndex = windowIndex;
+        d->timeDelta = timeDelta;
+        d->frame = frame;
+        d->width = width;
+        d->height = height;
+        return d;
+    }
+};
+
+static std::map<int, HostWindow> s_hostWindows; // Keyed by uid. Main thread only.
+static std::vector<int> s_pendingTextures; // uids of windows created or resized in the current plugin call.
+static int s_logLevel = 2;
+
+static void SERVO_UNITY_CALLBACK logCallback(const char *msg)
+{
+    fputs(msg, stderr);
+}
+
+static uint64_t s_logBenchMessages = 0;
+
+static void SERVO_UNITY_CALLBACK logBenchCallback(const char *msg)
+{
+    if (msg[0]) s_logBenchMessages++;
+}
+
+// Logs from a secondary thread in batches which fit in the plugin's log ring,
+// flushing on the main thread between batches, as Unity does each frame.
+static void runLogBench(long count)
+{
+    const int batch = 128;
+    s_plugin.servoUnityRegisterLogCallback(logBenchCallback);
+    s_plugin.servoUnitySetLogLevel(SERVO_UNITY_LOG_LEVEL_DEBUG);
+    printf("%ld log calls from a secondary thread, in batches of %d:\n", count, batch);
+    for (int deferred = 0; deferred < 2; deferred++) {
+        s_plugin.servoUnitySetParamBool(ServoUnityParam_b_LogDeferredFormatting, deferred != 0);
+        s_logBenchMessages = 0;
+        uint64_t logNs = 0, flushNs = 0;
+        long logged = 0;
+        while (logged < count) {
+            int n = (int)std::min<long>(batch, count - logged);
+            std::thread t([&logNs, n]() {
+                Clock::time_point t0 = Clock::now();
+                for (int i = 0; i < n; i++) {
+                    s_plugin.servoUnityLog(NULL, SERVO_UNITY_LOG_LEVEL_DEBUG, "servo callback wakeup on thread %" PRIu64 ", window %d, url '%s', scale %f.\n",
+                                           (uint64_t)12345, i, "https://servo.org/", 1.5);
+                }
+                logNs += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t0).count();
+            });
+            t.join();
+            Clock::time_point t0 = Clock::now();
+            s_plugin.servoUnityFlushLog();
+            flushNs += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t0).count();
+            logged += n;
+        }
+        printf("  %-10s %8.1f ns/call on logging thread, %8.1f ns/message at flush. %llu of %ld delivered.\n",
+               (deferred ? "Deferred:" : "Immediate:"), (double)logNs / count, (double)flushNs / count, (unsigned long long)s_logBenchMessages, count);
+    }
+    s_plugin.servoUnitySetParamBool(ServoUnityParam_b_LogDeferredFormatting, false);
+    s_plugin.servoUnityRegisterLogCallback(logCallback);
+    s_plugin.servoUnitySetLogLevel(s_logLevel);
+}
+
+// A task record the size of the plugin's, and a consumer which does a token amount of work with it.
+struct QueueBenchTask {
+    int32_t type;
+    int32_t x;
+    int32_t y;
+    int32_t button;
+    uint64_t timeQueuedNs;
+};
+
+static std::atomic<uint64_t> s_queueBenchSum(0);
+
+static void queueBenchConsume(int32_t x, int32_t y)
+{
+    s_queueBenchSum.fetch_add((uint64_t)(x + y), std::memory_order_relaxed);
+}
+
+// Runs `producers` threads, each calling push(i) `perProducer` times, while the calling thread runs
+// consume() until it returns a negative count. consume() returns how many tasks it ran, and the calling
+// thread yields whenever that is 0. Returns the mean ns per push, and sets *totalNs_p to the total time.
+template <typename P, typename C>
+static double runQueueBenchRound(int producers, long perProducer, P push, C consume, uint64_t *totalNs_p)
+{
+    std::atomic<uint64_t> pushNs(0);
+    std::vector<std::thread> threads;
+    Clock::time_point t0 = Clock::now();
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&pushNs, perProducer, push]() {
+            Clock::time_point t0 = Clock::now();
+            for (long i = 0; i < perProducer; i++) push((int32_t)i);
+            pushNs += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t0).count();
+        });
+    }
+    long n;
+    while ((n = consume()) >= 0) {
+        if (n == 0) std::this_thread::yield();
+    }
+    for (std::thread& t : threads) t.join();
+    *totalNs_p = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t0).count();
+    return (double)pushNs / (producers * perProducer);
+}
+
+// Compares the plugin's task queue with the one it replaced, under contention from two producers
+// (e.g. the main thread and an input thread) and a consumer draining continuously (the render thread).
+static void runQueueBench(long count)
+{
+    const int producers = 2;
+    const long perProducer = count / producers;
+    const long total = perProducer * producers;
+    uint64_t totalNs;
+    printf("%ld task records from %d producer threads to a consumer thread:\n", total, producers);
+
+    {
+        std::deque<std::function<void(void)>> tasks;
+        std::mutex lock;
+        long consumed = 0;
+        double pushNs = runQueueBenchRound(producers, perProducer, [&tasks, &lock](int32_t i) {
+            std::lock_guard<std::mutex> l(lock);
+            tasks.push_back([=]() { queueBenchConsume(i, i); });
+        }, [&]() {
+            // As the plugin did: take the lock once per task.
+            long n = 0;
+            while (true) {
+                std::function<void(void)> task;
+                {
+                    std::lock_guard<std::mutex> l(lock);
+                    if (tasks.empty()) break;
+                    task = tasks.front();
+                    tasks.pop_front();
+                }
+                task();
+                n++;
+            }
+            consumed += n;
+            return (consumed < total ? n : -1L);
+        }, &totalNs);
+        printf("  %-22s %8.1f ns/push, %8.1f ns/task overall.\n", "std::deque+std::mutex:", pushNs, (double)totalNs / total);
+    }
+
+    {
+        static ServoUnityMPSCQueue<QueueBenchTask, 1024> queue;
+        std::atomic<uint64_t> retries(0);
+        long consumed = 0;
+        double pushNs = runQueueBenchRound(producers, perProducer, [&retries](int32_t i) {
+            QueueBenchTask task = {1, i, i, 0, 0};
+            while (!queue.push(task)) { // Full. The plugin drops the task; here, wait for the consumer.
+                retries.fetch_add(1, std::memory_order_relaxed);
+                std::this_thread::yield();
+            }
+        }, [&]() {
+            long n = (long)queue.drain([](const QueueBenchTask& task) { queueBenchConsume(task.x, task.y); });
+            consumed += n;
+            return (consumed < total ? n : -1L);
+        }, &totalNs);
+        printf("  %-22s %8.1f ns/push, %8.1f ns/task overall. Pushes retried when full: %llu.\n", "ServoUnityMPSCQueue:", pushNs, (double)totalNs / total,
+               (unsigned long long)retries.load());
+    }
+}
+
+static void SERVO_UNITY_CALLBACK windowCreatedCallback(int uid, int windowIndex, int pixelWidth, int pixelHeight, int format)
+{
+    HostWindow& w = s_hostWindows[uid];
+    w.uid = uid;
+    w.windowIndex = windowIndex;
+    w.width = pixelWidth;
+    w.height = pixelHeight;
+    w.shutdown = false;
+    if (format != ServoUnityTextureFormat_RGBA32 && format != ServoUnityTextureFormat_BGRA32) {
+        fprintf(stderr, "Window %d requested unsupported texture format %d.\n", windowIndex, format);
+    }
+    s_pendingTextures.push_back(uid);
+}
+
+static void SERVO_UNITY_CALLBACK windowResizedCallback(int uid, int pixelWidth, int pixelHeight)
+{
+    auto it = s_hostWindows.find(uid);
+    if (it == s_hostWindows.end()) return;
+    it->second.width = pixelWidth;
+    it->second.height = pixelHeight;
+    s_pendingTextures.push_back(uid);
+}
+
+static void SERVO_UNITY_CALLBACK browserEventCallback(int uid, int eventType, int eventData1, int eventData2)
+{
+    auto it = s_hostWindows.find(uid);
+    if (it == s_hostWindows.end()) return;
+    if (eventType == ServoUnityBrowserEvent_Shutdown) it->second.shutdown = true;
+}
+
+// (Re)create textures for windows created or resized by the last plugin call, and pass them to the plugin.
+static void createPendingTextures(RenderThread& renderThread)
+{
+    for (int uid : s_pendingTextures) {
+        HostWindow& w = s_hostWindows[uid];
+        GLuint oldTexture = w.texture;
+        GLuint texture = 0;
+        int width = w.width, height = w.height;
+        renderThread.runSync([&]() {
+            if (oldTexture) glDeleteTextures(1, &oldTexture);
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        });
+        w.texture = texture;
+        s_plugin.servoUnitySetWindowUnityTextureID(w.windowIndex, (void *)(uintptr_t)texture);
+    }
+    s_pendingTextures.clear();
+}
+
+static void printPercentiles(const char *label, const utilHistogram& h, const char *unit, double scale)
+{
+    printf("%-28s p50 %8.3f  p95 %8.3f  p99 %8.3f  max %8.3f %s\n", label,
+           h.percentile(0.50) * scale, h.percentile(0.95) * scale, h.percentile(0.99) * scale, h.max() * scale, unit);
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "Usage: %s [-hz n] [-seconds n] [-windows n] [-size WxH] [-url url] [-input n] [-inputapi batch|single] [-prewarm] [-updateall] [-st] [-csv path] [-trace path] [-loglevel n] [-quitbudget ms] [-maxlatency ms] [-allocs] [-servologlevel level] [-servologmodules list] [-remote path] [-copies n] [-logbench n] path/to/plugin\n       %s -queuebench n\n", argv0, argv0);
+}
+
+int main(int argc, char *argv[])
+{
+    double hz = 60.0;
+    double seconds = 10.0;
+    int windowCount = 1;
+    int width = 1920, height = 1080;
+    const char *url = NULL;
+    int inputPerFrame = 0;
+    bool inputBatched = true;
+    bool prewarm = false;
+    bool updateAll = false;
+    bool singleThreaded = false;
+    const char *csvPath = NULL;
+    const char *tracePath = NULL;
+    long logBenchCount = 0;
+    const char *servoLogLevel = NULL;
+    const char *servoLogModules = NULL;
+    const char *remoteHostPath = NULL;
+    int libraryCopiesMax = -1;
+    long queueBenchCount = 0;
+    bool countAllocs = false;
+    double maxLatencyMs = 0.0;
+    double quitBudgetMs = 0.0;
+    const char *pluginPath = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasArg = (i + 1 < argc);
+        if (strcmp(argv[i], "-hz") == 0 && hasArg) hz = atof(argv[++i]);
+        else if (strcmp(argv[i], "-seconds") == 0 && hasArg) seconds = atof(argv[++i]);
+        else if (strcmp(argv[i], "-windows") == 0 && hasArg) windowCount = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-size") == 0 && hasArg) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2) { usage(argv[0]); return EXIT_FAILURE; }
+        }
+        else if (strcmp(argv[i], "-url") == 0 && hasArg) url = argv[++i];
+        else if (strcmp(argv[i], "-input") == 0 && hasArg) inputPerFrame = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-inputapi") == 0 && hasArg) {
+            const char *api = argv[++i];
+            if (strcmp(api, "batch") == 0) inputBatched = true;
+            else if (strcmp(api, "single") == 0) inputBatched = false;
+            else { usage(argv[0]); return EXIT_FAILURE; }
+        }
+        else if (strcmp(argv[i], "-prewarm") == 0) prewarm = true;
+        else if (strcmp(argv[i], "-updateall") == 0) updateAll = true;
+        else if (strcmp(argv[i], "-st") == 0) singleThreaded = true;
+        else if (strcmp(argv[i], "-csv") == 0 && hasArg) csvPath = argv[++i];
+        else if (strcmp(argv[i], "-trace") == 0 && hasArg) tracePath = argv[++i];
+        else if (strcmp(argv[i], "-loglevel") == 0 && hasArg) s_logLevel = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-logbench") == 0 && hasArg) logBenchCount = atol(argv[++i]);
+        else if (strcmp(argv[i], "-servologlevel") == 0 && hasArg) servoLogLevel = argv[++i];
+        else if (strcmp(argv[i], "-servologmodules") == 0 && hasArg) servoLogModules = argv[++i];
+        else if (strcmp(argv[i], "-remote") == 0 && hasArg) remoteHostPath = argv[++i];
+        else if (strcmp(argv[i], "-copies") == 0 && hasArg) libraryCopiesMax = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-quitbudget") == 0 && hasArg) quitBudgetMs = atof(argv[++i]);
+        else if (strcmp(argv[i], "-maxlatency") == 0 && hasArg) maxLatencyMs = atof(argv[++i]);
+        else if (strcmp(argv[i], "-allocs") == 0) countAllocs = true;
+        else if (strcmp(argv[i], "-queuebench") == 0 && hasArg) queueBenchCount = atol(argv[++i]);
+        else if (argv[i][0] != '-' && !pluginPath) pluginPath = argv[i];
+        else { usage(argv[0]); return EXIT_FAILURE; }
+    }
+    if (queueBenchCount > 0) {
+        runQueueBench(queueBenchCount);
+        return EXIT_SUCCESS;
+    }
+    if (!pluginPath || hz <= 0.0 || windowCount < 1 || width < 1 || height < 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (!loadPlugin(pluginPath)) return EXIT_FAILURE;
+    if (logBenchCount > 0) {
+        runLogBench(logBenchCount);
+        return EXIT_SUCCESS;
+    }
+    RenderThread renderThread(singleThreaded);
+    if (!renderThread.start()) return EXIT_FAILURE;
+
+    // Plugin load happens on the main thread, before any rendering.
+    initUnityInterfaces();
+    s_plugin.UnityPluginLoad(&s_interfaces);
+    UnityRenderingEventAndData renderEventFunc = s_plugin.GetRenderEventAndDataFunc();
+    RenderEventDataPool renderEventData;
+    renderEventData.slots = s_plugin.servoUnityGetRenderEventDataPool(&renderEventData.count);
+
+    // Render event 4 parameters, double-buffered as the render thread may be running the previous frame's event.
+    // A block's results are harvested before it is reused.
+    struct UpdateAllBlock {
+        ServoUnityUpdateAllWindowsData data;
+        std::vector<ServoUnityWindowUpdateResult> results;
+    } updateAllBlocks[2];
+    std::map<int, utilHistogram> updateAllHists; // Microseconds, keyed by window index.
+    auto harvestUpdateAll = [&updateAllHists](UpdateAllBlock& b) {
+        if (b.data.resultsFrame != b.data.frame) return;
+        int n = std::min(b.data.windowCount, b.data.resultsCapacity);
+        for (int i = 0; i < n; i++) {
+            if (b.results[i].updated) updateAllHists[b.results[i].windowIndex].record((uint64_t)(b.results[i].updateMs * 1000.0f));
+        }
+        b.data.resultsFrame = UINT64_MAX;
+    };
+    for (UpdateAllBlock& b : updateAllBlocks) {
+        memset(&b.data, 0, sizeof(b.data));
+        b.data.resultsFrame = UINT64_MAX;
+    }
+
+    // ServoUnityController.Awake() / Start().
+    s_plugin.servoUnityRegisterLogCallback(logCallback);
+    s_plugin.servoUnitySetLogLevel(s_logLevel);
+    char version[256];
+    if (s_plugin.servoUnityGetVersion(version, sizeof(version))) printf("Plugin reports version '%s'.\n", version);
+    s_plugin.servoUnityInit(windowCreatedCallback, windowResizedCallback, browserEventCallback);
+    if (tracePath) s_plugin.servoUnitySetParamBool(ServoUnityParam_b_Trace, true);
+    if (servoLogLevel) s_plugin.servoUnitySetParamString(ServoUnityParam_s_ServoLogLevel, servoLogLevel);
+    if (servoLogModules) s_plugin.servoUnitySetParamString(ServoUnityParam_s_ServoLogModules, servoLogModules);
+    if (remoteHostPath) s_plugin.servoUnitySetParamString(ServoUnityParam_s_RemoteHost, remoteHostPath);
+    if (libraryCopiesMax >= 0) s_plugin.servoUnitySetParamInt(ServoUnityParam_i_MaxLibraryCopies, libraryCopiesMax);
+
+    // As during a loading screen, let prewarming complete before creating windows.
+    if (prewarm) {
+        renderThread.issuePluginEventAndData(renderEventFunc, 3, renderEventData.next(0, 0.0f, 0, width, height));
+        renderThread.endFrame();
+        renderThread.finish();
+    }
+
+    // ServoUnityWindow.Start().
+    Clock::time_point tStart = Clock::now();
+    for (int i = 0; i < windowCount; i++) {
+        if (!s_plugin.servoUnityRequestNewWindow(i + 1, width, height)) {
+            fprintf(stderr, "Unable to create window %d.\n", i + 1);
+            renderThread.stop();
+            return EXIT_FAILURE;
+        }
+        createPendingTextures(renderThread);
+    }
+    s_plugin.servoUnityFlushLog();
+
+    // Frame loop.
+    const std::chrono::nanoseconds framePeriod((long long)(1e9 / hz));
+    const long frameCount = (long)(seconds * hz);
+    std::vector<uint64_t> mainTimes;
+    mainTimes.reserve(frameCount);
+    std::vector<ServoUnityInputEvent> inputEvents(inputPerFrame > 0 ? inputPerFrame : 0);
+    float timeDelta = (float)(1.0 / hz);
+    long late = 0;
+    std::atomic<uint64_t> inputAllocs(0);
+    uint64_t inputAllocsEvents = 0;
+    uint64_t inputNs = 0, inputTimedEvents = 0;
+    Clock::time_point frameDeadline = Clock::now() + framePeriod;
+    for (long frame = 0; frame < frameCount; frame++) {
+        Clock::time_point t0 = Clock::now();
+        // The plugin ignores navigation until Servo has started in the window's first update,
+        // which has completed by the time frame 2 starts.
+        if (url && frame == 2) {
+            for (auto& w : s_hostWindows) s_plugin.servoUnityWindowBrowserControlEvent(w.second.windowIndex, ServoUnityWindowBrowserControlEventID_Navigate, 0, 0, url);
+        }
+        for (auto& w : s_hostWindows) {
+            int windowIndex = w.second.windowIndex;
+            // ServoUnityPointer: sweep the pointer across the window.
+            if (inputPerFrame > 0) {
+                for (int j = 0; j < inputPerFrame; j++) {
+                    ServoUnityInputEvent& e = inputEvents[j];
+                    memset(&e, 0, sizeof(e));
+                    e.timestamp = (int64_t)usSince(tStart);
+                    e.type = ServoUnityInputEventType_Pointer;
+                    e.eventID = ServoUnityPointerEventID_Over;
+                    e.windowX = (int32_t)((frame * inputPerFrame + j) % w.second.width);
+                    e.windowY = w.second.height / 2;
+                }
+                // Once Servo has started and navigated (see below), input should never touch the heap.
+                bool count = (countAllocs && frame > 2);
+                if (count) t_allocCounter = &inputAllocs;
+                Clock::time_point tInput = Clock::now();
+                if (inputBatched) {
+                    s_plugin.servoUnitySubmitInputEvents(windowIndex, inputEvents.data(), inputPerFrame);
+                } else {
+                    for (const ServoUnityInputEvent& e : inputEvents) s_plugin.servoUnityWindowPointerEvent(windowIndex, e.param0, e.param1, e.eventID, e.windowX, e.windowY);
+                }
+                uint64_t ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - tInput).count();
+                t_allocCounter = nullptr;
+                if (count) inputAllocsEvents += inputPerFrame;
+                if (frame > 2) {
+                    inputNs += ns;
+                    inputTimedEvents += inputPerFrame;
+                }
+            }
+            // ServoUnityWindow.Update().
+            s_plugin.servoUnityServiceWindowEvents(windowIndex);
+            if (!updateAll) renderThread.issuePluginEventAndData(renderEventFunc, 1, renderEventData.next(windowIndex, timeDelta, frame));
+        }
+        if (updateAll) {
+            UpdateAllBlock& b = updateAllBlocks[frame % 2];
+            harvestUpdateAll(b);
+            b.results.resize(s_hostWindows.size());
+            b.data.timeDelta = timeDelta;
+            b.data.frame = (uint64_t)frame;
+            b.data.results = b.results.data();
+            b.data.resultsCapacity = (int32_t)b.results.size();
+            renderThread.issuePluginEventAndData(renderEventFunc, 4, &b.data);
+        }
+        createPendingTextures(renderThread);
+        // ServoUnityController.Update().
+        s_plugin.servoUnityFlushLog();
+        mainTimes.push_back(usSince(t0));
+        renderThread.endFrame();
+
+        // Pace to the target rate. If we've fallen behind, don't try to catch up.
+        Clock::time_point now = Clock::now();
+        if (now < frameDeadline) {
+            std::this_thread::sleep_until(frameDeadline);
+            frameDeadline += framePeriod;
+        } else {
+            late++;
+            frameDeadline = now + framePeriod;
+        }
+    }
+    renderThread.finish();
+    for (UpdateAllBlock& b : updateAllBlocks) harvestUpdateAll(b);
+
+    // Read counters before shutdown.
+    struct WindowReport {
+        int windowIndex;
+        uint64_t counters[ServoUnityWindowCounter_Max];
+        ServoUnityLatencyStats latency[ServoUnityLatencyStage_Max];
+        bool hasLatency[ServoUnityLatencyStage_Max];
+        ServoUnityWindowStats stats;
+        bool hasStats;
+    };
+    std::vector<WindowReport> reports;
+    for (auto& w : s_hostWindows) {
+        WindowReport r;
+        r.windowIndex = w.second.windowIndex;
+        for (int c = 0; c < ServoUnityWindowCounter_Max; c++) r.counters[c] = s_plugin.servoUnityGetWindowCounter(r.windowIndex, c);
+        for (int s = 0; s < ServoUnityLatencyStage_Max; s++) r.hasLatency[s] = s_plugin.servoUnityGetWindowLatencyStats(r.windowIndex, s, &r.latency[s]);
+        r.hasStats = s_plugin.servoUnityGetWindowStats(r.windowIndex, &r.stats);
+        reports.push_back(r);
+    }
+
+    // ServoUnityController.OnApplicationQuit().
+    renderThread.resetMaxEventTime();
+    Clock::time_point tQuit = Clock::now();
+    for (auto& w : s_hostWindows) {
+        renderThread.issuePluginEventAndData(renderEventFunc, 2, renderEventData.next(w.second.windowIndex, 0.0f, frameCount));
+    }
+    renderThread.endFrame();
+    bool allShutdown;
+    do {
+        allShutdown = true;
+        for (auto& w : s_hostWindows) {
+            if (w.second.shutdown) continue;
+            allShutdown = false;
+            renderThread.issuePluginEventAndData(renderEventFunc, 1, renderEventData.next(w.second.windowIndex, 0.0f, frameCount));
+        }
+        renderThread.endFrame();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        for (auto& w : s_hostWindows) s_plugin.servoUnityServiceWindowEvents(w.second.windowIndex);
+    } while (!allShutdown && usSince(tQuit) < 2500000);
+    renderThread.finish();
+    uint64_t quitUs = usSince(tQuit);
+    uint64_t quitMaxEventUs = renderThread.maxEventTime();
+    if (!allShutdown) fprintf(stderr, "Timed out waiting for browser shutdown.\n");
+    if (tracePath) {
+        s_plugin.servoUnitySetParamBool(ServoUnityParam_b_Trace, false);
+        if (!s_plugin.servoUnityWriteTrace(tracePath)) fprintf(stderr, "Unable to write trace to '%s'.\n", tracePath);
+    }
+    s_plugin.servoUnityFlushLog();
+    for (auto& w : s_hostWindows) s_plugin.servoUnityCloseWindow(w.second.windowIndex);
+    s_plugin.servoUnityFinalise();
+
+    // Device shutdown happens on the render thread, with the context current.
+    renderThread.runSync([]() {
+        for (auto& w : s_hostWindows) if (w.second.texture) glDeleteTextures(1, &w.second.texture);
+        if (s_deviceEventCallback) s_deviceEventCallback(kUnityGfxDeviceEventShutdown);
+    });
+    s_plugin.UnityPluginUnload();
+    s_plugin.servoUnityFlushLog();
+    renderThread.stop();
+
+    // Report.
+    std::vector<uint64_t> renderTimes;
+    std::vector<int> eventCounts;
+    renderThread.frameTimings(renderTimes, eventCounts);
+    utilHistogram renderHist, mainHist;
+    const uint64_t framePeriodUs = (uint64_t)(1e6 / hz);
+    const size_t offset = (prewarm ? 1 : 0); // Skip the prewarm frame.
+    long overBudget = 0;
+    for (size_t i = 0; i < mainTimes.size() && i + offset < renderTimes.size(); i++) {
+        renderHist.record(renderTimes[i + offset]);
+        if (renderTimes[i + offset] > framePeriodUs) overBudget++;
+    }
+    for (uint64_t t : mainTimes) mainHist.record(t);
+
+    printf("%ld frames at %.1f Hz, %d window(s) of %dx%d, %s rendering, %d input events/window/frame.\n",
+           frameCount, hz, windowCount, width, height, (singleThreaded ? "single-threaded" : "multithreaded"), inputPerFrame);
+    printPercentiles("Render thread cost/frame:", renderHist, "ms", 0.001);
+    printPercentiles("Main thread cost/frame:", mainHist, "ms", 0.001);
+    printf("Frames where plugin render cost exceeded the frame period: %ld. Frames that started late: %ld.\n", overBudget, late);
+    uint64_t firstFrameUsMax = 0, firstFrameUsSum = 0;
+    int firstFrameCount = 0;
+    for (auto& r : reports) {
+        uint64_t us = r.counters[ServoUnityWindowCounter_TimeToFirstFrameUs];
+        if (!us) continue;
+        firstFrameUsSum += us;
+        firstFrameUsMax = std::max(firstFrameUsMax, us);
+        firstFrameCount++;
+    }
+    if (firstFrameCount > 0) {
+        printf("Time to first frame (%s): mean %.3f ms, max %.3f ms, over %d of %zu window(s).", (prewarm ? "prewarmed" : "not prewarmed"),
+               firstFrameUsSum / 1000.0 / firstFrameCount, firstFrameUsMax / 1000.0, firstFrameCount, reports.size());
+        if (prewarm && !renderTimes.empty()) printf(" Prewarm render event: %.3f ms.", renderTimes[0] / 1000.0);
+        printf("\n");
+    } else {
+        printf("Time to first frame (%s): no window produced a frame.\n", (prewarm ? "prewarmed" : "not prewarmed"));
+    }
+    printf("Quit to browser shutdown: %.3f ms. Longest render event during quit: %.3f ms.\n", quitUs / 1000.0, quitMaxEventUs / 1000.0);
+    if (inputTimedEvents > 0) {
+        printf("Input submission (%s): %.1f ns/event, over %llu events.\n", (inputBatched ? "batched" : "single calls"),
+               (double)inputNs / inputTimedEvents, (unsigned long long)inputTimedEvents);
+    }
+    bool failed = false;
+    if (quitBudgetMs > 0.0) {
+        if (!allShutdown) {
+            fprintf(stderr, "FAIL: browser shutdown did not complete.\n");
+            failed = true;
+        }
+        if (quitMaxEventUs > quitBudgetMs * 1000.0) {
+            fprintf(stderr, "FAIL: a render event during quit took %.3f ms, exceeding %.3f ms.\n", quitMaxEventUs / 1000.0, quitBudgetMs);
+            failed = true;
+        }
+    }
+    if (countAllocs) {
+        printf("Heap allocations in input calls: %llu, for %llu input events.\n", (unsigned long long)inputAllocs.load(), (unsigned long long)inputAllocsEvents);
+        if (inputAllocs > 0) {
+            fprintf(stderr, "FAIL: input calls allocated from the heap.\n");
+            failed = true;
+        }
+        if (inputAllocsEvents == 0) fprintf(stderr, "No input events were counted. Use -input <n> with -allocs.\n");
+    }
+    static const char *counterNames[ServoUnityWindowCounter_Max] = {
+        "PointerMovesCoalesced", "ScrollsCoalesced", "InputEventsCoalescedLastFrame", "LatencySamplesDropped",
+        "TasksDeferred", "TasksDeferredLastFrame", "TextureFillsPerformed", "TextureFillsSkipped", "TimeToFirstFrameUs"
+    };
+    static const char *stageNames[ServoUnityLatencyStage_Max] = {"Queue", "Update", "Fill", "Total"};
+    for (auto& r : reports) {
+        printf("Window %d:\n", r.windowIndex);
+        if (r.hasStats) {
+            const ServoUnityWindowStats& st = r.stats;
+            printf("  %llu render events, %llu skipped. perform_updates: %llu, mean %.3f ms, max %.3f ms. Texture fills: %llu, mean %.3f ms, max %.3f ms.\n",
+                   (unsigned long long)st.renderEvents, (unsigned long long)st.framesSkipped,
+                   (unsigned long long)st.performUpdatesCount, st.performUpdatesCount ? st.performUpdatesTotalUs / 1000.0 / st.performUpdatesCount : 0.0, st.performUpdatesMaxUs / 1000.0,
+                   (unsigned long long)st.fillCount, st.fillCount ? st.fillTotalUs / 1000.0 / st.fillCount : 0.0, st.fillMaxUs / 1000.0);
+            printf("  Task queue depth %llu (high water %llu). Browser event queue depth %llu. %llu wakeups (%.1f/s).\n",
+                   (unsigned long long)st.taskQueueDepth, (unsigned long long)st.taskQueueHighWater, (unsigned long long)st.browserEventQueueDepth,
+                   (unsigned long long)st.wakeups, st.wakeupsPerSecond);
+        }
+        auto h = updateAllHists.find(r.windowIndex);
+        if (h != updateAllHists.end()) printPercentiles("  Update time (event 4):", h->second, "ms", 0.001);
+        for (int c = 0; c < ServoUnityWindowCounter_Max; c++) printf("  %-30s %llu\n", counterNames[c], (unsigned long long)r.counters[c]);
+        for (int s = 0; s < ServoUnityLatencyStage_Max; s++) {
+            if (!r.hasLatency[s] || r.latency[s].count == 0) continue;
+            printf("  Input latency %-7s (n=%llu) p50 %.3f p95 %.3f p99 %.3f max %.3f ms\n", stageNames[s], (unsigned long long)r.latency[s].count,
+                   r.latency[s].p50Ms, r.latency[s].p95Ms, r.latency[s].p99Ms, r.latency[s].maxMs);
+        }
+        if (maxLatencyMs > 0.0) {
+            const ServoUnityLatencyStats& total = r.latency[ServoUnityLatencyStage_Total];
+            if (!r.hasLatency[ServoUnityLatencyStage_Total] || total.count == 0) {
+                fprintf(stderr, "FAIL: window %d recorded no input latency. Use -input <n> with -maxlatency.\n", r.windowIndex);
+                failed = true;
+            } else if (total.p95Ms > maxLatencyMs) {
+                fprintf(stderr, "FAIL: window %d p95 input latency %.3f ms exceeds %.3f ms.\n", r.windowIndex, total.p95Ms, maxLatencyMs);
+                failed = true;
+            }
+        }
+    }
+
+    if (csvPath) {
+        FILE *fp = fopen(csvPath, "w");
+        if (!fp) {
+            fprintf(stderr, "Unable to open '%s' for writing: %s\n", csvPath, strerror(errno));
+        } else {
+            fprintf(fp, "frame,main_us,render_us,render_events\n");
+            for (size_t i = 0; i < mainTimes.size() && i + offset < renderTimes.size(); i++) {
+                fprintf(fp, "%zu,%llu,%llu,%d\n", i, (unsigned long long)mainTimes[i], (unsigned long long)renderTimes[i + offset], eventCounts[i + offset]);
+            }
+            fclose(fp);
+        }
+    }
+
+    dlclose(s_plugin.handle);
+    return (failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,620 @@
+//
+// simpleservo_stub.cpp
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0.If a copy of the MPL was not distributed with this
+// file, You can obtain one at https ://mozilla.org/MPL/2.0/.
+//
+// Copyright (c) 2019-2020 Mozilla, Inc.
+//
+// Author(s): Philip Lamb
+//
+// A stand-in for libsimpleservo2 which implements the whole simpleservo.h
+// interface without a browser engine, so that the plugin's own overhead can be
+// measured and load-tested on machines without a Servo build (including
+// GPU-less Linux machines using Mesa's software GL).
+//
+// An "engine" thread stands in for Servo's own threads. It plays out page loads
+// and shutdown with configurable delays, and produces synthetic frames, calling
+// wakeup() whenever the embedder should call perform_updates(). As with real
+// Servo, host callbacks other than wakeup() are delivered from perform_updates()
+// on the embedder's thread, unless SIMPLESERVO_STUB_CALLBACK_THREAD=engine.
+//
+// Behaviour is configured by environment variables, read in init_with_gl():
+//   SIMPLESERVO_STUB_FRAME_US     Simulated cost of producing a frame in perform_updates(). Default 0.
+//   SIMPLESERVO_STUB_FILL_US      Simulated extra cost of fill_gl_texture(), beyond the real upload. Default 0.
+//   SIMPLESERVO_STUB_LOAD_MS      Time from load_uri() to load complete. Default 50.
+//   SIMPLESERVO_STUB_SHUTDOWN_MS  Time from request_shutdown() to shutdown complete. Default 20.
+//   SIMPLESERVO_STUB_ANIMATE_HZ   If non-zero, pages "animate" after loading, producing frames at this rate. Default 0.
+//   SIMPLESERVO_STUB_CALLBACK_THREAD  "embedder" (default) or "engine".
+//   SIMPLESERVO_STUB_UPLOAD       If 0, fill_gl_texture() doesn't touch GL at all. Default 1.
+//   SIMPLESERVO_STUB_VERBOSE      If 1, print call counts at deinit(). Default 0.
+//
+// Servo's logging is emulated: "--vslogger-level" in CInitOptions.args and
+// CInitOptions.vslogger_mod_list filter a few representative messages (page
+// loads from "constellation" at info level, each frame from "compositing" at
+// debug level), which are passed to on_log_output.
+//
+
+#include "simpleservo.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __APPLE__
+#  include <OpenGL/gl3.h>
+#else
+#  define GL_GLEXT_PROTOTYPES
+#  include <GL/gl.h>
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+namespace {
+
+struct Config {
+    long frameUs = 0;
+    long fillUs = 0;
+    long loadMs = 50;
+    long shutdownMs = 20;
+    long animateHz = 0;
+    bool callbacksOnEngineThread = false;
+    bool upload = true;
+    bool verbose = false;
+    int logLevel = 1; // 0 error, 1 warn, 2 info, 3 debug, 4 trace.
+    std::vector<std::string> logModules; // Empty means all.
+};
+
+struct Counts {
+    std::atomic<uint64_t> performUpdates{0};
+    std::atomic<uint64_t> framesProduced{0};
+    std::atomic<uint64_t> fills{0};
+    std::atomic<uint64_t> inputEvents{0};
+    std::atomic<uint64_t> wakeups{0};
+    std::atomic<uint64_t> loads{0};
+};
+
+struct Timer {
+    Clock::time_point when;
+    std::function<void(void)> fn;
+};
+
+Config s_config;
+Counts s_counts;
+void (*s_wakeup)(void) = nullptr;
+CHostCallbacks s_callbacks;
+std::atomic<int32_t> s_width{0};
+std::atomic<int32_t> s_height{0};
+
+// Engine thread state.
+std::thread *s_engineThread = nullptr; // Never destroyed by static destructors, in case the embedder exits without calling deinit().
+std::mutex s_engineLock;
+std::condition_variable s_engineCond;
+bool s_engineQuit = false;
+std::vector<Timer> s_timers; // Guarded by s_engineLock.
+Clock::time_point s_nextAnimationFrame;
+bool s_animating = false; // Guarded by s_engineLock.
+
+// Work for the embedder thread, delivered from perform_updates().
+std::mutex s_pendingLock;
+std::deque<std::function<void(void)>> s_pendingCallbacks;
+std::atomic<bool> s_frameRequested{false};
+std::atomic<uint64_t> s_frameNumber{0};
+
+// Page state. Only touched on whichever thread callbacks are delivered on.
+std::vector<std::string> s_history;
+size_t s_historyIndex = 0;
+
+// Pointer state, used to draw a cursor into synthetic frames.
+std::atomic<int32_t> s_pointerX{-1};
+std::atomic<int32_t> s_pointerY{-1};
+
+std::vector<uint8_t> s_pixels;
+int32_t s_pixelsWidth = 0;
+int32_t s_pixelsHeight = 0;
+std::vector<uint8_t> s_marker; // White, for the bar and cursor.
+
+std::map<std::string, std::string> s_prefs; // All prefs stored as strings.
+std::string s_prefValue;
+bool s_prefBool;
+double s_prefFloat;
+int64_t s_prefInt;
+
+long envLong(const char *name, long def)
+{
+    const char *v = getenv(name);
+    return (v && *v ? strtol(v, nullptr, 10) : def);
+}
+
+void spinFor(long us)
+{
+    if (us <= 0) return;
+    Clock::time_point end = Clock::now() + std::chrono::microseconds(us);
+    while (Clock::now() < end) {}
+}
+
+const char *const kLogLevelNames[] = {"error", "warn", "info", "debug", "trace"};
+
+// As Servo's vslogger: filtered by level and module prefix, and output from whichever thread logs.
+void servoLog(int level, const char *module, const char *format, ...)
+{
+    if (level > s_config.logLevel || !s_callbacks.on_log_output) return;
+    if (!s_config.logModules.empty()) {
+        bool found = false;
+        for (auto& m : s_config.logModules) if (strncmp(module, m.c_str(), m.size()) == 0) { found = true; break; }
+        if (!found) return;
+    }
+    char buf[512];
+    int len = snprintf(buf, sizeof(buf), "%s %s: ", kLogLevelNames[level], module);
+    va_list ap;
+    va_start(ap, format);
+    vsnprintf(buf + len, sizeof(buf) - len, format, ap);
+    va_end(ap);
+    s_callbacks.on_log_output(buf, (uint32_t)strlen(buf));
+}
+
+void wakeEmbedder(void)
+{
+    s_counts.wakeups++;
+    if (s_wakeup) (*s_wakeup)();
+}
+
+// Run fn on the callback thread: queued for perform_updates() (the default), or immediately on the engine thread.
+void deliver(std::function<void(void)> fn)
+{
+    if (s_config.callbacksOnEngineThread) {
+        fn();
+    } else {
+        {
+            std::lock_guard<std::mutex> lock(s_pendingLock);
+            s_pendingCallbacks.push_back(std::move(fn));
+        }
+        wakeEmbedder();
+    }
+}
+
+void requestFrame(void)
+{
+    s_frameRequested = true;
+    wakeEmbedder();
+}
+
+// Must be called with s_engineLock held.
+void scheduleLocked(long ms, std::function<void(void)> fn)
+{
+    s_timers.push_back({Clock::now() + std::chrono::milliseconds(ms), std::move(fn)});
+    s_engineCond.notify_one();
+}
+
+void schedule(long ms, std::function<void(void)> fn)
+{
+    std::lock_guard<std::mutex> lock(s_engineLock);
+    scheduleLocked(ms, std::move(fn));
+}
+
+void engineThread(void)
+{
+    std::unique_lock<std::mutex> lock(s_engineLock);
+    while (!s_engineQuit) {
+        Clock::time_point now = Clock::now();
+        Clock::time_point next = now + std::chrono::seconds(1);
+
+        // Fire due timers. Callbacks run without the lock held, as they may schedule more work.
+        std::vector<Timer> due;
+        for (auto it = s_timers.begin(); it != s_timers.end();) {
+            if (it->when <= now) {
+                due.push_back(std::move(*it));
+                it = s_timers.erase(it);
+            } else {
+                if (it->when < next) next = it->when;
+                ++it;
+            }
+        }
+        if (s_animating) {
+            if (s_nextAnimationFrame <= now) {
+                requestFrame();
+                s_nextAnimationFrame = now + std::chrono::microseconds(1000000 / s_config.animateHz);
+            }
+            if (s_nextAnimationFrame < next) next = s_nextAnimationFrame;
+        }
+        if (!due.empty()) {
+            lock.unlock();
+            for (auto& t : due) t.fn();
+            lock.lock();
+            continue;
+        }
+        s_engineCond.wait_until(lock, next);
+    }
+}
+
+void setAnimating(bool animating)
+{
+    {
+        std::lock_guard<std::mutex> lock(s_engineLock);
+        if (s_animating == animating) return;
+        s_animating = animating;
+        s_nextAnimationFrame = Clock::now();
+        s_engineCond.notify_one();
+    }
+    deliver([animating]() {
+        if (s_callbacks.on_animating_changed) s_callbacks.on_animating_changed(animating);
+    });
+}
+
+// Plays out a page load. Called on the engine thread.
+void startLoad(const std::string& url, bool pushHistory)
+{
+    s_counts.loads++;
+    servoLog(2, "constellation", "Loading %s", url.c_str());
+    deliver([]() {
+        if (s_callbacks.on_load_started) s_callbacks.on_load_started();
+    });
+    schedule(s_config.loadMs, [url, pushHistory]() {
+        deliver([url, pushHistory]() {
+            if (pushHistory) {
+                if (!s_history.empty()) s_history.resize(s_historyIndex + 1);
+                s_history.push_back(url);
+                s_historyIndex = s_history.size() - 1;
+            }
+            std::string title = "Stub: " + url;
+            if (s_callbacks.on_url_changed) s_callbacks.on_url_changed(url.c_str());
+            if (s_callbacks.on_title_changed) s_callbacks.on_title_changed(title.c_str());
+            if (s_callbacks.on_history_changed) s_callbacks.on_history_changed(s_historyIndex > 0, s_historyIndex + 1 < s_history.size());
+            if (s_callbacks.on_load_ended) s_callbacks.on_load_ended();
+        });
+        servoLog(2, "constellation", "Load of %s complete", url.c_str());
+        requestFrame();
+        if (s_config.animateHz > 0) setAnimating(true);
+    });
+}
+
+void input(void)
+{
+    s_counts.inputEvents++;
+    requestFrame();
+}
+
+// The background gradient only changes with size, so is generated once and then reused.
+void drawBackground(int32_t w, int32_t h)
+{
+    if (s_pixelsWidth == w && s_pixelsHeight == h) return;
+    s_pixels.resize((size_t)w * (size_t)h * 4);
+    uint8_t *p = s_pixels.data();
+    for (int32_t y = 0; y < h; y++) {
+        for (int32_t x = 0; x < w; x++) {
+            p[0] = (uint8_t)(x * 255 / w);
+            p[1] = (uint8_t)(y * 255 / h);
+            p[2] = 64;
+            p[3] = 255;
+            p += 4;
+        }
+    }
+    s_pixelsWidth = w;
+    s_pixelsHeight = h;
+    s_marker.assign((size_t)(h > 64 ? h : 64) * 4, 255); // At least 8x8 pixels.
+}
+
+} // namespace
+
+// --------------------------------------------------------------------------
+//  Lifecycle.
+
+void init_with_gl(CInitOptions opts, void (*wakeup)(void), CHostCallbacks callbacks)
+{
+    if (s_engineThread) {
+        fprintf(stderr, "simpleservo-stub: init_with_gl called while already inited.\n");
+        return;
+    }
+    s_config.frameUs = envLong("SIMPLESERVO_STUB_FRAME_US", 0);
+    s_config.fillUs = envLong("SIMPLESERVO_STUB_FILL_US", 0);
+    s_config.loadMs = envLong("SIMPLESERVO_STUB_LOAD_MS", 50);
+    s_config.shutdownMs = envLong("SIMPLESERVO_STUB_SHUTDOWN_MS", 20);
+    s_config.animateHz = envLong("SIMPLESERVO_STUB_ANIMATE_HZ", 0);
+    const char *ct = getenv("SIMPLESERVO_STUB_CALLBACK_THREAD");
+    s_config.callbacksOnEngineThread = (ct && strcmp(ct, "engine") == 0);
+    s_config.upload = envLong("SIMPLESERVO_STUB_UPLOAD", 1) != 0;
+    s_config.verbose = envLong("SIMPLESERVO_STUB_VERBOSE", 0) != 0;
+    s_config.logLevel = 1;
+    const char *ll = (opts.args ? strstr(opts.args, "--vslogger-level ") : nullptr);
+    if (ll) {
+        ll += strlen("--vslogger-level ");
+        for (int i = 0; i < 5; i++) {
+            size_t n = strlen(kLogLevelNames[i]);
+            if (strncmp(ll, kLogLevelNames[i], n) == 0 && (ll[n] == '\0' || ll[n] == ' ')) s_config.logLevel = i;
+        }
+    }
+    s_config.logModules.clear();
+    for (uint32_t i = 0; i < opts.vslogger_mod_size; i++) s_config.logModules.push_back(opts.vslogger_mod_list[i]);
+
+    s_wakeup = wakeup;
+    s_callbacks = callbacks;
+    s_width = opts.width;
+    s_height = opts.height;
+    s_history.clear();
+    s_historyIndex = 0;
+    s_frameNumber = 0;
+    s_frameRequested = true;
+    s_engineQuit = false;
+    s_animating = false;
+    s_engineThread = new std::thread(engineThread);
+    wakeEmbedder();
+}
+
+void init_with_egl(CInitOptions opts, void (*wakeup)(void), CHostCallbacks callbacks)
+{
+    init_with_gl(opts, wakeup, callbacks);
+}
+
+void request_shutdown(void)
+{
+    setAnimating(false);
+    schedule(s_config.shutdownMs, []() {
+        deliver([]() {
+            if (s_callbacks.on_shutdown_complete) s_callbacks.on_shutdown_complete();
+        });
+    });
+}
+
+void deinit(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(s_engineLock);
+        s_engineQuit = true;
+        s_timers.clear();
+        s_engineCond.notify_one();
+    }
+    if (s_engineThread) {
+        s_engineThread->join();
+        delete s_engineThread;
+        s_engineThread = nullptr;
+    }
+    {
+        std::lock_guard<std::mutex> lock(s_pendingLock);
+        s_pendingCallbacks.clear();
+    }
+    if (s_config.verbose) {
+        fprintf(stderr, "simpleservo-stub: %llu perform_updates, %llu frames, %llu fills, %llu input events, %llu wakeups, %llu loads.\n",
+                (unsigned long long)s_counts.performUpdates, (unsigned long long)s_counts.framesProduced, (unsigned long long)s_counts.fills,
+                (unsigned long long)s_counts.inputEvents, (unsigned long long)s_counts.wakeups, (unsigned long long)s_counts.loads);
+    }
+    s_wakeup = nullptr;
+    memset(&s_callbacks, 0, sizeof(s_callbacks));
+}
+
+const char *servo_version(void)
+{
+    return strdup("simpleservo-stub 1.0"); // Leaks, as documented for the real library.
+}
+
+void register_panic_handler(void (*on_panic)(const char*))
+{
+}
+
+// --------------------------------------------------------------------------
+//  Rendering.
+
+void perform_updates(void)
+{
+    s_counts.performUpdates++;
+    std::deque<std::function<void(void)>> pending;
+    {
+        std::lock_guard<std::mutex> lock(s_pendingLock);
+        pending.swap(s_pendingCallbacks);
+    }
+    for (auto& fn : pending) fn();
+
+    if (s_frameRequested.exchange(false)) {
+        spinFor(s_config.frameUs);
+        s_frameNumber++;
+        s_counts.framesProduced++;
+        servoLog(3, "compositing::compositor", "Composited frame %llu", (unsigned long long)s_frameNumber.load());
+    }
+}
+
+void fill_gl_texture(uint32_t tex_id, int32_t tex_width, int32_t tex_height)
+{
+    s_counts.fills++;
+    spinFor(s_config.fillUs);
+    if (!s_config.upload || !tex_id || tex_width <= 0 || tex_height <= 0) return;
+
+    // A full-size upload, standing in for Servo's copy, then a vertical bar that sweeps across with each frame, and a cursor at the last pointer position.
+    drawBackground(tex_width, tex_height);
+    GLint prev = 0;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &prev);
+    glBindTexture(GL_TEXTURE_2D, tex_id);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, tex_width, tex_height, GL_RGBA, GL_UNSIGNED_BYTE, s_pixels.data());
+    int32_t bar = (int32_t)(s_frameNumber % (uint64_t)tex_width);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, bar, 0, 1, tex_height, GL_RGBA, GL_UNSIGNED_BYTE, s_marker.data());
+    int32_t px = s_pointerX, py = s_pointerY;
+    if (px >= 0 && py >= 0 && px + 8 <= tex_width && py + 8 <= tex_height) {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, px, py, 8, 8, GL_RGBA, GL_UNSIGNED_BYTE, s_marker.data());
+    }
+    glBindTexture(GL_TEXTURE_2D, (GLuint)prev);
+}
+
+void resize(int32_t width, int32_t height)
+{
+    s_width = width;
+    s_height = height;
+    requestFrame();
+}
+
+void change_visibility(bool visible)
+{
+    if (visible) requestFrame();
+}
+
+void set_batch_mode(bool batch)
+{
+}
+
+// --------------------------------------------------------------------------
+//  Navigation.
+
+bool is_uri_valid(const char *url)
+{
+    // A scheme, a colon, and something after it.
+    if (!url || !((url[0] >= 'a' && url[0] <= 'z') || (url[0] >= 'A' && url[0] <= 'Z'))) return false;
+    const char *p = url + 1;
+    while ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') || *p == '+' || *p == '-' || *p == '.') p++;
+    return (*p == ':' && p[1] != '\0');
+}
+
+bool load_uri(const char *url)
+{
+    if (!is_uri_valid(url)) return false;
+    std::string u(url);
+    schedule(0, [u]() { startLoad(u, true); });
+    return true;
+}
+
+void reload(void)
+{
+    schedule(0, []() {
+        if (!s_history.empty()) startLoad(s_history[s_historyIndex], false);
+    });
+}
+
+void refresh(void)
+{
+    requestFrame();
+}
+
+void stop(void)
+{
+}
+
+void go_back(void)
+{
+    schedule(0, []() {
+        if (s_historyIndex > 0) startLoad(s_history[--s_historyIndex], false);
+    });
+}
+
+void go_forward(void)
+{
+    schedule(0, []() {
+        if (s_historyIndex + 1 < s_history.size()) startLoad(s_history[++s_historyIndex], false);
+    });
+}
+
+// --------------------------------------------------------------------------
+//  Input.
+
+void mouse_move(float x, float y)
+{
+    s_pointerX = (int32_t)x;
+    s_pointerY = (int32_t)y;
+    input();
+}
+
+void mouse_down(float x, float y, CMouseButton button) { input(); }
+void mouse_up(float x, float y, CMouseButton button) { input(); }
+void click(float x, float y) { input(); }
+void key_down(uint32_t key_code, CKeyType key_type) { input(); }
+void key_up(uint32_t key_code, CKeyType key_type) { input(); }
+void scroll(int32_t dx, int32_t dy, int32_t x, int32_t y) { input(); }
+void scroll_start(int32_t dx, int32_t dy, int32_t x, int32_t y) { input(); }
+void scroll_end(int32_t dx, int32_t dy, int32_t x, int32_t y) { input(); }
+void touch_down(float x, float y, int32_t pointer_id) { input(); }
+void touch_move(float x, float y, int32_t pointer_id) { input(); }
+void touch_up(float x, float y, int32_t pointer_id) { input(); }
+void touch_cancel(float x, float y, int32_t pointer_id) { input(); }
+void pinchzoom_start(float factor, int32_t x, int32_t y) { input(); }
+void pinchzoom(float factor, int32_t x, int32_t y) { input(); }
+void pinchzoom_end(float factor, int32_t x, int32_t y) { input(); }
+void ime_dismissed(void) {}
+void on_context_menu_closed(CContextMenuResult result, uint32_t item) {}
+void media_session_action(CMediaSessionActionType action) {}
+
+// --------------------------------------------------------------------------
+//  Preferences. Values are stored as strings and converted on access.
+//  Pointers returned by get_pref and get_pref_as_* are valid until the next call to either.
+
+CPref get_pref(const char *key)
+{
+    CPref pref = {Missing, key, nullptr, true};
+    auto it = s_prefs.find(key ? key : "");
+    if (it == s_prefs.end()) return pref;
+    s_prefValue = it->second;
+    pref.pref_type = Str;
+    pref.value = &s_prefValue;
+    pref.is_default = false;
+    return pref;
+}
+
+const bool *get_pref_as_bool(const void *ptr)
+{
+    if (!ptr) return nullptr;
+    s_prefBool = (*(const std::string *)ptr == "true");
+    return &s_prefBool;
+}
+
+const double *get_pref_as_float(const void *ptr)
+{
+    if (!ptr) return nullptr;
+    s_prefFloat = strtod(((const std::string *)ptr)->c_str(), nullptr);
+    return &s_prefFloat;
+}
+
+const int64_t *get_pref_as_int(const void *ptr)
+{
+    if (!ptr) return nullptr;
+    s_prefInt = strtoll(((const std::string *)ptr)->c_str(), nullptr, 10);
+    return &s_prefInt;
+}
+
+const char *get_pref_as_str(const void *ptr)
+{
+    return (ptr ? ((const std::string *)ptr)->c_str() : nullptr);
+}
+
+CPrefList get_prefs(void)
+{
+    CPrefList list = {0, nullptr};
+    return list; // Enumeration not supported.
+}
+
+bool set_bool_pref(const char *key, bool value)
+{
+    s_prefs[key] = (value ? "true" : "false");
+    return true;
+}
+
+bool set_float_pref(const char *key, double value)
+{
+    s_prefs[key] = std::to_string(value);
+    return true;
+}
+
+bool set_int_pref(const char *key, int64_t value)
+{
+    s_prefs[key] = std::to_string(value);
+    return true;
+}
+
+bool set_str_pref(const char *key, const char *value)
+{
+    s_prefs[key] = (value ? value : "");
+    return true;
+}
+
+bool reset_pref(const char *key)
+{
+    return s_prefs.erase(key) > 0;
+}
+
+void reset_all_prefs(void)
+{
+    s_prefs.clear();
+}